@@ -87,9 +87,45 @@ typedef union
 	u16 data;
 } tic80_input;
 
+// sound output formats, TIC80_SOUND_STEREO and TIC80_SOUND_FLOAT can be combined
+enum
+{
+	TIC80_SOUND_S16 = 0,
+	TIC80_SOUND_STEREO = 1,
+	TIC80_SOUND_FLOAT = 2,
+};
+
 TIC80_API tic80* tic80_create(s32 samplerate);
 TIC80_API void tic80_load(tic80* tic, void* cart, s32 size);
 TIC80_API void tic80_tick(tic80* tic, tic80_input input);
+
+// makes tic80_tick write sound.count samples per tick straight into 'buffer'
+// (twice as many values for stereo), NULL goes back to the internal s16 buffer
+TIC80_API void tic80_sound_output(tic80* tic, void* buffer, s32 format);
+
+// pulls 'count' samples at any pace, independent of the tick rate; the sound
+// advances a tick at a time as samples are taken and the leftovers are kept
+// for the next call. The first call switches the instance to pulled sound,
+// tic80_tick doesn't fill sound.samples after that; pull 0 samples before the
+// first tick to switch on a clean frame. Call it from the ticking thread or
+// serialize it with tic80_tick.
+TIC80_API s32 tic80_sound_pull(tic80* tic, void* buffer, s32 count, s32 format);
+
+// limits the cart's code to 'instructions' per tick, 0 (the default) is no limit;
+// a tick over the budget is aborted with an error. Only Lua and JS code is counted.
+TIC80_API void tic80_cpu_budget(tic80* tic, u64 instructions);
+
+// instructions the cart's TIC() ran on the last tick
+TIC80_API u64 tic80_cpu_instructions(tic80* tic);
+
+// caps the memory the cart's script VM may hold at 'bytes', 0 (the default) is no
+// limit; Lua and JS allocations past it fail with an out of memory error that
+// stops the cart like any other, Wren is only counted.
+TIC80_API void tic80_memory_limit(tic80* tic, u32 bytes);
+
+// the most memory the cart's script VM has held since it started
+TIC80_API u32 tic80_memory_peak(tic80* tic);
+
 TIC80_API void tic80_delete(tic80* tic);
 
 #ifdef __cplusplus
@@ -46,6 +46,26 @@ static void readConfigVideoScale(Config* config, lua_State* lua)
 	lua_pop(lua, 1);
 }
 
+static void readConfigAudioLatency(Config* config, lua_State* lua)
+{
+	lua_getglobal(lua, "AUDIO_LATENCY");
+
+	if(lua_isinteger(lua, -1))
+		config->data.audioLatency = (s32)lua_tointeger(lua, -1);
+
+	lua_pop(lua, 1);
+}
+
+static void readConfigCpuBudget(Config* config, lua_State* lua)
+{
+	lua_getglobal(lua, "CPU_BUDGET");
+
+	if(lua_isinteger(lua, -1))
+		config->data.cpuBudget = (s32)lua_tointeger(lua, -1);
+
+	lua_pop(lua, 1);
+}
+
 static void readConfigCheckNewVersion(Config* config, lua_State* lua)
 {
 	lua_getglobal(lua, "CHECK_NEW_VERSION");
@@ -155,6 +175,8 @@ static void readConfig(Config* config)
 		{
 			readConfigVideoLength(config, lua);
 			readConfigVideoScale(config, lua);
+			readConfigAudioLatency(config, lua);
+			readConfigCpuBudget(config, lua);
 			readConfigCheckNewVersion(config, lua);
 			readTheme(config, lua);
 		}
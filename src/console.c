@@ -317,6 +317,7 @@ static void loadCart(tic_mem* tic, tic_cartridge* cart, const u8* buffer, s32 si
 static bool loadRom(tic_mem* tic, const void* data, s32 size, bool palette)
 {
 	loadCart(tic, &tic->cart, data, size, palette);
+	tic->api.load_binary(tic, data, size);
 	tic->api.reset(tic);
 
 	return true;
@@ -364,7 +365,10 @@ static bool onConsoleLoadSectionCommand(Console* console, const char* param)
 
 						switch(i)
 						{
-						case 0: memcpy(&tic->cart.gfx.tiles, 	&cart->gfx.tiles, 	sizeof cart->gfx.tiles + sizeof cart->gfx.sprites); break;
+						case 0:
+							memcpy(&tic->cart.gfx.tiles, 	&cart->gfx.tiles, 	sizeof cart->gfx.tiles + sizeof cart->gfx.sprites);
+							memcpy(&tic->cart.flags, 		&cart->flags, 		sizeof cart->flags);
+							break;
 						case 1: memcpy(&tic->cart.gfx.map, 		&cart->gfx.map, 	sizeof cart->gfx.map); break;
 						case 2: memcpy(&tic->cart.cover, 		&cart->cover, 		sizeof cart->cover); break;
 						case 3: memcpy(&tic->cart.code, 		&cart->code, 		sizeof cart->code); break;
@@ -905,6 +909,120 @@ static void onConsoleVersionCommand(Console* console, const char* param)
 	commandDone(console);
 }
 
+#define RENDER_SAMPLERATE 44100
+#define RENDER_MAX_FRAMES (TIC_FRAMERATE * 60 * 10)
+#define RENDER_SFX_FRAMES TIC_FRAMERATE
+
+static void onConsoleRenderCommand(Console* console, const char* param)
+{
+	char kind[16] = {0};
+	s32 index = -1;
+
+	if(param)
+	{
+		const char* value = SDL_strchr(param, ' ');
+
+		if(value)
+		{
+			SDL_strlcpy(kind, param, SDL_min(sizeof kind, value - param + 1));
+			index = SDL_atoi(value + 1);
+		}
+	}
+
+	bool music = strcmp(kind, "music") == 0;
+	bool sfx = strcmp(kind, "sfx") == 0;
+
+	if(!(music && index >= 0 && index < MUSIC_TRACKS) && !(sfx && index >= 0 && index < SFX_COUNT))
+	{
+		printBack(console, "\nusage: render music 0-7|sfx 0-63");
+		commandDone(console);
+		return;
+	}
+
+	tic_mem* tic = tic_create(RENDER_SAMPLERATE);
+
+	if(tic)
+	{
+		const tic_sound* sound = &console->tic->cart.sound;
+		memcpy(&tic->ram.sound, sound, sizeof(tic_sound));
+
+		if(music)
+			tic->api.music(tic, index, -1, -1, false);
+		else
+		{
+			const tic_sound_effect* effect = &sound->sfx.data[index];
+			tic->api.sfx(tic, index, effect->note, effect->octave, RENDER_SFX_FRAMES, 0);
+		}
+
+		u64 start = SDL_GetPerformanceCounter();
+
+		// render a minute at a time, most tracks are much shorter than the limit
+		enum {Chunk = TIC_FRAMERATE * 60};
+		u8* buffer = NULL;
+		s32 frames = 0;
+
+		for(s32 count = Chunk; count == Chunk && frames < RENDER_MAX_FRAMES; frames += count)
+		{
+			u8* data = SDL_realloc(buffer, TIC_WAV_HEADER_SIZE + (frames + Chunk) * tic->samples.size);
+
+			if(!data) break;
+
+			buffer = data;
+			count = tic->api.render_sound(tic, (s16*)(buffer + TIC_WAV_HEADER_SIZE + frames * tic->samples.size), Chunk);
+		}
+
+		double ms = (SDL_GetPerformanceCounter() - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+		if(buffer)
+		{
+			s32 samples = frames * tic->samples.size / sizeof(s16);
+			tic_tool_wav_header(buffer, RENDER_SAMPLERATE, samples);
+
+			char name[FILENAME_MAX];
+			sprintf(name, "%s%i.wav", music ? "track" : "sfx", index);
+
+			if(fsSaveFile(console->fs, name, buffer, TIC_WAV_HEADER_SIZE + samples * sizeof(s16), true))
+			{
+				char info[STUDIO_TEXT_BUFFER_WIDTH * 2];
+				sprintf(info, "\n%s: %.1fs rendered in %ims", name, (double)frames / TIC_FRAMERATE, (s32)ms);
+				printBack(console, info);
+			}
+			else printError(console, "\nrender error :(");
+
+			SDL_free(buffer);
+		}
+
+		tic_close(tic);
+	}
+
+	commandDone(console);
+}
+
+static void onConsoleAudioCommand(Console* console, const char* param)
+{
+	AudioStats stats = getAudioStats();
+
+	char buf[STUDIO_TEXT_BUFFER_WIDTH * 2];
+	sprintf(buf, "\n%iHz latency %ims queued %ims\nunderruns %u overruns %u",
+		stats.freq, stats.latency, stats.queued, stats.underruns, stats.overruns);
+
+	printBack(console, buf);
+	commandDone(console);
+}
+
+static void onConsoleCpuCommand(Console* console, const char* param)
+{
+	tic_cpu_stats stats = console->tic->api.cpu_stats(console->tic);
+	tic_vm_memory vm = console->tic->api.vm_memory(console->tic);
+
+	char buf[STUDIO_TEXT_BUFFER_WIDTH * 3];
+	sprintf(buf, "\nlast frame %llu instructions %.2fms\nbudget %ims\nvm memory %uK peak %uK",
+		(unsigned long long)stats.instructions, stats.ms, getCpuBudget(), (vm.current + 1023) / 1024, (vm.peak + 1023) / 1024);
+
+	printBack(console, buf);
+	commandDone(console);
+}
+
 static void onConsoleConfigCommand(Console* console, const char* param)
 {
 	if(param == NULL)
@@ -1943,8 +2061,20 @@ static CartSaveResult saveCartName(Console* console, const char* name)
 			}
 			else
 			{
+				// the bytecode is signed with the studio's key, only this studio runs it
+				tic->api.compile(tic);
 				s32 size = tic->api.save(&tic->cart, buffer);
 
+				{
+					u8* grown = (u8*)SDL_realloc(buffer, size + tic->api.save_binary(tic, NULL));
+
+					if(grown)
+					{
+						buffer = grown;
+						size += tic->api.save_binary(tic, buffer + size);
+					}
+				}
+
 				name = getCartName(name);
 
 				if(size && fsSaveFile(console->fs, name, buffer, size, true))
@@ -2170,7 +2300,7 @@ static void onConsoleRamCommand(Console* console, const char* param)
 	printLine(console);
 
 	printTable(console, "\n+-----------------------------------+" \
-						"\n|           80K RAM LAYOUT          |" \
+						"\n|           82K RAM LAYOUT          |" \
 						"\n+-------+-------------------+-------+" \
 						"\n| ADDR  | INFO              | SIZE  |" \
 						"\n+-------+-------------------+-------+");
@@ -2194,6 +2324,12 @@ static void onConsoleRamCommand(Console* console, const char* param)
 		{offsetof(tic_ram, sound.music.patterns.data), 	"MUSIC PATTERNS"},
 		{offsetof(tic_ram, sound.music.tracks.data), 	"MUSIC TRACKS"},
 		{offsetof(tic_ram, music_pos), 					"MUSIC POS"},
+		{offsetof(tic_ram, raster.offset), 				"RASTER OFFSETS"},
+		{offsetof(tic_ram, raster.palette), 			"RASTER PAL INDEX"},
+		{offsetof(tic_ram, raster.palettes), 			"RASTER PALETTES"},
+		{offsetof(tic_ram, raster.palettes) + sizeof(tic_palette) * TIC_RASTER_PALETTES, "..."},
+		{offsetof(tic_ram, flags), 						"TILE FLAGS"},
+		{offsetof(tic_ram, flags) + sizeof(tic_flags), 	"..."},
 		{TIC_RAM_SIZE, 									"..."},
 	};
 
@@ -2247,6 +2383,9 @@ static const struct
 	{"config",	NULL, "edit TIC config",			onConsoleConfigCommand},
 	{"keymap",	NULL, "configure keyboard mapping",	onConsoleKeymapCommand},
 	{"version",	NULL, "show the current version",	onConsoleVersionCommand},
+	{"audio",	NULL, "show audio device stats",	onConsoleAudioCommand},
+	{"cpu",		NULL, "show last frame cpu stats",	onConsoleCpuCommand},
+	{"render",	NULL, "render music or sfx to .wav",	onConsoleRenderCommand},
 	{"edit",	NULL, "open cart editor",			onConsoleCodeCommand},
 	{"surf",	NULL, "open carts browser",			onConsoleSurfCommand},
 };
@@ -205,7 +205,36 @@ static void remove_samples( blip_t* m, int count )
 	memset( &buf [remain], 0, count * sizeof buf [0] );
 }
 
-int blip_read_samples( blip_t* m, short out [], int count)
+/* Integrates, high-passes and clamps, writing each sample straight in the
+output format. The integrator feeds back through the clamped sample, so the
+loop is serial; the format switch is hoisted out of it instead. */
+#define READ_SAMPLES( type, convert, channels ) \
+	{\
+		type* dst = (type*) out;\
+		do\
+		{\
+			/* Eliminate fraction */\
+			int s = ARITH_SHIFT( sum, delta_bits );\
+			\
+			sum += *in++;\
+			\
+			CLAMP( s );\
+			\
+			dst [0] = convert( s );\
+			if ( channels == 2 )\
+				dst [1] = dst [0];\
+			dst += channels;\
+			\
+			/* High-pass filter */\
+			sum -= s << (delta_bits - bass_shift);\
+		}\
+		while ( in != end );\
+	}
+
+#define TO_SHORT( s ) ((short) (s))
+#define TO_FLOAT( s ) ((s) * (1.0f / 32768))
+
+int blip_read_samples_ex( blip_t* m, void* out, int count, int format )
 {
 	assert( count >= 0 );
 	
@@ -214,28 +243,18 @@ int blip_read_samples( blip_t* m, short out [], int count)
 	
 	if ( count )
 	{
-		int const step = 1;
 		buf_t const* in  = SAMPLES( m );
 		buf_t const* end = in + count;
 		int sum = m->integrator;
-		do
+		
+		switch ( format & (blip_stereo | blip_float) )
 		{
-			/* Eliminate fraction */
-			int s = ARITH_SHIFT( sum, delta_bits );
-			
-			sum += *in++;
-			
-			CLAMP( s );
-			
-			int size = step;
-			while(size--)
-				*out++ = s;
-			// out += step;
-			
-			/* High-pass filter */
-			sum -= s << (delta_bits - bass_shift);
+		case blip_mono:                 READ_SAMPLES( short, TO_SHORT, 1 ); break;
+		case blip_stereo:               READ_SAMPLES( short, TO_SHORT, 2 ); break;
+		case blip_float:                READ_SAMPLES( float, TO_FLOAT, 1 ); break;
+		case blip_float | blip_stereo:  READ_SAMPLES( float, TO_FLOAT, 2 ); break;
 		}
-		while ( in != end );
+		
 		m->integrator = sum;
 		
 		remove_samples( m, count );
@@ -244,6 +263,11 @@ int blip_read_samples( blip_t* m, short out [], int count)
 	return count;
 }
 
+int blip_read_samples( blip_t* m, short out [], int count)
+{
+	return blip_read_samples_ex( m, out, count, blip_mono );
+}
+
 /* Things that didn't help performance on x86:
 	__attribute__((aligned(128)))
 	#define short int
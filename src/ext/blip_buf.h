@@ -58,6 +58,15 @@ interleaving of two buffers into a stereo sample stream. Outputs 16-bit signed
 samples. Returns number of samples actually read.  */
 int blip_read_samples( blip_t*, short out [], int count);
 
+/** Output formats of blip_read_samples_ex(), blip_stereo and blip_float can
+be combined. */
+enum { blip_mono = 0, blip_stereo = 1, blip_float = 2 };
+
+/** Same as blip_read_samples(), but writes 'format' samples to 'out' in the
+same pass. Stereo writes every sample to both channels of an interleaved frame,
+float scales to [-1, 1). */
+int blip_read_samples_ex( blip_t*, void* out, int count, int format );
+
 /** Frees buffer. No effect if NULL is passed. */
 void blip_delete( blip_t* );
 
@@ -2941,6 +2941,12 @@ typedef struct duk_hthread duk_context;
 
 /* __OVERRIDE_DEFINES__ */
 
+/* TIC-80 runs cart code on a per frame cpu budget, jsapi.c implements the check */
+#define DUK_USE_INTERRUPT_COUNTER
+#define DUK_USE_EXEC_TIMEOUT_CHECK(udata) checkJavascriptBudget(udata)
+#define DUK_HTHREAD_INTCTR_DEFAULT (4L * 1024L)
+extern duk_bool_t checkJavascriptBudget(void* udata);
+
 /*
  *  Date provider selection
  *
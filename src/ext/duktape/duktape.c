@@ -7284,7 +7284,7 @@ DUK_INTERNAL_DECL void duk_hbufobj_promote_plain(duk_context *ctx, duk_idx_t idx
  * for reasonable execution timeout checking but large enough to keep
  * impact on execution performance low.
  */
-#if defined(DUK_USE_INTERRUPT_COUNTER)
+#if defined(DUK_USE_INTERRUPT_COUNTER) && !defined(DUK_HTHREAD_INTCTR_DEFAULT)
 #define DUK_HTHREAD_INTCTR_DEFAULT     (256L * 1024L)
 #endif
 
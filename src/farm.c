@@ -0,0 +1,718 @@
+// MIT License
+
+// Copyright (c) 2017 Vadim Grigoruk @nesbox // grigoruk@gmail.com
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Headless cart farm: ticks many carts through the public tic80 API
+// on a work-stealing thread pool and reports timings and frame hashes.
+// With -m it renders music tracks to .wav instead, one work item per track.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <tic80.h>
+#include "ticapi.h"
+#include "tools.h"
+
+#define FARM_SAMPLERATE 44100
+#define FARM_DEFAULT_FRAMES 600
+#define FARM_RENDER_FRAMES (TIC_FRAMERATE * 60 * 10)
+#define FARM_MAX_THREADS 256
+#define FARM_ERROR_SIZE 128
+#define FARM_DEFAULT_BUDGET 100000000
+#define FARM_DEFAULT_MEMORY (64*1024)
+
+typedef struct
+{
+	const char* path;
+	s32 track; // music track to render, -1 to tick the cart
+
+	s32 frames;
+	double seconds;
+	double p50;
+	double p99;
+	u64 instructions; // the most TIC() ran in one frame
+	u32 memory; // peak bytes the script VM held
+	u64 hash;
+
+	enum
+	{
+		CartOk = 0,
+		CartNotLoaded,
+		CartExit,
+		CartError,
+		CartEmpty,
+	} status;
+
+	char error[FARM_ERROR_SIZE];
+} Cart;
+
+typedef struct
+{
+	pthread_mutex_t lock;
+	s32* items;
+	s32 top;	// thieves take from here
+	s32 bottom;	// the owner pops from here
+} Deque;
+
+typedef struct Farm Farm;
+
+typedef struct
+{
+	Farm* farm;
+	Deque queue;
+	s32 index;
+	pthread_t thread;
+	double* ticks;
+} Worker;
+
+struct Farm
+{
+	Cart* carts;
+	s32 count;
+
+	Worker* workers;
+	s32 threads;
+
+	s32 frames;
+	u64 budget;
+	u32 memory; // KB
+
+	struct
+	{
+		bool enabled;
+		bool all;
+		bool tracks[MUSIC_TRACKS];
+		const char* folder;
+	} render;
+
+	struct
+	{
+		u16* data;
+		s32 count;
+	} input;
+};
+
+// tic80 callbacks carry no user data, every worker runs one cart at a time
+static __thread Cart* CurrentCart = NULL;
+
+static void onError(const char* info)
+{
+	Cart* cart = CurrentCart;
+
+	if(cart && cart->status == CartOk)
+	{
+		cart->status = CartError;
+		snprintf(cart->error, sizeof cart->error, "%s", info);
+
+		for(char* ptr = cart->error; *ptr; ptr++)
+			if(*ptr == '\n' || *ptr == '\r') *ptr = ' ';
+	}
+}
+
+static void onExit()
+{
+	Cart* cart = CurrentCart;
+
+	if(cart && cart->status == CartOk)
+		cart->status = CartExit;
+}
+
+static void onTrace(const char* text, u8 color) {}
+
+static double getTime()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void* readFile(const char* path, s32* size)
+{
+	FILE* file = fopen(path, "rb");
+	void* buffer = NULL;
+
+	if(file)
+	{
+		fseek(file, 0, SEEK_END);
+		*size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		if(*size > 0 && (buffer = malloc(*size)))
+			if(fread(buffer, *size, 1, file) != 1)
+			{
+				free(buffer);
+				buffer = NULL;
+			}
+
+		fclose(file);
+	}
+
+	return buffer;
+}
+
+static u64 hashData(u64 hash, const void* data, s32 size)
+{
+	const u8* ptr = (const u8*)data;
+
+	for(s32 i = 0; i < size; i++)
+	{
+		hash ^= ptr[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static u64 hashScreen(const u32* screen)
+{
+	return hashData(14695981039346656037ULL, screen, TIC80_FULLWIDTH * TIC80_FULLHEIGHT * sizeof(u32));
+}
+
+static int compareTicks(const void* a, const void* b)
+{
+	double left = *(const double*)a, right = *(const double*)b;
+
+	return left < right ? -1 : left > right;
+}
+
+static void getStats(Cart* cart, double* ticks)
+{
+	for(s32 i = 0; i < cart->frames; i++)
+		cart->seconds += ticks[i];
+
+	if(cart->frames)
+	{
+		qsort(ticks, cart->frames, sizeof ticks[0], compareTicks);
+
+		cart->p50 = ticks[(cart->frames - 1) * 50 / 100] * 1000.0;
+		cart->p99 = ticks[(cart->frames - 1) * 99 / 100] * 1000.0;
+	}
+}
+
+static void getWavPath(const Farm* farm, const Cart* cart, char* path, s32 size)
+{
+	const char* name = strrchr(cart->path, '/');
+	name = name ? name + 1 : cart->path;
+
+	const char* ext = strrchr(name, '.');
+	s32 length = ext ? (s32)(ext - name) : (s32)strlen(name);
+
+	snprintf(path, size, "%s/%.*s-%i.wav", farm->render.folder, length, name, cart->track);
+}
+
+static bool isTrackEmpty(const tic_track* track)
+{
+	for(s32 c = 0; c < TIC_SOUND_CHANNELS; c++)
+		if(tic_tool_get_pattern_id(track, 0, c))
+			return false;
+
+	return true;
+}
+
+// the synth only, no script and no SDL, so a track renders as fast as the cpu allows
+static void renderTrack(Farm* farm, Cart* cart, double* ticks)
+{
+	s32 size = 0;
+	void* data = readFile(cart->path, &size);
+
+	if(!data)
+	{
+		cart->status = CartNotLoaded;
+		return;
+	}
+
+	tic_mem* tic = tic_create(FARM_SAMPLERATE);
+
+	if(tic)
+	{
+		tic->api.load(&tic->cart, data, size, true);
+		memcpy(&tic->ram.sound, &tic->cart.sound, sizeof(tic_sound));
+
+		if(isTrackEmpty(&tic->ram.sound.music.tracks.data[cart->track]))
+			cart->status = CartEmpty;
+		else
+		{
+			char path[FILENAME_MAX];
+			getWavPath(farm, cart, path, sizeof path);
+
+			FILE* file = fopen(path, "wb");
+
+			if(file)
+			{
+				u8 header[TIC_WAV_HEADER_SIZE] = {0};
+				fwrite(header, sizeof header, 1, file);
+
+				s16* samples = malloc(tic->samples.size);
+				s32 count = tic->samples.size / sizeof(s16);
+				u64 hash = 14695981039346656037ULL;
+
+				tic->api.music(tic, cart->track, -1, -1, false);
+
+				for(s32 i = 0; i < farm->frames; i++)
+				{
+					double start = getTime();
+					s32 rendered = tic->api.render_sound(tic, samples, 1);
+					double time = getTime() - start;
+
+					if(!rendered) break;
+
+					ticks[cart->frames++] = time;
+					hash = hashData(hash, samples, tic->samples.size);
+					fwrite(samples, tic->samples.size, 1, file);
+				}
+
+				free(samples);
+
+				tic_tool_wav_header(header, FARM_SAMPLERATE, cart->frames * count);
+				fseek(file, 0, SEEK_SET);
+				fwrite(header, sizeof header, 1, file);
+				fclose(file);
+
+				cart->hash = hash;
+			}
+			else
+			{
+				cart->status = CartError;
+				snprintf(cart->error, sizeof cart->error, "can't write to %s", farm->render.folder);
+			}
+		}
+
+		tic_close(tic);
+	}
+	else cart->status = CartNotLoaded;
+
+	free(data);
+
+	getStats(cart, ticks);
+}
+
+static void runCart(Farm* farm, Cart* cart, double* ticks)
+{
+	if(cart->track >= 0)
+	{
+		renderTrack(farm, cart, ticks);
+		return;
+	}
+
+	s32 size = 0;
+	void* data = readFile(cart->path, &size);
+
+	if(!data)
+	{
+		cart->status = CartNotLoaded;
+		return;
+	}
+
+	tic80* tic = tic80_create(FARM_SAMPLERATE);
+
+	if(tic)
+	{
+		tic->callback.error = onError;
+		tic->callback.exit = onExit;
+		tic->callback.trace = onTrace;
+
+		CurrentCart = cart;
+
+		tic80_cpu_budget(tic, farm->budget);
+		tic80_memory_limit(tic, farm->memory * 1024);
+		tic80_load(tic, data, size);
+
+		for(s32 i = 0; i < farm->frames && cart->status == CartOk; i++)
+		{
+			tic80_input input = {.data = i < farm->input.count ? farm->input.data[i] : 0};
+
+			double start = getTime();
+			tic80_tick(tic, input);
+			ticks[cart->frames++] = getTime() - start;
+
+			u64 instructions = tic80_cpu_instructions(tic);
+			if(instructions > cart->instructions) cart->instructions = instructions;
+		}
+
+		cart->memory = tic80_memory_peak(tic);
+
+		CurrentCart = NULL;
+
+		cart->hash = hashScreen(tic->screen);
+
+		tic80_delete(tic);
+	}
+	else cart->status = CartNotLoaded;
+
+	free(data);
+
+	getStats(cart, ticks);
+}
+
+static bool popOwn(Deque* queue, s32* item)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&queue->lock);
+
+	if(queue->bottom > queue->top)
+	{
+		*item = queue->items[--queue->bottom];
+		found = true;
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return found;
+}
+
+static bool steal(Deque* queue, s32* item)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&queue->lock);
+
+	if(queue->bottom > queue->top)
+	{
+		*item = queue->items[queue->top++];
+		found = true;
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+
+	return found;
+}
+
+// no work is added once the pool starts, so a failed pass over all victims means we're done
+static bool nextCart(Worker* worker, s32* item)
+{
+	Farm* farm = worker->farm;
+
+	if(popOwn(&worker->queue, item))
+		return true;
+
+	for(s32 i = 1; i < farm->threads; i++)
+		if(steal(&farm->workers[(worker->index + i) % farm->threads].queue, item))
+			return true;
+
+	return false;
+}
+
+static void* workerThread(void* data)
+{
+	Worker* worker = (Worker*)data;
+	s32 item = 0;
+
+	while(nextCart(worker, &item))
+		runCart(worker->farm, &worker->farm->carts[item], worker->ticks);
+
+	return NULL;
+}
+
+static void runFarm(Farm* farm)
+{
+	farm->workers = calloc(farm->threads, sizeof(Worker));
+
+	for(s32 i = 0; i < farm->threads; i++)
+	{
+		Worker* worker = &farm->workers[i];
+
+		worker->farm = farm;
+		worker->index = i;
+		worker->ticks = malloc(farm->frames * sizeof(double));
+		worker->queue.items = malloc(farm->count * sizeof(s32));
+		pthread_mutex_init(&worker->queue.lock, NULL);
+	}
+
+	// deal the carts round robin, stealing evens out the rest
+	for(s32 i = 0; i < farm->count; i++)
+	{
+		Deque* queue = &farm->workers[i % farm->threads].queue;
+		queue->items[queue->bottom++] = i;
+	}
+
+	for(s32 i = 0; i < farm->threads; i++)
+		pthread_create(&farm->workers[i].thread, NULL, workerThread, &farm->workers[i]);
+
+	for(s32 i = 0; i < farm->threads; i++)
+		pthread_join(farm->workers[i].thread, NULL);
+
+	for(s32 i = 0; i < farm->threads; i++)
+	{
+		Worker* worker = &farm->workers[i];
+
+		pthread_mutex_destroy(&worker->queue.lock);
+		free(worker->queue.items);
+		free(worker->ticks);
+	}
+
+	free(farm->workers);
+}
+
+static void addItem(Farm* farm, const char* path, s32 track)
+{
+	farm->carts = realloc(farm->carts, (farm->count + 1) * sizeof(Cart));
+	memset(&farm->carts[farm->count], 0, sizeof(Cart));
+	farm->carts[farm->count].path = path;
+	farm->carts[farm->count++].track = track;
+}
+
+// every requested track is its own work item, so the tracks of one cart render in parallel
+static void addCart(Farm* farm, const char* path)
+{
+	if(farm->render.enabled)
+	{
+		for(s32 i = 0; i < MUSIC_TRACKS; i++)
+			if(farm->render.all || farm->render.tracks[i])
+				addItem(farm, path, i);
+	}
+	else addItem(farm, path, -1);
+}
+
+static bool parseTracks(Farm* farm, const char* value)
+{
+	farm->render.enabled = true;
+
+	if(strcmp(value, "all") == 0)
+	{
+		farm->render.all = true;
+		return true;
+	}
+
+	for(const char* ptr = value; *ptr; ptr++)
+	{
+		char* end = NULL;
+		s32 track = (s32)strtol(ptr, &end, 10);
+
+		if(end == ptr || track < 0 || track >= MUSIC_TRACKS || (*end && *end != ','))
+			return false;
+
+		farm->render.tracks[track] = true;
+
+		if(!*end) break;
+
+		ptr = end;
+	}
+
+	return true;
+}
+
+static char* readLine(char* line)
+{
+	char* end = line + strlen(line);
+
+	while(end > line && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t'))
+		*--end = '\0';
+
+	return line;
+}
+
+static bool loadList(Farm* farm, const char* path)
+{
+	FILE* file = fopen(path, "r");
+
+	if(!file) return false;
+
+	char line[FILENAME_MAX];
+
+	while(fgets(line, sizeof line, file))
+		if(*readLine(line))
+			addCart(farm, strdup(line));
+
+	fclose(file);
+
+	return true;
+}
+
+static bool loadInput(Farm* farm, const char* path)
+{
+	FILE* file = fopen(path, "r");
+
+	if(!file) return false;
+
+	char line[64];
+
+	while(fgets(line, sizeof line, file))
+	{
+		farm->input.data = realloc(farm->input.data, (farm->input.count + 1) * sizeof(u16));
+		farm->input.data[farm->input.count++] = (u16)strtol(readLine(line), NULL, 0);
+	}
+
+	fclose(file);
+
+	return true;
+}
+
+static void printUsage(const char* name)
+{
+	printf("usage: %s [options] cart.tic ...\n"
+		"  -f frames   frames to tick every cart (default %i)\n"
+		"  -t threads  worker threads (default: online cpus)\n"
+		"  -l file     read cart paths from file, one per line\n"
+		"  -i file     scripted input, one tic80_input value per frame (0x.. allowed),\n"
+		"              frames past the end of the script get zero input\n"
+		"  -b budget   instructions a Lua or JS cart may run per frame before it's\n"
+		"              stopped with an error, 0 for no limit (default %llu)\n"
+		"  -k kbytes   memory a cart's script VM may hold, Lua and JS carts going over\n"
+		"              it are stopped with an error, 0 for no limit, at most 4194303\n"
+		"              (default %i)\n"
+		"  -m tracks   render music tracks to .wav instead of ticking, comma separated\n"
+		"              track numbers or 'all', -f caps the length (default %i)\n"
+		"  -o folder   where the .wav files go (default: current folder)\n",
+		name, FARM_DEFAULT_FRAMES, (unsigned long long)FARM_DEFAULT_BUDGET, FARM_DEFAULT_MEMORY, FARM_RENDER_FRAMES);
+}
+
+static const char* statusName(const Cart* cart)
+{
+	switch(cart->status)
+	{
+	case CartOk: return "ok";
+	case CartNotLoaded: return "not loaded";
+	case CartExit: return "exit";
+	case CartError: return cart->error;
+	case CartEmpty: return "empty";
+	}
+
+	return "";
+}
+
+int main(int argc, char** argv)
+{
+	Farm farm =
+	{
+		.frames = 0,
+		.threads = (s32)sysconf(_SC_NPROCESSORS_ONLN),
+		.budget = FARM_DEFAULT_BUDGET,
+		.memory = FARM_DEFAULT_MEMORY,
+		.render.folder = ".",
+	};
+
+	// -m changes how cart paths become work items, so it has to be known up front
+	for(s32 i = 1; i + 1 < argc; i++)
+		if(strcmp(argv[i], "-m") == 0 && !parseTracks(&farm, argv[i + 1]))
+		{
+			fprintf(stderr, "bad track list %s\n", argv[i + 1]);
+			return 1;
+		}
+
+	for(s32 i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+
+		if(arg[0] == '-' && arg[1] && !arg[2] && i + 1 < argc)
+		{
+			const char* value = argv[++i];
+
+			switch(arg[1])
+			{
+			case 'f': farm.frames = atoi(value); break;
+			case 't': farm.threads = atoi(value); break;
+			case 'b': farm.budget = strtoull(value, NULL, 0); break;
+			case 'k':
+				{
+					// the limit goes to the VM in bytes, as a u32
+					unsigned long long kbytes = strtoull(value, NULL, 0);
+
+					if(kbytes > UINT32_MAX / 1024)
+					{
+						fprintf(stderr, "memory limit %s is over %u KB\n", value, UINT32_MAX / 1024);
+						return 1;
+					}
+
+					farm.memory = (u32)kbytes;
+				}
+				break;
+			case 'm': break;
+			case 'o': farm.render.folder = value; break;
+			case 'l':
+				if(!loadList(&farm, value))
+				{
+					fprintf(stderr, "can't read cart list %s\n", value);
+					return 1;
+				}
+				break;
+			case 'i':
+				if(!loadInput(&farm, value))
+				{
+					fprintf(stderr, "can't read input script %s\n", value);
+					return 1;
+				}
+				break;
+			default:
+				printUsage(argv[0]);
+				return 1;
+			}
+		}
+		else if(arg[0] == '-')
+		{
+			printUsage(argv[0]);
+			return 1;
+		}
+		else addCart(&farm, arg);
+	}
+
+	if(farm.frames == 0)
+		farm.frames = farm.render.enabled ? FARM_RENDER_FRAMES : FARM_DEFAULT_FRAMES;
+
+	if(farm.count == 0 || farm.frames <= 0)
+	{
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	if(farm.threads < 1) farm.threads = 1;
+	if(farm.threads > FARM_MAX_THREADS) farm.threads = FARM_MAX_THREADS;
+	if(farm.threads > farm.count) farm.threads = farm.count;
+
+	double start = getTime();
+	runFarm(&farm);
+	double wall = getTime() - start;
+
+	s32 frames = 0;
+	s32 failed = 0;
+
+	printf("%-40s %7s %9s %8s %8s %10s %8s %-16s %s\n", "cart", "frames", "fps", "p50 ms", "p99 ms", "max instr", "peak KB", "hash", "status");
+
+	for(s32 i = 0; i < farm.count; i++)
+	{
+		const Cart* cart = &farm.carts[i];
+
+		char name[FILENAME_MAX];
+		if(cart->track >= 0)
+			snprintf(name, sizeof name, "%s:%i", cart->path, cart->track);
+		else snprintf(name, sizeof name, "%s", cart->path);
+
+		printf("%-40s %7i %9.1f %8.3f %8.3f %10llu %8u %016llx %s\n", name, cart->frames,
+			cart->seconds > 0 ? cart->frames / cart->seconds : 0.0,
+			cart->p50, cart->p99, (unsigned long long)cart->instructions, (cart->memory + 1023) / 1024,
+			(unsigned long long)cart->hash, statusName(cart));
+
+		frames += cart->frames;
+
+		if(cart->status == CartNotLoaded || cart->status == CartError)
+			failed++;
+	}
+
+	printf("%i carts (%i failed), %i threads, %i frames in %.2fs, %.1f frames/s\n",
+		farm.count, failed, farm.threads, frames, wall, wall > 0 ? frames / wall : 0.0);
+
+	return failed ? 2 : 0;
+}
@@ -26,6 +26,8 @@
 #include "ext/duktape/duktape.h"
 
 static const char TicMachine[] = "_TIC80";
+static const char TicRam[] = "_TIC80RAM";
+static const char TicScanline[] = "_TIC80SCN";
 
 void closeJavascript(tic_machine* machine)
 {
@@ -33,7 +35,22 @@ void closeJavascript(tic_machine* machine)
 	{
 		duk_destroy_heap(machine->js);
 		machine->js = NULL;
+
+		closeVmHeap(&machine->heap);
 	}
+
+	if(machine->jsRamView.live)
+	{
+		machine->jsRamView.live = false;
+		machine->memory.api.shadow_screen(&machine->memory, machine->jsRamView.shadow);
+	}
+}
+
+// the cart may have written tiles or sfx through RAM, called when a callback returns
+static void syncRamView(tic_machine* machine)
+{
+	if(machine->jsRamView.live)
+		machine->memory.api.invalidate(&machine->memory, &machine->memory.ram, sizeof(tic_ram));
 }
 
 static tic_machine* getDukMachine(duk_context* duk)
@@ -137,43 +154,49 @@ static duk_ret_t duk_rectb(duk_context* duk)
 	return 0;
 }
 
-static duk_ret_t duk_spr(duk_context* duk)
+// a single color or an array of them
+static s32 getDukColorKey(duk_context* duk, duk_idx_t index, u8* colors)
 {
-	static u8 colors[TIC_PALETTE_SIZE];
 	s32 count = 0;
 
-	s32 index = duk_is_null_or_undefined(duk, 0) ? 0						: duk_to_int(duk, 0);
-	s32 x = duk_is_null_or_undefined(duk, 1) ? 0							: duk_to_int(duk, 1);
-	s32 y = duk_is_null_or_undefined(duk, 2) ? 0							: duk_to_int(duk, 2);
-
+	if(duk_is_array(duk, index))
 	{
-		if(!duk_is_null_or_undefined(duk, 3))
+		for(s32 i = 0; i < TIC_PALETTE_SIZE; i++)
 		{
-			if(duk_is_array(duk, 3))
+			duk_get_prop_index(duk, index, i);
+			if(duk_is_null_or_undefined(duk, -1))
 			{
-				for(s32 i = 0; i < TIC_PALETTE_SIZE; i++)
-				{
-					duk_get_prop_index(duk, 3, i);
-					if(duk_is_null_or_undefined(duk, -1))
-					{
-						duk_pop(duk);
-						break;
-					}
-					else
-					{
-						colors[i] = duk_to_int(duk, -1);
-						count++;
-						duk_pop(duk);
-					}					
-				}
+				duk_pop(duk);
+				break;
 			}
 			else
 			{
-				colors[0] = duk_to_int(duk, 3);
-				count = 1;
-			}
+				colors[i] = duk_to_int(duk, -1);
+				count++;
+				duk_pop(duk);
+			}					
 		}
 	}
+	else
+	{
+		colors[0] = duk_to_int(duk, index);
+		count = 1;
+	}
+
+	return count;
+}
+
+static duk_ret_t duk_spr(duk_context* duk)
+{
+	u8 colors[TIC_PALETTE_SIZE];
+	s32 count = 0;
+
+	s32 index = duk_is_null_or_undefined(duk, 0) ? 0						: duk_to_int(duk, 0);
+	s32 x = duk_is_null_or_undefined(duk, 1) ? 0							: duk_to_int(duk, 1);
+	s32 y = duk_is_null_or_undefined(duk, 2) ? 0							: duk_to_int(duk, 2);
+
+	if(!duk_is_null_or_undefined(duk, 3))
+		count = getDukColorKey(duk, 3, colors);
 
 	s32 scale = duk_is_null_or_undefined(duk, 4) ? 1						: duk_to_int(duk, 4);
 	tic_flip flip = duk_is_null_or_undefined(duk, 5) ? tic_no_flip			: duk_to_int(duk, 5);
@@ -187,6 +210,135 @@ static duk_ret_t duk_spr(duk_context* duk)
 	return 0;
 }
 
+// batch calls take a flat array of instance fields (typed arrays too), or an array with an array per instance
+typedef struct
+{
+	s32 count;
+	s32 stride;
+	bool nested;
+} DukBatch;
+
+static bool getDukBatch(duk_context* duk, s32 stride, DukBatch* batch)
+{
+	if(!duk_is_object(duk, 0))
+		return false;
+
+	duk_get_prop_index(duk, 0, 0);
+	batch->nested = duk_is_object(duk, -1);
+	duk_pop(duk);
+
+	s32 length = (s32)duk_get_length(duk, 0);
+
+	batch->stride = stride;
+	batch->count = batch->nested ? length : length / stride;
+
+	return true;
+}
+
+// missing fields read as 0, an instance that isn't an object is skipped
+static bool getDukInstance(duk_context* duk, const DukBatch* batch, s32 index, s32* fields)
+{
+	if(batch->nested)
+	{
+		duk_get_prop_index(duk, 0, index);
+
+		if(!duk_is_object(duk, -1))
+		{
+			duk_pop(duk);
+			return false;
+		}
+
+		for(s32 i = 0; i < batch->stride; i++)
+		{
+			duk_get_prop_index(duk, -1, i);
+			fields[i] = duk_to_int(duk, -1);
+			duk_pop(duk);
+		}
+
+		duk_pop(duk);
+	}
+	else
+	{
+		for(s32 i = 0; i < batch->stride; i++)
+		{
+			duk_get_prop_index(duk, 0, index * batch->stride + i);
+			fields[i] = duk_to_int(duk, -1);
+			duk_pop(duk);
+		}
+	}
+
+	return true;
+}
+
+// instances are [index, x, y, flip, rotate]
+static duk_ret_t duk_sprlist(duk_context* duk)
+{
+	DukBatch batch;
+
+	if(getDukBatch(duk, 5, &batch))
+	{
+		u8 colors[TIC_PALETTE_SIZE];
+		s32 count = duk_is_null_or_undefined(duk, 1) ? 0	: getDukColorKey(duk, 1, colors);
+		s32 scale = duk_is_null_or_undefined(duk, 2) ? 1	: duk_to_int(duk, 2);
+		s32 w = duk_is_null_or_undefined(duk, 3) ? 1		: duk_to_int(duk, 3);
+		s32 h = duk_is_null_or_undefined(duk, 4) ? 1		: duk_to_int(duk, 4);
+
+		tic_mem* memory = (tic_mem*)getDukMachine(duk);
+
+		for(s32 i = 0; i < batch.count; i++)
+		{
+			s32 f[5];
+
+			if(getDukInstance(duk, &batch, i, f))
+				memory->api.sprite_ex(memory, &memory->ram.gfx, f[0], f[1], f[2], w, h, colors, count, scale, f[3], f[4]);
+		}
+	}
+
+	return 0;
+}
+
+// instances are [x, y, color]
+static duk_ret_t duk_pixlist(duk_context* duk)
+{
+	DukBatch batch;
+
+	if(getDukBatch(duk, 3, &batch))
+	{
+		tic_mem* memory = (tic_mem*)getDukMachine(duk);
+
+		for(s32 i = 0; i < batch.count; i++)
+		{
+			s32 f[3];
+
+			if(getDukInstance(duk, &batch, i, f))
+				memory->api.pixel(memory, f[0], f[1], f[2]);
+		}
+	}
+
+	return 0;
+}
+
+// instances are [x, y, w, h, color]
+static duk_ret_t duk_rectlist(duk_context* duk)
+{
+	DukBatch batch;
+
+	if(getDukBatch(duk, 5, &batch))
+	{
+		tic_mem* memory = (tic_mem*)getDukMachine(duk);
+
+		for(s32 i = 0; i < batch.count; i++)
+		{
+			s32 f[5];
+
+			if(getDukInstance(duk, &batch, i, f))
+				memory->api.rect(memory, f[0], f[1], f[2], f[3], f[4]);
+		}
+	}
+
+	return 0;
+}
+
 static duk_ret_t duk_btn(duk_context* duk)
 {
 	tic_machine* machine = getDukMachine(duk);
@@ -347,6 +499,38 @@ static void remapCallback(void* data, s32 x, s32 y, RemapResult* result)
 	duk_pop(duk);
 }
 
+// indices are tile indices, an entry is the new index or [index, flip, rotate], missing entries stay as they are
+static void getDukRemapTable(duk_context* duk, duk_idx_t index, RemapResult* table)
+{
+	for(s32 i = 0; i < TIC_REMAP_SIZE; i++)
+	{
+		RemapResult* tile = &table[i];
+
+		tile->index = i;
+		tile->flip = tic_no_flip;
+		tile->rotate = tic_no_rotate;
+
+		duk_get_prop_index(duk, index, i);
+
+		if(duk_is_array(duk, -1))
+		{
+			duk_get_prop_index(duk, -1, 0);
+			duk_get_prop_index(duk, -2, 1);
+			duk_get_prop_index(duk, -3, 2);
+
+			tile->index = duk_to_int(duk, -3);
+			tile->flip = duk_to_int(duk, -2) & 0b11;
+			tile->rotate = duk_to_int(duk, -1) & 0b11;
+
+			duk_pop_3(duk);
+		}
+		else if(duk_is_number(duk, -1))
+			tile->index = duk_to_int(duk, -1);
+
+		duk_pop(duk);
+	}
+}
+
 static duk_ret_t duk_map(duk_context* duk)
 {
 	s32 x = duk_is_null_or_undefined(duk, 0) ? 0 : duk_to_int(duk, 0);
@@ -362,6 +546,17 @@ static duk_ret_t duk_map(duk_context* duk)
 
 	if (duk_is_null_or_undefined(duk, 8))
 		memory->api.map(memory, &memory->ram.gfx, x, y, w, h, sx, sy, chromakey, scale);
+	else if(duk_is_array(duk, 8) || duk_is_number(duk, 8))
+	{
+		RemapResult table[TIC_REMAP_SIZE];
+
+		if(duk_is_array(duk, 8))
+			getDukRemapTable(duk, 8, table);
+		else if(!loadRemapTable((tic_machine*)memory, duk_to_int(duk, 8), table))
+			duk_error(duk, DUK_ERR_ERROR, "invalid remap table address\n");
+
+		memory->api.remap_table(memory, &memory->ram.gfx, x, y, w, h, sx, sy, chromakey, scale, table);
+	}
 	else
 	{
 		void* remap = duk_get_heapptr(duk, 8);
@@ -374,6 +569,72 @@ static duk_ret_t duk_map(duk_context* duk)
 	return 0;
 }
 
+// hits come as a flat array of x, y, tile with x and y in cells, mask defaults to any flag
+static duk_ret_t duk_mhit(duk_context* duk)
+{
+	s32 x = duk_to_int(duk, 0);
+	s32 y = duk_to_int(duk, 1);
+	s32 w = duk_to_int(duk, 2);
+	s32 h = duk_to_int(duk, 3);
+	u8 mask = duk_is_null_or_undefined(duk, 4) ? 0xff : duk_to_int(duk, 4);
+
+	tic_mem* memory = (tic_mem*)getDukMachine(duk);
+
+	tic_map_hit buffer[TIC_MAP_HITS];
+	tic_map_hit* hits = buffer;
+	s32 count = memory->api.map_hits(memory, &memory->ram.gfx, &memory->ram.flags, x, y, w, h, mask, hits, TIC_MAP_HITS);
+
+	if(count > TIC_MAP_HITS && (hits = malloc(count * sizeof(tic_map_hit))))
+		memory->api.map_hits(memory, &memory->ram.gfx, &memory->ram.flags, x, y, w, h, mask, hits, count);
+	else if(count > TIC_MAP_HITS)
+	{
+		hits = buffer;
+		count = TIC_MAP_HITS;
+	}
+
+	duk_idx_t list = duk_push_array(duk);
+
+	for(s32 i = 0, n = 0; i < count; i++)
+	{
+		duk_push_int(duk, hits[i].x);
+		duk_put_prop_index(duk, list, n++);
+		duk_push_int(duk, hits[i].y);
+		duk_put_prop_index(duk, list, n++);
+		duk_push_uint(duk, hits[i].index);
+		duk_put_prop_index(duk, list, n++);
+	}
+
+	if(hits != buffer)
+		free(hits);
+
+	return 1;
+}
+
+static duk_ret_t duk_fget(duk_context* duk)
+{
+	s32 index = duk_to_int(duk, 0);
+	s32 flag = duk_to_int(duk, 1);
+
+	tic_mem* memory = (tic_mem*)getDukMachine(duk);
+
+	duk_push_boolean(duk, memory->api.flag_get(memory, &memory->ram.flags, index, flag));
+
+	return 1;
+}
+
+static duk_ret_t duk_fset(duk_context* duk)
+{
+	s32 index = duk_to_int(duk, 0);
+	s32 flag = duk_to_int(duk, 1);
+	bool value = duk_to_boolean(duk, 2);
+
+	tic_mem* memory = (tic_mem*)getDukMachine(duk);
+
+	memory->api.flag_set(memory, &memory->ram.flags, index, flag, value);
+
+	return 0;
+}
+
 static duk_ret_t duk_mget(duk_context* duk)
 {
 	s32 x = duk_is_null_or_undefined(duk, 0) ? 0 : duk_to_int(duk, 0);
@@ -407,7 +668,9 @@ static duk_ret_t duk_peek(duk_context* duk)
 	if(address >= 0 && address < sizeof(tic_ram))
 	{
 		tic_machine* machine = getDukMachine(duk);
-		duk_push_uint(duk, *((u8*)&machine->memory.ram + address));
+		u8* ptr = (u8*)&machine->memory.ram + address;
+		machine->memory.api.observe(&machine->memory, ptr, 1);
+		duk_push_uint(duk, *ptr);
 		return 1;
 	}
 
@@ -423,7 +686,9 @@ static duk_ret_t duk_poke(duk_context* duk)
 	if(address >= 0 && address < sizeof(tic_ram))
 	{
 		tic_machine* machine = getDukMachine(duk);
-		*((u8*)&machine->memory.ram + address) = value;
+		u8* ptr = (u8*)&machine->memory.ram + address;
+		*ptr = value;
+		machine->memory.api.invalidate(&machine->memory, ptr, 1);
 	}
 
 	return 0;
@@ -438,6 +703,7 @@ static duk_ret_t duk_peek4(duk_context* duk)
 	{
 		tic_mem* memory = (tic_mem*)getDukMachine(duk);
 
+		memory->api.observe(memory, (u8*)&memory->ram + (address >> 1), 1);
 		duk_push_uint(duk, tic_tool_peek4((u8*)&memory->ram, address));
 		return 1;
 	}
@@ -455,7 +721,9 @@ static duk_ret_t duk_poke4(duk_context* duk)
 	{
 		tic_mem* memory = (tic_mem*)getDukMachine(duk);
 
+		memory->api.observe(memory, (u8*)&memory->ram + (address >> 1), 1);
 		tic_tool_poke4((u8*)&memory->ram, address, value);
+		memory->api.invalidate(memory, (u8*)&memory->ram + (address >> 1), 1);
 	}
 
 	return 0;
@@ -470,8 +738,11 @@ static duk_ret_t duk_memcpy(duk_context* duk)
 
 	if(size >= 0 && size <= sizeof(tic_ram) && dest >= 0 && src >= 0 && dest <= bound && src <= bound)
 	{
-		u8* base = (u8*)&getDukMachine(duk)->memory;
+		tic_mem* memory = (tic_mem*)getDukMachine(duk);
+		u8* base = (u8*)memory;
+		memory->api.observe(memory, base + src, size);
 		memcpy(base + dest, base + src, size);
+		memory->api.invalidate(memory, base + dest, size);
 	}
 
 	return 0;
@@ -486,13 +757,149 @@ static duk_ret_t duk_memset(duk_context* duk)
 
 	if(size >= 0 && size <= sizeof(tic_ram) && dest >= 0 && dest <= bound)
 	{
-		u8* base = (u8*)&getDukMachine(duk)->memory;
+		tic_mem* memory = (tic_mem*)getDukMachine(duk);
+		u8* base = (u8*)memory;
 		memset(base + dest, value, size);
+		memory->api.invalidate(memory, base + dest, size);
 	}
 
 	return 0;
 }
 
+static duk_ret_t duk_pemitter(duk_context* duk)
+{
+	tic_particle_emitter emitter;
+	u8 colors[TIC_PALETTE_SIZE] = {0};
+
+	s32 id = duk_to_int(duk, 0);
+	emitter.life = duk_to_int(duk, 1);
+	emitter.speed = (float)duk_to_number(duk, 2);
+	emitter.angle = (float)duk_to_number(duk, 3);
+	emitter.spread = (float)duk_to_number(duk, 4);
+	emitter.gravity = (float)duk_to_number(duk, 5);
+	emitter.count = duk_is_null_or_undefined(duk, 6) ? 0 : getDukColorKey(duk, 6, colors);
+	memcpy(emitter.colors, colors, sizeof emitter.colors);
+	emitter.sprite = duk_is_null_or_undefined(duk, 7) ? -1 : duk_to_int(duk, 7);
+
+	tic_mem* memory = (tic_mem*)getDukMachine(duk);
+	memory->api.particle_emitter(memory, id, &emitter);
+
+	return 0;
+}
+
+static duk_ret_t duk_pemit(duk_context* duk)
+{
+	s32 id = duk_to_int(duk, 0);
+	s32 x = duk_to_int(duk, 1);
+	s32 y = duk_to_int(duk, 2);
+	s32 count = duk_is_null_or_undefined(duk, 3) ? 1 : duk_to_int(duk, 3);
+
+	tic_mem* memory = (tic_mem*)getDukMachine(duk);
+	memory->api.particle_emit(memory, id, x, y, count);
+
+	return 0;
+}
+
+static duk_ret_t duk_pdraw(duk_context* duk)
+{
+	tic_mem* memory = (tic_mem*)getDukMachine(duk);
+
+	duk_push_uint(duk, memory->api.particle_draw(memory));
+
+	return 1;
+}
+
+static duk_ret_t duk_pclear(duk_context* duk)
+{
+	tic_mem* memory = (tic_mem*)getDukMachine(duk);
+
+	memory->api.particle_clear(memory);
+
+	return 0;
+}
+
+static duk_ret_t duk_memread(duk_context* duk)
+{
+	s32 address = duk_to_int(duk, 0);
+	s32 size = duk_to_int(duk, 1);
+	s32 bound = sizeof(tic_ram) - size;
+
+	if(size >= 0 && size <= sizeof(tic_ram) && address >= 0 && address <= bound)
+	{
+		tic_mem* memory = (tic_mem*)getDukMachine(duk);
+		u8* ptr = (u8*)&memory->ram + address;
+		memory->api.observe(memory, ptr, size);
+
+		void* data = duk_push_fixed_buffer(duk, size);
+		memcpy(data, ptr, size);
+		duk_push_buffer_object(duk, -1, 0, size, DUK_BUFOBJ_UINT8ARRAY);
+		return 1;
+	}
+
+	return 0;
+}
+
+// data is a typed array, an ArrayBuffer or an array of bytes
+static duk_ret_t duk_memwrite(duk_context* duk)
+{
+	s32 address = duk_to_int(duk, 0);
+	duk_size_t size = 0;
+	const u8* data = duk_get_buffer_data(duk, 1, &size);
+	bool array = !data && duk_is_array(duk, 1);
+
+	if(array)
+		size = duk_get_length(duk, 1);
+
+	if((data || array) && size <= sizeof(tic_ram) && address >= 0 && address <= (s32)(sizeof(tic_ram) - size))
+	{
+		tic_mem* memory = (tic_mem*)getDukMachine(duk);
+		u8* ptr = (u8*)&memory->ram + address;
+
+		if(array)
+		{
+			for(s32 i = 0; i < size; i++)
+			{
+				duk_get_prop_index(duk, 1, i);
+				ptr[i] = duk_to_int(duk, -1) & 0xff;
+				duk_pop(duk);
+			}
+		}
+		else memmove(ptr, data, size);
+
+		memory->api.invalidate(memory, ptr, (s32)size);
+	}
+
+	return 0;
+}
+
+// the first read of RAM hands out the view, from then on the caches are resynced when
+// a callback returns, so tiles and sfx written through it are drawn and played from then on
+static duk_ret_t duk_ram(duk_context* duk)
+{
+	tic_machine* machine = getDukMachine(duk);
+
+	duk_push_global_stash(duk);
+
+	if(!machine->jsRamView.live)
+	{
+		machine->jsRamView.live = true;
+		machine->jsRamView.shadow = machine->shadow.enabled;
+
+		// drawing goes to VRAM directly, so the view always sees the screen
+		machine->memory.api.shadow_screen(&machine->memory, false);
+
+		duk_push_external_buffer(duk);
+		duk_config_buffer(duk, -1, &machine->memory.ram, sizeof(tic_ram));
+		duk_push_buffer_object(duk, -1, 0, sizeof(tic_ram), DUK_BUFOBJ_UINT8ARRAY);
+		duk_put_prop_string(duk, -3, TicRam);
+		duk_pop(duk);
+	}
+
+	duk_get_prop_string(duk, -1, TicRam);
+
+	return 1;
+}
+
 static duk_ret_t duk_trace(duk_context* duk)
 {
 	tic_machine* machine = getDukMachine(duk);
@@ -652,6 +1059,12 @@ static duk_ret_t duk_textri(duk_context* duk)
 	tic_mem* memory = (tic_mem*)getDukMachine(duk);
 	bool use_map = duk_is_null_or_undefined(duk, 12) ? false : duk_to_boolean(duk, 12);
 	u8 chroma = duk_is_null_or_undefined(duk, 13) ? 0xff : duk_to_int(duk, 13);
+	bool depth = !duk_is_null_or_undefined(duk, 16);
+	float z[3] = {0};
+
+	if(depth)
+		for (s32 i = 0; i < COUNT_OF(z); i++)
+			z[i] = (float)duk_to_number(duk, i + 14);
 
 	memory->api.textri(memory, pt[0], pt[1],	//	xy 1
 						pt[2], pt[3],	//	xy 2
@@ -660,7 +1073,8 @@ static duk_ret_t duk_textri(duk_context* duk)
 						pt[8], pt[9],	//	uv 2
 						pt[10], pt[11],//  uv 3
 						use_map, // usemap
-						chroma);	//	chroma
+						chroma,	//	chroma
+						z[0], z[1], z[2], depth);
 	
 	return 0;
 }
@@ -746,17 +1160,62 @@ static const struct{duk_c_function func; s32 params;} ApiFunc[] =
 	{duk_circ, 4},
 	{duk_circb, 4},
 	{duk_tri, 7},
-	{duk_textri,14},
+	{duk_textri,17},
 	{duk_clip, 4},
 	{duk_music, 4},
 	{duk_sync, 0},
+	{duk_memread, 2},
+	{duk_memwrite, 2},
+	{duk_sprlist, 5},
+	{duk_pixlist, 1},
+	{duk_rectlist, 1},
+	{duk_pemitter, 8},
+	{duk_pemit, 4},
+	{duk_pdraw, 0},
+	{duk_pclear, 0},
+	{duk_fget, 2},
+	{duk_fset, 3},
+	{duk_mhit, 5},
 };
 
+// Duktape calls it every DUK_HTHREAD_INTCTR_DEFAULT opcodes and keeps throwing while it returns true
+duk_bool_t checkJavascriptBudget(void* udata)
+{
+	// heaps made only to compile have no machine
+	return udata && checkCpuBudget((tic_machine*)udata, DUK_HTHREAD_INTCTR_DEFAULT);
+}
+
+static void reportJavascriptError(tic_machine* machine, duk_context* duk)
+{
+	if(machine->cpu.exceeded)
+	{
+		char buffer[128];
+		getCpuBudgetError(machine, buffer, sizeof buffer);
+		machine->data->error(machine->data->data, buffer);
+	}
+	else machine->data->error(machine->data->data, duk_safe_to_string(duk, -1));
+}
+
+static void* allocDuktape(void* udata, duk_size_t size)
+{
+	return vmRealloc(&((tic_machine*)udata)->heap, NULL, size);
+}
+
+static void* reallocDuktape(void* udata, void* ptr, duk_size_t size)
+{
+	return vmRealloc(&((tic_machine*)udata)->heap, ptr, size);
+}
+
+static void freeDuktape(void* udata, void* ptr)
+{
+	vmRealloc(&((tic_machine*)udata)->heap, ptr, 0);
+}
+
 static void initDuktape(tic_machine* machine)
 {
 	closeJavascript(machine);
 
-	duk_context* duk = machine->js = duk_create_heap_default();
+	duk_context* duk = machine->js = duk_create_heap(allocDuktape, reallocDuktape, freeDuktape, machine, NULL);
 
 	{
 		duk_push_global_stash(duk);
@@ -776,6 +1235,71 @@ static void initDuktape(tic_machine* machine)
 		duk_push_c_function(machine->js, duk_dofile, 1);
 		duk_put_global_string(machine->js, "dofile");
 	}
+
+	{
+		duk_push_global_object(duk);
+		duk_push_string(duk, "RAM");
+		duk_push_c_function(duk, duk_ram, 0);
+		duk_def_prop(duk, -3, DUK_DEFPROP_HAVE_GETTER);
+		duk_pop(duk);
+	}
+
+	// Duktape collects and retries before an allocation over the cap becomes a RangeError
+	machine->heap.capped = true;
+}
+
+static u64 getJavascriptHash(const char* code)
+{
+	return tic_tool_hash(code, (s32)strlen(code), DUK_VERSION);
+}
+
+void compileJavascript(const char* code, CodeBinary* binary)
+{
+	duk_context* duk = duk_create_heap_default();
+
+	if(duk)
+	{
+		binary->chunk.size = 0;
+
+		if(duk_pcompile_string(duk, 0, code) == 0)
+		{
+			duk_size_t size = 0;
+			duk_dump_function(duk);
+			const void* data = duk_get_buffer(duk, -1, &size);
+
+			if(writeCodeChunk(&binary->chunk, data, (s32)size))
+				binary->hash = getJavascriptHash(code);
+			else binary->chunk.size = 0;
+		}
+
+		duk_destroy_heap(duk);
+	}
+}
+
+static duk_ret_t loadBinary(duk_context* duk, void* udata)
+{
+	duk_load_function(duk);
+	return 1;
+}
+
+// leaves the program function on the stack, or the error
+static duk_int_t loadJavascriptCode(tic_machine* machine, const char* code)
+{
+	duk_context* duk = machine->js;
+	const CodeBinary* binary = &machine->binary;
+
+	if(binary->chunk.size && binary->hash == getJavascriptHash(code))
+	{
+		void* data = duk_push_fixed_buffer(duk, binary->chunk.size);
+		memcpy(data, binary->chunk.data, binary->chunk.size);
+
+		if(duk_safe_call(duk, loadBinary, NULL, 1, 1) == DUK_EXEC_SUCCESS)
+			return DUK_EXEC_SUCCESS;
+
+		duk_pop(duk);
+	}
+
+	return duk_pcompile_string(duk, 0, code);
 }
 
 bool initJavascript(tic_machine* machine, const char* code)
@@ -783,13 +1307,17 @@ bool initJavascript(tic_machine* machine, const char* code)
 	initDuktape(machine);
 	duk_context* duktape = machine->js;
 
-	if (duk_pcompile_string(duktape, 0, code) != 0 || duk_peval_string(duktape, code) != 0)
+	// compiled once, running the program function declares the globals
+	if (loadJavascriptCode(machine, code) != 0 || duk_pcall(duktape, 0) != 0)
 	{					
-		machine->data->error(machine->data->data, duk_safe_to_string(duktape, -1));
+		reportJavascriptError(machine, duktape);
 		duk_pop(duktape);
 		return false;
 	}
 
+	duk_pop(duktape);
+	syncRamView(machine);
+
 	return true;
 }
 
@@ -805,9 +1333,11 @@ void callJavascriptTick(tic_machine* machine)
 		{
 			if(duk_pcall(duk, 0) != 0)
 			{
-				machine->data->error(machine->data->data, duk_safe_to_string(duk, -1));
+				reportJavascriptError(machine, duk);
 				duk_pop(duk);
 			}
+
+			syncRamView(machine);
 		}
 		else
 		{
@@ -821,18 +1351,36 @@ void callJavascriptScanline(tic_mem* memory, s32 row)
 	tic_machine* machine = (tic_machine*)memory;
 	duk_context* duk = machine->js;
 
-	const char* ScanlineFunc = ApiKeywords[1];
-
-	if(duk_get_global_string(duk, ScanlineFunc)) 
+	// the function is looked up at row 0 and kept in the stash for the other rows of the frame
+	if(row == 0)
 	{
-		duk_push_int(duk, row);
+		const char* ScanlineFunc = ApiKeywords[1];
+
+		duk_push_global_stash(duk);
+		machine->scanlineCall.defined = duk_get_global_string(duk, ScanlineFunc) && duk_is_function(duk, -1);
 
-		if(duk_pcall(duk, 1) != 0)
+		if(machine->scanlineCall.defined)
+			duk_put_prop_string(duk, -2, TicScanline);
+		else
 		{
-			machine->data->error(machine->data->data, duk_safe_to_string(duk, -1));
 			duk_pop(duk);
+			duk_del_prop_string(duk, -1, TicScanline);
 		}
-		else duk_pop(duk);
+
+		duk_pop(duk);
 	}
-	else duk_pop(duk);
+
+	if(!machine->scanlineCall.defined)
+		return;
+
+	duk_push_global_stash(duk);
+	duk_get_prop_string(duk, -1, TicScanline);
+	duk_remove(duk, -2);
+	duk_push_int(duk, row);
+
+	if(duk_pcall(duk, 1) != 0)
+		reportJavascriptError(machine, duk);
+
+	duk_pop(duk);
+	syncRamView(machine);
 }
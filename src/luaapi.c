@@ -21,6 +21,7 @@
 // SOFTWARE.
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
 #include <lua.h>
 #include <lauxlib.h>
@@ -62,7 +63,9 @@ static s32 lua_peek(lua_State* lua)
 
 	if(address >=0 && address < sizeof(tic_ram))
 	{
-		lua_pushinteger(lua, *((u8*)&machine->memory.ram + address));
+		u8* ptr = (u8*)&machine->memory.ram + address;
+		machine->memory.api.observe(&machine->memory, ptr, 1);
+		lua_pushinteger(lua, *ptr);
 		return 1;
 	}
 
@@ -78,7 +81,9 @@ static s32 lua_poke(lua_State* lua)
 
 	if(address >=0 && address < sizeof(tic_ram))
 	{
-		*((u8*)&machine->memory.ram + address) = value;
+		u8* ptr = (u8*)&machine->memory.ram + address;
+		*ptr = value;
+		machine->memory.api.invalidate(&machine->memory, ptr, 1);
 	}
 
 	return 0;
@@ -94,7 +99,10 @@ static s32 lua_peek4(lua_State* lua)
 
 		if(address >= 0 && address < sizeof(tic_ram)*2)
 		{
-			lua_pushinteger(lua, tic_tool_peek4((u8*)&getLuaMachine(lua)->memory.ram, address));
+			tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+
+			memory->api.observe(memory, (u8*)&memory->ram + (address >> 1), 1);
+			lua_pushinteger(lua, tic_tool_peek4((u8*)&memory->ram, address));
 			return 1;
 		}		
 	}
@@ -114,7 +122,11 @@ static s32 lua_poke4(lua_State* lua)
 
 		if(address >= 0 && address < sizeof(tic_ram)*2)
 		{
-			tic_tool_poke4((u8*)&getLuaMachine(lua)->memory.ram, address, value);
+			tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+
+			memory->api.observe(memory, (u8*)&memory->ram + (address >> 1), 1);
+			tic_tool_poke4((u8*)&memory->ram, address, value);
+			memory->api.invalidate(memory, (u8*)&memory->ram + (address >> 1), 1);
 		}
 	}
 	else luaL_error(lua, "invalid parameters, poke4(addr,value)\n");
@@ -304,6 +316,8 @@ static s32 lua_textri(lua_State* lua)
 		tic_mem* memory = (tic_mem*)getLuaMachine(lua);
 		u8 chroma = 0xff;
 		bool use_map = false;
+		float z[3] = {0};
+		bool depth = false;
 
 		//	check for use map 
 		if (top >= 13)
@@ -311,6 +325,14 @@ static s32 lua_textri(lua_State* lua)
 		//	check for chroma 
 		if (top >= 14)
 			chroma = (u8)getLuaNumber(lua, 14);
+		//	check for depth
+		if (top >= 17)
+		{
+			for (s32 i = 0; i < COUNT_OF(z); i++)
+				z[i] = (float)lua_tonumber(lua, i + 15);
+
+			depth = true;
+		}
 
 		memory->api.textri(memory, pt[0], pt[1],	//	xy 1
 									pt[2], pt[3],	//	xy 2
@@ -319,9 +341,10 @@ static s32 lua_textri(lua_State* lua)
 									pt[8], pt[9],	//	uv 2
 									pt[10], pt[11], //  uv 3
 									use_map,		// use map
-									chroma);		// chroma
+									chroma,			// chroma
+									z[0], z[1], z[2], depth);
 	}
-	else luaL_error(lua, "invalid parameters, textri(x1,y1,x2,y2,x3,y3,u1,v1,u2,v2,u3,v3,[use_map=false],[chroma=off])\n");
+	else luaL_error(lua, "invalid parameters, textri(x1,y1,x2,y2,x3,y3,u1,v1,u2,v2,u3,v3,[use_map=false],[chroma=off],[z1,z2,z3])\n");
 	return 0;
 }
 
@@ -413,6 +436,38 @@ static s32 lua_btn(lua_State* lua)
 	return 0;
 }
 
+// a single color or a table of them
+static s32 getLuaColorKey(lua_State* lua, s32 index, u8* colors)
+{
+	s32 count = 0;
+
+	if(lua_istable(lua, index))
+	{
+		for(s32 i = 1; i <= TIC_PALETTE_SIZE; i++)
+		{
+			lua_rawgeti(lua, index, i);
+			if(lua_isnumber(lua, -1))
+			{
+				colors[i-1] = getLuaNumber(lua, -1);
+				count++;
+				lua_pop(lua, 1);
+			}
+			else
+			{
+				lua_pop(lua, 1);
+				break;
+			}
+		}
+	}
+	else 
+	{
+		colors[0] = getLuaNumber(lua, index);
+		count = 1;
+	}
+
+	return count;
+}
+
 static s32 lua_spr(lua_State* lua)
 {
 	s32 top = lua_gettop(lua);
@@ -425,7 +480,7 @@ static s32 lua_spr(lua_State* lua)
 	s32 scale = 1;
 	tic_flip flip = tic_no_flip;
 	tic_rotate rotate = tic_no_rotate;
-	static u8 colors[TIC_PALETTE_SIZE];
+	u8 colors[TIC_PALETTE_SIZE];
 	s32 count = 0;
 
 	if(top >= 1) 
@@ -439,29 +494,7 @@ static s32 lua_spr(lua_State* lua)
 
 			if(top >= 4)
 			{
-				if(lua_istable(lua, 4))
-				{
-					for(s32 i = 1; i <= TIC_PALETTE_SIZE; i++)
-					{
-						lua_rawgeti(lua, 4, i);
-						if(lua_isnumber(lua, -1))
-						{
-							colors[i-1] = getLuaNumber(lua, -1);
-							count++;
-							lua_pop(lua, 1);
-						}
-						else
-						{
-							lua_pop(lua, 1);
-							break;
-						}
-					}
-				}
-				else 
-				{
-					colors[0] = getLuaNumber(lua, 4);
-					count = 1;
-				}
+				count = getLuaColorKey(lua, 4, colors);
 
 				if(top >= 5)
 				{
@@ -494,6 +527,139 @@ static s32 lua_spr(lua_State* lua)
 	return 0;
 }
 
+// batch calls take a flat list of instance fields, or a list with a table per instance
+typedef struct
+{
+	s32 count;
+	s32 stride;
+	bool nested;
+} LuaBatch;
+
+static bool getLuaBatch(lua_State* lua, s32 stride, LuaBatch* batch)
+{
+	if(!lua_istable(lua, 1))
+		return false;
+
+	lua_rawgeti(lua, 1, 1);
+	batch->nested = lua_istable(lua, -1);
+	lua_pop(lua, 1);
+
+	s32 length = (s32)lua_rawlen(lua, 1);
+
+	batch->stride = stride;
+	batch->count = batch->nested ? length : length / stride;
+
+	return true;
+}
+
+// missing fields read as 0, an instance that isn't a table is skipped
+static bool getLuaInstance(lua_State* lua, const LuaBatch* batch, s32 index, s32* fields)
+{
+	if(batch->nested)
+	{
+		lua_rawgeti(lua, 1, index + 1);
+
+		if(!lua_istable(lua, -1))
+		{
+			lua_pop(lua, 1);
+			return false;
+		}
+
+		for(s32 i = 0; i < batch->stride; i++)
+		{
+			lua_rawgeti(lua, -1, i + 1);
+			fields[i] = getLuaNumber(lua, -1);
+			lua_pop(lua, 1);
+		}
+
+		lua_pop(lua, 1);
+	}
+	else
+	{
+		for(s32 i = 0; i < batch->stride; i++)
+		{
+			lua_rawgeti(lua, 1, index * batch->stride + i + 1);
+			fields[i] = getLuaNumber(lua, -1);
+			lua_pop(lua, 1);
+		}
+	}
+
+	return true;
+}
+
+// instances are {index, x, y, flip, rotate}
+static s32 lua_sprlist(lua_State* lua)
+{
+	s32 top = lua_gettop(lua);
+	LuaBatch batch;
+
+	if(top >= 1 && getLuaBatch(lua, 5, &batch))
+	{
+		u8 colors[TIC_PALETTE_SIZE];
+		s32 count = top >= 2 ? getLuaColorKey(lua, 2, colors) : 0;
+		s32 scale = top >= 3 ? getLuaNumber(lua, 3) : 1;
+		s32 w = top >= 5 ? getLuaNumber(lua, 4) : 1;
+		s32 h = top >= 5 ? getLuaNumber(lua, 5) : 1;
+
+		tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+
+		for(s32 i = 0; i < batch.count; i++)
+		{
+			s32 f[5];
+
+			if(getLuaInstance(lua, &batch, i, f))
+				memory->api.sprite_ex(memory, &memory->ram.gfx, f[0], f[1], f[2], w, h, colors, count, scale, f[3], f[4]);
+		}
+	}
+	else luaL_error(lua, "invalid parameters, sprlist(list [colorkey scale w h])\n");
+
+	return 0;
+}
+
+// instances are {x, y, color}
+static s32 lua_pixlist(lua_State* lua)
+{
+	LuaBatch batch;
+
+	if(lua_gettop(lua) >= 1 && getLuaBatch(lua, 3, &batch))
+	{
+		tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+
+		for(s32 i = 0; i < batch.count; i++)
+		{
+			s32 f[3];
+
+			if(getLuaInstance(lua, &batch, i, f))
+				memory->api.pixel(memory, f[0], f[1], f[2]);
+		}
+	}
+	else luaL_error(lua, "invalid parameters, pixlist(list)\n");
+
+	return 0;
+}
+
+// instances are {x, y, w, h, color}
+static s32 lua_rectlist(lua_State* lua)
+{
+	LuaBatch batch;
+
+	if(lua_gettop(lua) >= 1 && getLuaBatch(lua, 5, &batch))
+	{
+		tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+
+		for(s32 i = 0; i < batch.count; i++)
+		{
+			s32 f[5];
+
+			if(getLuaInstance(lua, &batch, i, f))
+				memory->api.rect(memory, f[0], f[1], f[2], f[3], f[4]);
+		}
+	}
+	else luaL_error(lua, "invalid parameters, rectlist(list)\n");
+
+	return 0;
+}
+
 static s32 lua_mget(lua_State* lua)
 {
 	s32 top = lua_gettop(lua);
@@ -514,6 +680,93 @@ static s32 lua_mget(lua_State* lua)
 	return 0;
 }
 
+// hits come as a flat list of x, y, tile with x and y in cells, mask defaults to any flag
+static s32 lua_mhit(lua_State* lua)
+{
+	s32 top = lua_gettop(lua);
+
+	if(top >= 4)
+	{
+		s32 x = getLuaNumber(lua, 1);
+		s32 y = getLuaNumber(lua, 2);
+		s32 w = getLuaNumber(lua, 3);
+		s32 h = getLuaNumber(lua, 4);
+		u8 mask = top >= 5 ? getLuaNumber(lua, 5) : 0xff;
+
+		tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+
+		tic_map_hit buffer[TIC_MAP_HITS];
+		tic_map_hit* hits = buffer;
+		s32 count = memory->api.map_hits(memory, &memory->ram.gfx, &memory->ram.flags, x, y, w, h, mask, hits, TIC_MAP_HITS);
+
+		if(count > TIC_MAP_HITS && (hits = malloc(count * sizeof(tic_map_hit))))
+			memory->api.map_hits(memory, &memory->ram.gfx, &memory->ram.flags, x, y, w, h, mask, hits, count);
+		else if(count > TIC_MAP_HITS)
+		{
+			hits = buffer;
+			count = TIC_MAP_HITS;
+		}
+
+		lua_createtable(lua, count * 3, 0);
+
+		for(s32 i = 0, n = 1; i < count; i++)
+		{
+			lua_pushinteger(lua, hits[i].x);
+			lua_rawseti(lua, -2, n++);
+			lua_pushinteger(lua, hits[i].y);
+			lua_rawseti(lua, -2, n++);
+			lua_pushinteger(lua, hits[i].index);
+			lua_rawseti(lua, -2, n++);
+		}
+
+		if(hits != buffer)
+			free(hits);
+
+		return 1;
+	}
+	else luaL_error(lua, "invalid params, mhit(x,y,w,h,[mask])\n");
+
+	return 0;
+}
+
+static s32 lua_fget(lua_State* lua)
+{
+	s32 top = lua_gettop(lua);
+
+	if(top == 2)
+	{
+		s32 index = getLuaNumber(lua, 1);
+		s32 flag = getLuaNumber(lua, 2);
+
+		tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+
+		lua_pushboolean(lua, memory->api.flag_get(memory, &memory->ram.flags, index, flag));
+		return 1;
+	}
+	else luaL_error(lua, "invalid params, fget(index,flag)\n");
+
+	return 0;
+}
+
+static s32 lua_fset(lua_State* lua)
+{
+	s32 top = lua_gettop(lua);
+
+	if(top == 3)
+	{
+		s32 index = getLuaNumber(lua, 1);
+		s32 flag = getLuaNumber(lua, 2);
+		bool value = lua_toboolean(lua, 3);
+
+		tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+
+		memory->api.flag_set(memory, &memory->ram.flags, index, flag, value);
+	}
+	else luaL_error(lua, "invalid params, fset(index,flag,value)\n");
+
+	return 0;
+}
+
 static s32 lua_mset(lua_State* lua)
 {
 	s32 top = lua_gettop(lua);
@@ -555,6 +808,38 @@ static void remapCallback(void* data, s32 x, s32 y, RemapResult* result)
 	result->rotate = getLuaNumber(lua, -1);
 }
 
+// keys are tile indices from 0, a value is the new index or {index, flip, rotate}, tiles without one stay as they are
+static void getLuaRemapTable(lua_State* lua, s32 index, RemapResult* table)
+{
+	for(s32 i = 0; i < TIC_REMAP_SIZE; i++)
+	{
+		RemapResult* tile = &table[i];
+
+		tile->index = i;
+		tile->flip = tic_no_flip;
+		tile->rotate = tic_no_rotate;
+
+		lua_rawgeti(lua, index, i);
+
+		if(lua_istable(lua, -1))
+		{
+			lua_rawgeti(lua, -1, 1);
+			lua_rawgeti(lua, -2, 2);
+			lua_rawgeti(lua, -3, 3);
+
+			tile->index = getLuaNumber(lua, -3);
+			tile->flip = getLuaNumber(lua, -2) & 0b11;
+			tile->rotate = getLuaNumber(lua, -1) & 0b11;
+
+			lua_pop(lua, 3);
+		}
+		else if(lua_isnumber(lua, -1))
+			tile->index = getLuaNumber(lua, -1);
+
+		lua_pop(lua, 1);
+	}
+}
+
 static s32 lua_map(lua_State* lua)
 {
 	s32 x = 0;
@@ -606,7 +891,22 @@ static s32 lua_map(lua_State* lua)
 								luaL_unref(lua, LUA_REGISTRYINDEX, data.reg);
 
 								return 0;
-							}							
+							}
+							else if(lua_istable(lua, 9) || lua_isnumber(lua, 9))
+							{
+								RemapResult table[TIC_REMAP_SIZE];
+								tic_machine* machine = getLuaMachine(lua);
+								tic_mem* memory = &machine->memory;
+
+								if(lua_istable(lua, 9))
+									getLuaRemapTable(lua, 9, table);
+								else if(!loadRemapTable(machine, getLuaNumber(lua, 9), table))
+									luaL_error(lua, "invalid remap table address\n");
+
+								memory->api.remap_table(memory, &memory->ram.gfx, x, y, w, h, sx, sy, chromakey, scale, table);
+
+								return 0;
+							}
 						}
 					}
 				}
@@ -762,8 +1062,11 @@ static s32 lua_memcpy(lua_State* lua)
 
 		if(size >= 0 && size <= sizeof(tic_ram) && dest >= 0 && src >= 0 && dest <= bound && src <= bound)
 		{
-			u8* base = (u8*)&getLuaMachine(lua)->memory;
+			tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+			u8* base = (u8*)memory;
+			memory->api.observe(memory, base + src, size);
 			memcpy(base + dest, base + src, size);
+			memory->api.invalidate(memory, base + dest, size);
 			return 0;
 		}
 	}
@@ -786,8 +1089,10 @@ static s32 lua_memset(lua_State* lua)
 
 		if(size >= 0 && size <= sizeof(tic_ram) && dest >= 0 && dest <= bound)
 		{
-			u8* base = (u8*)&getLuaMachine(lua)->memory;
+			tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+			u8* base = (u8*)memory;
 			memset(base + dest, value, size);
+			memory->api.invalidate(memory, base + dest, size);
 			return 0;
 		}
 	}
@@ -797,6 +1102,136 @@ static s32 lua_memset(lua_State* lua)
 	return 0;
 }
 
+static s32 lua_pemitter(lua_State* lua)
+{
+	s32 top = lua_gettop(lua);
+
+	if(top >= 7)
+	{
+		tic_particle_emitter emitter;
+		u8 colors[TIC_PALETTE_SIZE] = {0};
+
+		s32 id = getLuaNumber(lua, 1);
+		emitter.life = getLuaNumber(lua, 2);
+		emitter.speed = (float)lua_tonumber(lua, 3);
+		emitter.angle = (float)lua_tonumber(lua, 4);
+		emitter.spread = (float)lua_tonumber(lua, 5);
+		emitter.gravity = (float)lua_tonumber(lua, 6);
+		emitter.count = getLuaColorKey(lua, 7, colors);
+		memcpy(emitter.colors, colors, sizeof emitter.colors);
+		emitter.sprite = top >= 8 ? getLuaNumber(lua, 8) : -1;
+
+		tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+		memory->api.particle_emitter(memory, id, &emitter);
+	}
+	else luaL_error(lua, "invalid parameters, pemitter(id life speed angle spread gravity colors [sprite])\n");
+
+	return 0;
+}
+
+static s32 lua_pemit(lua_State* lua)
+{
+	s32 top = lua_gettop(lua);
+
+	if(top >= 3)
+	{
+		s32 id = getLuaNumber(lua, 1);
+		s32 x = getLuaNumber(lua, 2);
+		s32 y = getLuaNumber(lua, 3);
+		s32 count = top >= 4 ? getLuaNumber(lua, 4) : 1;
+
+		tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+		memory->api.particle_emit(memory, id, x, y, count);
+	}
+	else luaL_error(lua, "invalid parameters, pemit(id x y [count])\n");
+
+	return 0;
+}
+
+static s32 lua_pdraw(lua_State* lua)
+{
+	tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+
+	lua_pushinteger(lua, memory->api.particle_draw(memory));
+
+	return 1;
+}
+
+static s32 lua_pclear(lua_State* lua)
+{
+	tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+
+	memory->api.particle_clear(memory);
+
+	return 0;
+}
+
+static s32 lua_memread(lua_State* lua)
+{
+	s32 top = lua_gettop(lua);
+
+	if(top == 2)
+	{
+		s32 address = getLuaNumber(lua, 1);
+		s32 size = getLuaNumber(lua, 2);
+		s32 bound = sizeof(tic_ram) - size;
+
+		if(size >= 0 && size <= sizeof(tic_ram) && address >= 0 && address <= bound)
+		{
+			tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+			u8* ptr = (u8*)&memory->ram + address;
+			memory->api.observe(memory, ptr, size);
+			lua_pushlstring(lua, (const char*)ptr, size);
+			return 1;
+		}
+	}
+
+	luaL_error(lua, "invalid params, memread(addr,size)\n");
+
+	return 0;
+}
+
+// data is a string or a table of bytes
+static s32 lua_memwrite(lua_State* lua)
+{
+	s32 top = lua_gettop(lua);
+
+	if(top == 2)
+	{
+		s32 address = getLuaNumber(lua, 1);
+		bool table = lua_istable(lua, 2);
+		size_t size = 0;
+		const char* data = table ? NULL : lua_tolstring(lua, 2, &size);
+
+		if(table)
+			size = lua_rawlen(lua, 2);
+
+		if((table || data) && size <= sizeof(tic_ram) && address >= 0 && address <= (s32)(sizeof(tic_ram) - size))
+		{
+			tic_mem* memory = (tic_mem*)getLuaMachine(lua);
+			u8* ptr = (u8*)&memory->ram + address;
+
+			if(table)
+			{
+				for(s32 i = 0; i < size; i++)
+				{
+					lua_rawgeti(lua, 2, i + 1);
+					ptr[i] = getLuaNumber(lua, -1) & 0xff;
+					lua_pop(lua, 1);
+				}
+			}
+			else memcpy(ptr, data, size);
+
+			memory->api.invalidate(memory, ptr, (s32)size);
+			return 0;
+		}
+	}
+
+	luaL_error(lua, "invalid params, memwrite(addr,data)\n");
+
+	return 0;
+}
+
 static const char* printString(lua_State* lua, s32 index)
 {
 	lua_getglobal(lua, "tostring");
@@ -1047,20 +1482,127 @@ static const lua_CFunction ApiFunc[] =
 	lua_rectb, lua_spr, lua_btn, lua_btnp, lua_sfx, lua_map, lua_mget, 
 	lua_mset, lua_peek, lua_poke, lua_peek4, lua_poke4, lua_memcpy, 
 	lua_memset, lua_trace, lua_pmem, lua_time, lua_exit, lua_font, lua_mouse, 
-	lua_circ, lua_circb, lua_tri, lua_textri, lua_clip, lua_music, lua_sync
+	lua_circ, lua_circb, lua_tri, lua_textri, lua_clip, lua_music, lua_sync,
+	lua_memread, lua_memwrite, lua_sprlist, lua_pixlist, lua_rectlist,
+	lua_pemitter, lua_pemit, lua_pdraw, lua_pclear, lua_fget, lua_fset, lua_mhit
 };
 
 STATIC_ASSERT(api_func, COUNT_OF(ApiKeywords) == COUNT_OF(ApiFunc));
 
+#define LUA_BUDGET_HOOK_COUNT 1000
+
+static void budgetHook(lua_State* lua, lua_Debug* ar)
+{
+	tic_machine* machine = getLuaMachine(lua);
+
+	if(checkCpuBudget(machine, LUA_BUDGET_HOOK_COUNT))
+	{
+		char buffer[128];
+		getCpuBudgetError(machine, buffer, sizeof buffer);
+
+		// level 0 is the Lua function the hook interrupted
+		luaL_where(lua, 0);
+		lua_pushstring(lua, buffer);
+		lua_concat(lua, 2);
+		lua_error(lua);
+	}
+}
+
+// a count hook slows every instruction down, so it's only there while a budget is set
+static void setBudgetHook(tic_machine* machine)
+{
+	const tic_cpu_budget* limit = &machine->cpu.limit;
+	bool enabled = limit->instructions || limit->ms;
+
+	// coroutines inherit the hook from the main state
+	lua_sethook(machine->lua, budgetHook, enabled ? LUA_MASKCOUNT : 0, LUA_BUDGET_HOOK_COUNT);
+}
+
+static const char TicRam[] = "_TIC80RAM";
+
+// RAM[addr] reads like peek, the userdata holds the machine so there is no global lookup
+static s32 lua_ram_index(lua_State* lua)
+{
+	tic_mem* memory = *(tic_mem**)lua_touserdata(lua, 1);
+
+	if(lua_type(lua, 2) == LUA_TNUMBER)
+	{
+		s32 address = getLuaNumber(lua, 2);
+
+		if(address >= 0 && address < sizeof(tic_ram))
+		{
+			u8* ptr = (u8*)&memory->ram + address;
+			memory->api.observe(memory, ptr, 1);
+			lua_pushinteger(lua, *ptr);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static s32 lua_ram_newindex(lua_State* lua)
+{
+	tic_mem* memory = *(tic_mem**)lua_touserdata(lua, 1);
+
+	if(lua_type(lua, 2) == LUA_TNUMBER)
+	{
+		s32 address = getLuaNumber(lua, 2);
+
+		if(address >= 0 && address < sizeof(tic_ram))
+		{
+			u8* ptr = (u8*)&memory->ram + address;
+			*ptr = getLuaNumber(lua, 3) & 0xff;
+			memory->api.invalidate(memory, ptr, 1);
+		}
+	}
+
+	return 0;
+}
+
+static s32 lua_ram_len(lua_State* lua)
+{
+	lua_pushinteger(lua, sizeof(tic_ram));
+	return 1;
+}
+
+static void registerRamView(tic_machine* machine)
+{
+	static const luaL_Reg RamMeta[] =
+	{
+		{ "__index", lua_ram_index },
+		{ "__newindex", lua_ram_newindex },
+		{ "__len", lua_ram_len },
+		{ NULL, NULL }
+	};
+
+	lua_State* lua = machine->lua;
+
+	tic_mem** view = (tic_mem**)lua_newuserdata(lua, sizeof(tic_mem*));
+	*view = &machine->memory;
+
+	luaL_newmetatable(lua, TicRam);
+	luaL_setfuncs(lua, RamMeta, 0);
+	lua_setmetatable(lua, -2);
+
+	lua_setglobal(lua, "RAM");
+}
+
 static void initAPI(tic_machine* machine)
 {
 	lua_pushlightuserdata(machine->lua, machine);
 	lua_setglobal(machine->lua, TicMachine);
 
+	setBudgetHook(machine);
+
+	machine->scanlineCall.luaRef = LUA_NOREF;
+
 	for (s32 i = 0; i < COUNT_OF(ApiFunc); i++)
 		if (ApiFunc[i])
 			registerLuaFunction(machine, ApiFunc[i], ApiKeywords[i]);
 
+	registerRamView(machine);
+
 	registerLuaFunction(machine, lua_dofile, "dofile");
 	registerLuaFunction(machine, lua_loadfile, "loadfile");
 }
@@ -1071,14 +1613,103 @@ void closeLua(tic_machine* machine)
 	{
 		lua_close(machine->lua);
 		machine->lua = NULL;
+
+		closeVmHeap(&machine->heap);
+	}
+}
+
+static void* allocLua(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	return vmRealloc((VmHeap*)ud, ptr, nsize);
+}
+
+// same as the one luaL_newstate sets
+static s32 panicLua(lua_State* lua)
+{
+	fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(lua, -1));
+
+	return 0;
+}
+
+// the cap is left off until the libs and the API are in, running out there would be unprotected
+static lua_State* newLuaState(tic_machine* machine)
+{
+	lua_State* lua = lua_newstate(allocLua, &machine->heap);
+
+	if(lua)
+		lua_atpanic(lua, panicLua);
+
+	return lua;
+}
+
+static u64 getLuaHash(const char* code)
+{
+	return tic_tool_hash(code, (s32)strlen(code), LUA_VERSION_NUM);
+}
+
+static s32 writeChunk(lua_State* lua, const void* data, size_t size, void* udata)
+{
+	return writeCodeChunk((CodeChunk*)udata, data, (s32)size) ? 0 : 1;
+}
+
+// the name luaL_loadstring would give the code, which is the whole source and
+// would go into the dump, cut to what Lua shows of it in error messages anyway
+static void getLuaChunkName(const char* code, char* name)
+{
+	enum {MaxSize = LUA_IDSIZE - sizeof "[string \"...\"]"};
+
+	const char* newline = strchr(code, '\n');
+	s32 size = newline ? (s32)(newline - code) : (s32)strlen(code);
+	bool cut = newline || size >= MaxSize;
+
+	sprintf(name, "=[string \"%.*s%s\"]", size < MaxSize ? size : MaxSize, code, cut ? "..." : "");
+}
+
+// debug info stays in, so errors still point at the source lines
+void compileLua(const char* code, CodeBinary* binary)
+{
+	lua_State* lua = luaL_newstate();
+
+	if(lua)
+	{
+		char name[LUA_IDSIZE + 1];
+		getLuaChunkName(code, name);
+
+		binary->chunk.size = 0;
+
+		if(luaL_loadbuffer(lua, code, strlen(code), name) == LUA_OK && lua_dump(lua, writeChunk, &binary->chunk, 0) == 0)
+			binary->hash = getLuaHash(code);
+		else binary->chunk.size = 0;
+
+		lua_close(lua);
+	}
+}
+
+// binary chunks carry their own header, a mismatch there falls back to the source as well
+static s32 loadLuaCode(tic_machine* machine, const char* code)
+{
+	lua_State* lua = machine->lua;
+	const CodeBinary* binary = &machine->binary;
+
+	char name[LUA_IDSIZE + 1];
+	getLuaChunkName(code, name);
+
+	if(binary->chunk.size && binary->hash == getLuaHash(code))
+	{
+		if(luaL_loadbufferx(lua, (const char*)binary->chunk.data, binary->chunk.size, name, "b") == LUA_OK)
+			return LUA_OK;
+
+		lua_pop(lua, 1);
 	}
+
+	return luaL_loadbuffer(lua, code, strlen(code), name);
 }
 
 bool initLua(tic_machine* machine, const char* code)
 {
 	closeLua(machine);
 
-	lua_State* lua = machine->lua = luaL_newstate();
+	lua_State* lua = machine->lua = newLuaState(machine);
 
 	static const luaL_Reg loadedlibs[] =
 	{
@@ -1106,12 +1737,14 @@ bool initLua(tic_machine* machine, const char* code)
 
 	initAPI(machine);
 
+	machine->heap.capped = true;
+
 	{
 		lua_State* lua = machine->lua;
 
 		lua_settop(lua, 0);
 
-		if(luaL_loadstring(lua, code) != LUA_OK || lua_pcall(lua, 0, LUA_MULTRET, 0) != LUA_OK)
+		if(loadLuaCode(machine, code) != LUA_OK || lua_pcall(lua, 0, LUA_MULTRET, 0) != LUA_OK)
 		{
 			machine->data->error(machine->data->data, lua_tostring(lua, -1));
 			return false;
@@ -1127,30 +1760,28 @@ static const char* execute_moonscript_src = MOON_CODE(
 	local fn, err = require('moonscript.base').loadstring(...)
 
 	if not fn then
-		return err
+		error(err, 0)
 	end
-	return fn()
+	return fn
 );
 
-bool initMoonscript(tic_machine* machine, const char* code)
-{
-	closeLua(machine);
-
-	lua_State* lua = machine->lua = luaL_newstate();
+static const char MoonscriptChunkName[] = "=(moonscript.loadstring)";
 
-	static const luaL_Reg loadedlibs[] =
-	{
-		{ "_G", luaopen_base },
-		{ LUA_LOADLIBNAME, luaopen_package },
-		{ LUA_COLIBNAME, luaopen_coroutine },
-		{ LUA_TABLIBNAME, luaopen_table },
-		{ LUA_STRLIBNAME, luaopen_string },
-		{ LUA_MATHLIBNAME, luaopen_math },
-		{ LUA_DBLIBNAME, luaopen_debug },
-		{ NULL, NULL }
-	};
+static const luaL_Reg MoonscriptLibs[] =
+{
+	{ "_G", luaopen_base },
+	{ LUA_LOADLIBNAME, luaopen_package },
+	{ LUA_COLIBNAME, luaopen_coroutine },
+	{ LUA_TABLIBNAME, luaopen_table },
+	{ LUA_STRLIBNAME, luaopen_string },
+	{ LUA_MATHLIBNAME, luaopen_math },
+	{ LUA_DBLIBNAME, luaopen_debug },
+	{ NULL, NULL }
+};
 
-	for (const luaL_Reg *lib = loadedlibs; lib->func; lib++)
+static void openMoonscriptLibs(lua_State* lua)
+{
+	for (const luaL_Reg *lib = MoonscriptLibs; lib->func; lib++)
 	{
 		luaL_requiref(lua, lib->name, lib->func, 1);
 		lua_pop(lua, 1);
@@ -1158,39 +1789,138 @@ bool initMoonscript(tic_machine* machine, const char* code)
 
 	luaopen_lpeg(lua);
 	setloaded(lua, "lpeg");
+}
 
-	initAPI(machine);
+// a new compiler version changes the translation, so it goes into the hash too
+static u64 getMoonHash(const char* code)
+{
+	return tic_tool_hash(code, (s32)strlen(code), LUA_VERSION_NUM ^ moonscript_lua_len);
+}
 
-	{
-		lua_State* moon = machine->lua;
+// the embedded compiler source is only parsed the first time, later states load it from the cached bytecode
+static lua_State* newMoonscriptCompiler(CodeChunk* cache)
+{
+	lua_State* moon = luaL_newstate();
+
+	if(!moon)
+		return NULL;
 
-		lua_settop(moon, 0);
+	openMoonscriptLibs(moon);
 
-		if (luaL_loadbuffer(moon, (const char *)moonscript_lua, moonscript_lua_len, "moonscript.lua") != LUA_OK)
+	if(cache && cache->size)
+	{
+		if(luaL_loadbufferx(moon, (const char*)cache->data, cache->size, "moonscript.lua", "b") != LUA_OK)
 		{
-			machine->data->error(machine->data->data, "failed to load moonscript.lua");
-			return false;
+			lua_close(moon);
+			return NULL;
+		}
+	}
+	else
+	{
+		if(luaL_loadbuffer(moon, (const char *)moonscript_lua, moonscript_lua_len, "moonscript.lua") != LUA_OK)
+		{
+			lua_close(moon);
+			return NULL;
 		}
 
-		lua_call(moon, 0, 0);
+		if(cache && lua_dump(moon, writeChunk, cache, 0) != 0)
+			cache->size = 0;
+	}
 
-		if (luaL_loadbuffer(moon, execute_moonscript_src, strlen(execute_moonscript_src), "execute_moonscript") != LUA_OK)
+	if(lua_pcall(moon, 0, 0, 0) != LUA_OK)
+	{
+		lua_close(moon);
+		return NULL;
+	}
+
+	return moon;
+}
+
+// leaves the translated cart function or the error message on the stack
+static bool translateMoonscript(lua_State* moon, const char* code)
+{
+	if (luaL_loadbuffer(moon, execute_moonscript_src, strlen(execute_moonscript_src), "execute_moonscript") != LUA_OK)
+		return false;
+
+	lua_pushstring(moon, code);
+	return lua_pcall(moon, 1, 1, 0) == LUA_OK;
+}
+
+void compileMoonscript(const char* code, CodeBinary* binary)
+{
+	lua_State* moon = newMoonscriptCompiler(NULL);
+
+	if(moon)
+	{
+		binary->chunk.size = 0;
+
+		if(translateMoonscript(moon, code) && lua_dump(moon, writeChunk, &binary->chunk, 0) == 0)
+			binary->hash = getMoonHash(code);
+		else binary->chunk.size = 0;
+
+		lua_close(moon);
+	}
+}
+
+// the cart's binary first, then the last translation, the compiler only runs when the source changed
+static s32 loadMoonscriptCode(tic_machine* machine, const char* code)
+{
+	lua_State* lua = machine->lua;
+	const CodeBinary* binary = &machine->binary;
+	CodeChunk* cache = &machine->moonscript.code;
+	u64 hash = getMoonHash(code);
+
+	if(binary->chunk.size && binary->hash == hash)
+	{
+		if(luaL_loadbufferx(lua, (const char*)binary->chunk.data, binary->chunk.size, MoonscriptChunkName, "b") == LUA_OK)
+			return LUA_OK;
+
+		lua_pop(lua, 1);
+	}
+
+	if(!cache->size || machine->moonscript.hash != hash)
+	{
+		lua_State* moon = newMoonscriptCompiler(&machine->moonscript.compiler);
+
+		cache->size = 0;
+
+		if(!moon)
 		{
-			machine->data->error(machine->data->data, "failed to load moonscript compiler");
-			return false;
+			lua_pushstring(lua, "failed to load moonscript.lua");
+			return LUA_ERRRUN;
 		}
 
-		lua_pushstring(moon, code);
-		if (lua_pcall(moon, 1, 1, 0) != LUA_OK)
+		if(!translateMoonscript(moon, code) || lua_dump(moon, writeChunk, cache, 0) != 0)
 		{
 			const char* msg = lua_tostring(moon, -1);
-
-			if (msg)
-			{
-				machine->data->error(machine->data->data, msg);
-				return false;
-			}
+			lua_pushstring(lua, msg ? msg : "failed to compile moonscript");
+			lua_close(moon);
+			cache->size = 0;
+			return LUA_ERRSYNTAX;
 		}
+
+		lua_close(moon);
+		machine->moonscript.hash = hash;
+	}
+
+	return luaL_loadbufferx(lua, (const char*)cache->data, cache->size, MoonscriptChunkName, "b");
+}
+
+bool initMoonscript(tic_machine* machine, const char* code)
+{
+	closeLua(machine);
+
+	lua_State* lua = machine->lua = newLuaState(machine);
+
+	openMoonscriptLibs(lua);
+	initAPI(machine);
+
+	machine->heap.capped = true;
+
+	if(loadMoonscriptCode(machine, code) != LUA_OK || lua_pcall(lua, 0, 0, 0) != LUA_OK)
+	{
+		machine->data->error(machine->data->data, lua_tostring(lua, -1));
+		return false;
 	}
 
 	return true;
@@ -1204,6 +1934,8 @@ void callLuaTick(tic_machine* machine)
 
  	if(lua)
  	{
+		setBudgetHook(machine);
+
 		lua_getglobal(lua, TicFunc);
 		if(lua_isfunction(lua, -1)) 
 		{
@@ -1225,15 +1957,28 @@ void callLuaScanline(tic_mem* memory, s32 row)
 
 	if (lua)
 	{
-		const char* ScanlineFunc = ApiKeywords[1];
+		s32* ref = &machine->scanlineCall.luaRef;
 
-		lua_getglobal(lua, ScanlineFunc);
-		if(lua_isfunction(lua, -1)) 
+		if(row == 0)
 		{
-			lua_pushinteger(lua, row);
-			if(lua_pcall(lua, 1, 0, 0) != LUA_OK)
-				machine->data->error(machine->data->data, lua_tostring(lua, -1));
+			const char* ScanlineFunc = ApiKeywords[1];
+
+			luaL_unref(lua, LUA_REGISTRYINDEX, *ref);
+			*ref = LUA_NOREF;
+
+			lua_getglobal(lua, ScanlineFunc);
+			if(lua_isfunction(lua, -1))
+				*ref = luaL_ref(lua, LUA_REGISTRYINDEX);
+			else lua_pop(lua, 1);
+
+			machine->scanlineCall.defined = *ref != LUA_NOREF;
 		}
-		else lua_pop(lua, 1);
+
+		if(*ref == LUA_NOREF) return;
+
+		lua_rawgeti(lua, LUA_REGISTRYINDEX, *ref);
+		lua_pushinteger(lua, row);
+		if(lua_pcall(lua, 1, 0, 0) != LUA_OK)
+			machine->data->error(machine->data->data, lua_tostring(lua, -1));
 	}
 }
\ No newline at end of file
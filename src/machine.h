@@ -22,6 +22,8 @@
 
 #pragma once
 
+#include <stddef.h>
+
 #include "ticapi.h"
 #include "tools.h"
 #include "ext/blip_buf.h"
@@ -35,12 +37,48 @@ typedef struct
 	s32 amp;        /* current amplitude in delta buffer */
 }tic_sound_register_data;
 
+#define NOTE_TABLE_START (-NOTES * 2)
+#define NOTE_TABLE_SIZE (NOTES * (OCTAVES + 4))
+#define SOUND_FREQ_BITS 12
+
+// note frequencies and register periods, so the synth doesn't call pow() or round() per tick
+typedef struct
+{
+	s32 notes[NOTE_TABLE_SIZE];
+	u16 noisePeriods[1 << SOUND_FREQ_BITS];
+	u16 envelopePeriods[1 << SOUND_FREQ_BITS];
+} SoundTables;
+
+#define SFX_PROGRAM_SIZE 128
+
+// one effect position with the loops resolved, volume is already inverted
+typedef struct
+{
+	tic_sfx_pos pos;
+	u8 volume;
+	u8 wave;
+	s8 arpeggio; // reverse applied
+	s8 pitch; // pitch16x applied
+} SfxStep;
+
+// an effect unrolled up to where its loops repeat together, covers every speed since it is indexed by position
+typedef struct
+{
+	tic_sound_effect source; // effect the steps were compiled from
+	bool valid;
+
+	u8 prefix; // steps before the repeating part
+	u8 period; // length of the repeating part, 0 if it doesn't fit and the effect is read directly
+	SfxStep steps[SFX_PROGRAM_SIZE];
+} SfxProgram;
+
 typedef struct
 {
 	s32 tick;
 	tic_sfx_pos pos;
 	s32 index;
 	u16 freq;
+	s32 note; // note of freq, base for the arpeggio
 	u8 volume:4;
 	s8 speed:SFX_SPEED_BITS;
 	s32 duration;
@@ -56,6 +94,141 @@ typedef struct
 	s32 b;
 } Clip;
 
+typedef struct
+{
+	u8 pixels[TIC_SPRITESIZE * TIC_SPRITESIZE];
+	u16 colors; // mask of colors used by the tile
+} TileCache;
+
+typedef struct
+{
+	u8 rows[TIC_FONT_HEIGHT]; // bit N is set when column N of the row is lit
+	u8 start; // first lit column
+	u8 end; // one past the last lit column, equals start for blank glyphs
+} FontGlyph;
+
+typedef struct
+{
+	bool valid; // cleared by api.invalidate on tic_mem.font
+
+	FontGlyph glyphs[TIC_FONT_CHARS];
+} FontCache;
+
+typedef struct
+{
+	u8 data[TIC80_WIDTH * TIC80_HEIGHT]; // one color index per byte
+	bool enabled;
+	bool dirty; // VRAM screen is behind the shadow
+} ShadowScreen;
+
+typedef struct
+{
+	s16 Left[TIC80_HEIGHT];
+	s16 Right[TIC80_HEIGHT];
+} SidesBuffer;
+
+struct BlitPalette;
+
+typedef void(BlitRowFunc)(const u8* src, u32* dst, s32 size, const struct BlitPalette* palette);
+
+typedef struct BlitPalette
+{
+	tic_palette source; // palette the tables were built from
+	bool valid;
+
+	u32 colors[TIC_PALETTE_SIZE];
+	u32 pairs[1 << BITS_IN_BYTE][2]; // screen byte -> two pixels
+	u8 planes[3][TIC_PALETTE_SIZE]; // blue, green and red channels for shuffle kernels
+} BlitPalette;
+
+typedef struct
+{
+	BlitPalette palettes[1 + TIC_RASTER_PALETTES]; // VRAM palette first, then the raster palettes
+
+	BlitRowFunc* row;
+	BlitRowFunc* pixels; // converts shadow screen rows, size is in pixels
+	bool usePairs;
+} BlitTables;
+
+// VM hooks report what ran through checkCpuBudget, the frame is aborted once it is over the limit
+typedef struct
+{
+	tic_cpu_budget limit;
+	u64 start; // tick data counter when the frame started
+	u64 deadline; // counter value the frame runs out of time at, 0 without a time limit
+	u64 instructions; // counted so far this frame
+	bool exceeded;
+
+	tic_cpu_stats stats; // TIC() of the last frame
+} CpuBudget;
+
+// growable buffer the VMs dump bytecode into
+typedef struct
+{
+	u8* data;
+	s32 size;
+	s32 capacity;
+} CodeChunk;
+
+// precompiled code of the cart, run instead of the source while the hash matches it
+typedef struct
+{
+	CodeChunk chunk;
+	u64 hash; // of the source and the VM version, see tic_tool_hash
+} CodeBinary;
+
+#define VM_HEAP_CLASSES 10
+#define VM_HEAP_PAGE_SIZE (64*1024)
+
+// in front of every block, Duktape and Wren don't pass the old size back
+typedef union
+{
+	size_t size; // usable bytes after the header
+	double align;
+} VmHeader;
+
+typedef struct VmPage
+{
+	struct VmPage* next;
+	double align;
+} VmPage;
+
+// size classed free lists carved from pages for the script VM, larger blocks go to malloc;
+// one per machine so instances on different threads don't share a lock
+typedef struct
+{
+	VmPage* pages; // released together when the VM is closed
+	void* free[VM_HEAP_CLASSES];
+	u8* next; // unused tail of the first page
+	u8* end;
+
+	size_t current; // bytes in blocks the VM holds, headers included
+	size_t peak;
+	size_t limit; // 0 for no limit
+	bool capped; // set once the VM is set up, Wren never is as it doesn't handle failed allocations
+} VmHeap;
+
+#define PARTICLES_COUNT 2048
+#define PARTICLE_EMITTERS 16
+
+typedef struct
+{
+	float x, y;
+	float vx, vy;
+	u16 age;
+	u16 life;
+	u8 emitter;
+} Particle;
+
+// fixed pool, dead particles are replaced by the last one so the live ones stay packed
+typedef struct
+{
+	tic_particle_emitter emitters[PARTICLE_EMITTERS];
+	Particle items[PARTICLES_COUNT];
+	s32 count;
+	u32 seed;
+} ParticlePool;
+
 typedef struct
 {
 
@@ -84,6 +257,8 @@ typedef struct
 		Channel channels[TIC_SOUND_CHANNELS];
 	} music;
 
+	ParticlePool particles;
+
 	ScanlineFunc* scanline;
 	bool initialized;
 } MachineState;
@@ -100,20 +275,96 @@ typedef struct
 		struct WrenVM* wren;	
 	};
 
+	struct
+	{
+		struct WrenHandle* gameClass;
+		struct WrenHandle* newHandle;
+		struct WrenHandle* updateHandle;
+		struct WrenHandle* scanlineHandle;
+		u32 calls; // foreign calls, the budget is checked every WREN_BUDGET_CALLS of them
+		bool loaded;
+	} wrenGame;
+
+	// resolved once a frame at row 0, the other rows reuse it
+	struct
+	{
+		s32 luaRef; // registry reference to the Lua scanline function
+		bool defined;
+	} scanlineCall;
+
+	// JS RAM is a Uint8Array over tic_ram, writes through it skip api.invalidate
+	struct
+	{
+		bool live; // handed out, so the RAM caches are dropped after every callback
+		bool shadow; // the screen shadow is off while the view is live, restored on close
+	} jsRamView;
+
+	VmHeap heap;
+
+	// MoonScript carts are translated in a separate state, the compiler and the last cart are kept as bytecode
+	struct
+	{
+		CodeChunk compiler;
+		CodeChunk code;
+		u64 hash; // source the code chunk was translated from
+	} moonscript;
+
 	blip_buffer_t* blip;
 	s32 samplerate;
+
+	// where tick_end writes the frame's samples, NULL for memory.samples
+	struct
+	{
+		void* buffer;
+		s32 format;
+	} soundOutput;
+
+	// the host pulls samples with sound_pull, ticks leave the sound alone
+	bool soundPull;
 	const tic_sound* soundSrc;
 
 	tic_tick_data* data;
 
+	CpuBudget cpu;
+
+	// made by api.compile or loaded from a chunk signed with the key, Duktape and Lua don't
+	// validate bytecode so chunks from anywhere else are never run
+	CodeBinary binary;
+
+	struct
+	{
+		u8 data[TIC_BINARY_KEY_SIZE];
+		bool set;
+	} binaryKey;
+
 	MachineState state;
 
+	struct
+	{
+		TileCache cache[TIC_SPRITES];
+		bool valid[TIC_SPRITES];
+	} tiles;
+
+	BlitTables blit;
+	SoundTables sound;
+
+	struct
+	{
+		const tic_sound* src; // sound the programs belong to
+		SfxProgram programs[SFX_COUNT];
+	} sfx;
+
+	FontCache font;
+	SidesBuffer sides;
+	ShadowScreen shadow;
+
 	struct
 	{
 		MachineState state;	
 		tic_sound_register registers[TIC_SOUND_CHANNELS];
 		tic_music_pos music_pos;
 		tic_vram vram;
+		tic_raster raster;
 	} pause;
 
 } tic_machine;
@@ -123,10 +374,23 @@ s32 drawText(tic_mem* memory, const char* text, s32 x, s32 y, s32 width, s32 hei
 s32 drawSpriteFont(tic_mem* memory, u8 symbol, s32 x, s32 y, s32 width, s32 height, u8 chromakey, s32 scale);
 s32 drawFixedSpriteFont(tic_mem* memory, u8 index, s32 x, s32 y, s32 width, s32 height, u8 chromakey, s32 scale);
 
+bool checkCpuBudget(tic_machine* machine, u32 instructions);
+void getCpuBudgetError(tic_machine* machine, char* buffer, s32 size);
+bool loadRemapTable(tic_machine* machine, s32 address, RemapResult* table);
+
+void* vmRealloc(VmHeap* heap, void* ptr, size_t size);
+void closeVmHeap(VmHeap* heap);
+
 void closeLua(tic_machine* machine);
 void closeJavascript(tic_machine* machine);
 void closeWren(tic_machine* machine);
 
+bool writeCodeChunk(CodeChunk* chunk, const void* data, s32 size);
+
+void compileLua(const char* code, CodeBinary* binary);
+void compileJavascript(const char* code, CodeBinary* binary);
+void compileMoonscript(const char* code, CodeBinary* binary);
+
 bool initMoonscript(tic_machine* machine, const char* code);
 bool initLua(tic_machine* machine, const char* code);
 bool initJavascript(tic_machine* machine, const char* code);
@@ -411,7 +411,7 @@ static void drawCursorPos(Map* map, s32 x, s32 y)
 
 	sprintf(pos, "%03i:%03i", tx, ty);
 
-	s32 width = map->tic->api.text(map->tic, pos, TIC80_WIDTH, 0, (tic_color_gray));
+	s32 width = map->tic->api.text_width(map->tic, pos, false, 1);
 
 	s32 px = x + (TIC_SPRITESIZE + 3);
 	if(px + width >= TIC80_WIDTH) px = x - (width + 2);
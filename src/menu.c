@@ -118,7 +118,7 @@ static void drawDialog(Menu* menu)
 
 	{
 		static const char Label[] = "GAME MENU";
-		s32 size = tic->api.text(tic, Label, 0, -TIC_FONT_HEIGHT, 0);
+		s32 size = tic->api.text_width(tic, Label, false, 1);
 		tic->api.text(tic, Label, rect.x + (DIALOG_WIDTH - size)/2, rect.y-(TOOLBAR_SIZE-2), (tic_color_gray));
 	}
 
@@ -47,6 +47,16 @@ static void onExit(void* data)
 	run->exit = true;
 }
 
+static u64 getCounter(void* data)
+{
+	return SDL_GetPerformanceCounter();
+}
+
+static u64 getFreq(void* data)
+{
+	return SDL_GetPerformanceFrequency();
+}
+
 static char* data2md5(const void* data, s32 length)
 {
 	const char *str = data;
@@ -99,7 +109,7 @@ static void tick(Run* run)
 		if(!processDoFile())
 			return;
 		
-		run->tickData.start = run->tickData.counter(),
+		run->tickData.start = run->tickData.counter(run),
 		run->init = true;
 	}
 
@@ -131,14 +141,16 @@ void initRun(Run* run, Console* console, tic_mem* tic)
 		{
 			.error = onError,
 			.trace = onTrace,
-			.counter = SDL_GetPerformanceCounter,
-			.freq = SDL_GetPerformanceFrequency,
+			.counter = getCounter,
+			.freq = getFreq,
 			.start = 0,
 			.data = run,
 			.exit = onExit,
 		},
 	};
 
+	tic->api.cpu_budget(tic, (tic_cpu_budget){.ms = getCpuBudget()});
+
 	{
 		enum {Size = sizeof(tic_persistent)};
 		SDL_memset(&run->tic->ram.persistent, 0, Size);
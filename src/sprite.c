@@ -987,6 +987,62 @@ static void deleteSprite(Sprite* sprite)
 	history_add(sprite->history);
 }
 
+// flags of the tiles under the canvas, a flag shows as set when all of them have it
+static void drawFlags(Sprite* sprite, s32 x, s32 y)
+{
+	if(sprite->index >= TIC_BANK_SPRITES) return;
+
+	enum{Size = 5, Gap = Size + 1};
+
+	y += (CANVAS_SIZE - TIC_TILE_FLAGS * Gap) / 2;
+
+	static const u8 Colors[TIC_TILE_FLAGS] = 
+	{
+		tic_color_red, tic_color_orange, tic_color_yellow, tic_color_light_green, 
+		tic_color_green, tic_color_cyan, tic_color_light_blue, tic_color_blue,
+	};
+
+	tic_mem* tic = sprite->tic;
+	s32 count = sprite->size / TIC_SPRITESIZE;
+
+	for(s32 f = 0; f < TIC_TILE_FLAGS; f++)
+	{
+		SDL_Rect rect = {x, y + f * Gap, Size, Size};
+		bool set = true;
+
+		for(s32 j = 0; j < count; j++)
+			for(s32 i = 0; i < count; i++)
+				if(!tic->api.flag_get(tic, &tic->cart.flags, sprite->index + i + j * SHEET_COLS, f))
+					set = false;
+
+		bool over = false;
+		if(checkMousePos(&rect))
+		{
+			setCursor(SDL_SYSTEM_CURSOR_HAND);
+			over = true;
+
+			char buf[] = "FLAG 0";
+			sprintf(buf, "FLAG %i", f);
+			showTooltip(buf);
+
+			if(checkMouseClick(&rect, SDL_BUTTON_LEFT))
+			{
+				set = !set;
+
+				for(s32 j = 0; j < count; j++)
+					for(s32 i = 0; i < count; i++)
+						tic->api.flag_set(tic, &tic->cart.flags, sprite->index + i + j * SHEET_COLS, f, set);
+			}
+		}
+
+		tic->api.rect(tic, rect.x, rect.y + 1, Size, Size, (tic_color_black));
+		tic->api.rect(tic, rect.x, rect.y, Size, Size, set ? Colors[f] : (tic_color_black));
+
+		if(over)
+			tic->api.rect_border(tic, rect.x, rect.y, Size, Size, (tic_color_white));
+	}
+}
+
 static void(* const SpriteToolsFunc[])(Sprite*) = {flipSpriteHorz, flipSpriteVert, rotateSprite, deleteSprite};
 
 static void drawSpriteTools(Sprite* sprite, s32 x, s32 y)
@@ -1444,6 +1500,7 @@ static void tick(Sprite* sprite)
 
 	drawCanvas(sprite, 24, 20);
 	drawMoveButtons(sprite);
+	drawFlags(sprite, 24 + CANVAS_SIZE + 12, 20);
 
 	sprite->editPalette 
 		? drawRGBSliders(sprite, 24, 91) 
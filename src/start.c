@@ -32,6 +32,7 @@ static void reset(Start* start)
 	u8 val = Reset[sizeof(Reset) * (start->ticks % TIC_FRAMERATE) / TIC_FRAMERATE];
 
 	for(s32 i = 0; i < sizeof(tic_tile); i++) tile[i] = val;
+	start->tic->api.invalidate(start->tic, tile, sizeof(tic_tile));
 
 	start->tic->api.map(start->tic, &start->tic->ram.gfx, 0, 0, TIC_MAP_SCREEN_WIDTH, TIC_MAP_SCREEN_HEIGHT + (TIC80_HEIGHT % TIC_SPRITESIZE ? 1 : 0), 0, 0, -1, 1);
 }
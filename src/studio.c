@@ -20,6 +20,10 @@
 // OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 // SOFTWARE.
 
+#if defined(_WIN32)
+#define _CRT_RAND_S
+#endif
+
 #include "studio.h"
 
 #include "start.h"
@@ -87,6 +91,19 @@ static struct
 	SDL_AudioSpec audioSpec;
 	SDL_AudioDeviceID audioDevice;
 
+	// single producer (tick) single consumer (device callback) sample ring
+	struct
+	{
+		s16* data;
+		u32 mask;
+
+		SDL_atomic_t head; // written by the tick only
+		SDL_atomic_t tail; // written by the callback only
+
+		SDL_atomic_t underruns;
+		u32 overruns;
+	} audio;
+
 	SDL_Joystick* joysticks[MAX_CONTROLLERS];
 
 	EditorMode mode;
@@ -187,8 +204,6 @@ static struct
 	s32 argc;
 	char **argv;
 
-	float* floatSamples;
-
 } studio =
 {
 	.tic80local = NULL,
@@ -264,7 +279,6 @@ static struct
 	.quitFlag = false,
 	.argc = 0,
 	.argv = NULL,
-	.floatSamples = NULL,
 };
 
 void playSystemSfx(s32 id)
@@ -1846,26 +1860,116 @@ static void transparentBlit(u32* out, s32 pitch)
 	}
 }
 
+static s32 getAudioTarget()
+{
+	s32 latency = getConfig()->audioLatency;
+
+	if(latency <= 0) latency = AUDIO_DEFAULT_LATENCY;
+
+	return SDL_max(AUDIO_MIN_LATENCY, SDL_min(latency, AUDIO_MAX_LATENCY));
+}
+
+s32 getCpuBudget()
+{
+	s32 budget = getConfig()->cpuBudget;
+
+	if(budget == 0) budget = CPU_DEFAULT_BUDGET;
+
+	return SDL_max(budget, 0);
+}
+
+AudioStats getAudioStats()
+{
+	u32 queued = (u32)SDL_AtomicGet(&studio.audio.head) - (u32)SDL_AtomicGet(&studio.audio.tail);
+
+	return (AudioStats)
+	{
+		.freq = studio.audioSpec.freq,
+		.latency = getAudioTarget(),
+		.queued = studio.audioSpec.freq ? queued * 1000 / studio.audioSpec.freq : 0,
+		.underruns = SDL_AtomicGet(&studio.audio.underruns),
+		.overruns = studio.audio.overruns,
+	};
+}
+
+static void audioCallback(void* userdata, u8* stream, s32 len)
+{
+	s16* out = (s16*)stream;
+	u32 count = len / sizeof(s16);
+
+	u32 tail = SDL_AtomicGet(&studio.audio.tail);
+	u32 head = SDL_AtomicGet(&studio.audio.head);
+	u32 size = SDL_min(head - tail, count);
+
+	for(u32 i = 0; i < size; i++)
+		out[i] = studio.audio.data[(tail + i) & studio.audio.mask];
+
+	if(size < count)
+	{
+		memset(out + size, 0, (count - size) * sizeof(s16));
+
+		// nothing was queued yet, it's not an underrun
+		if(head)
+			SDL_AtomicAdd(&studio.audio.underruns, 1);
+	}
+
+	SDL_AtomicSet(&studio.audio.tail, tail + size);
+}
+
 static void blitSound()
 {
-	s32 samples = studio.audioSpec.freq / TIC_FRAMERATE;
+	if(!studio.audio.data) return;
 
-	// TODO: use SDL_ConvertAudio to covert format
-	if(studio.audioSpec.format == AUDIO_F32)
+	enum {MaxStretch = 200, Damping = 16};
+
+	const s16* src = studio.tic->samples.buffer;
+	s32 samples = studio.tic->samples.size / sizeof(s16);
+
+	u32 head = SDL_AtomicGet(&studio.audio.head);
+	u32 tail = SDL_AtomicGet(&studio.audio.tail);
+	s32 queued = head - tail;
+	s32 target = getAudioTarget() * studio.audioSpec.freq / 1000;
+
+	// the device is far behind the ticks, drop the frame instead of growing the latency
+	if(queued + samples > SDL_max(target * 2, target + samples * 2))
 	{
-		if(!studio.floatSamples)
-			studio.floatSamples = SDL_malloc(samples * sizeof studio.floatSamples[0]);
+		studio.audio.overruns++;
+		return;
+	}
+
+	s16* data = studio.audio.data;
+	u32 mask = studio.audio.mask;
+
+	// the device is about to starve (first frame or after a stall), pad with silence up to the target
+	if(queued < samples)
+		for(; queued < target - samples; queued++)
+			data[head++ & mask] = 0;
 
-		s16* ptr = studio.tic->samples.buffer;
-		s16* end = ptr + samples;
-		float* out = studio.floatSamples;
+	// the 60Hz tick and the device clock drift apart, so stretch the frame
+	// by up to 0.5% to pull the queue back to the target latency
+	s32 stretch = (target - queued) / Damping;
+	s32 limit = samples / MaxStretch;
+	s32 count = samples + SDL_max(-limit, SDL_min(stretch, limit));
+
+	if(count == samples)
+		for(s32 i = 0; i < count; i++)
+			data[(head + i) & mask] = src[i];
+	else
+	{
+		// linear resample in 16.16 fixed point
+		u32 step = ((samples - 1) << 16) / (count - 1);
 
-		while(ptr != end) *out++ = *ptr++ / 32767.0f;
+		for(s32 i = 0, pos = 0; i < count; i++, pos += step)
+		{
+			s32 index = pos >> 16;
+			s32 frac = pos & 0xffff;
+			s32 next = index + 1 < samples ? index + 1 : index;
 
-		SDL_QueueAudio(studio.audioDevice, studio.floatSamples, samples * sizeof studio.floatSamples[0]);
+			data[(head + i) & mask] = (s16)(src[index] + (((src[next] - src[index]) * frac) >> 16));
+		}
 	}
-	else if (studio.audioSpec.format == AUDIO_S16)
-		SDL_QueueAudio(studio.audioDevice, studio.tic->samples.buffer, studio.tic->samples.size);
+
+	SDL_AtomicSet(&studio.audio.head, head + count);
 }
 
 static void drawRecordLabel(u32* frame, s32 pitch, s32 sx, s32 sy, const u32* color)
@@ -2251,13 +2355,26 @@ static void initSound()
 		.freq = 44100,
 		.format = AUDIO_S16,
 		.channels = 1,
+		.samples = 512,
+		.callback = audioCallback,
 		.userdata = NULL,
 	};
 
-	studio.audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &studio.audioSpec, SDL_AUDIO_ALLOW_ANY_CHANGE);
+	// SDL converts the format and channels, the callback always writes mono s16
+	studio.audioDevice = SDL_OpenAudioDevice(NULL, 0, &want, &studio.audioSpec, SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
 
 	if(studio.audioDevice)
+	{
+		// twice the max latency, rounded up to a power of two
+		u32 size = 1;
+		while(size < (u32)studio.audioSpec.freq * AUDIO_MAX_LATENCY * 2 / 1000)
+			size <<= 1;
+
+		studio.audio.data = SDL_malloc(size * sizeof(s16));
+		studio.audio.mask = size - 1;
+
 		SDL_PauseAudioDevice(studio.audioDevice, 0);
+	}
 }
 
 static void initTouchGamepad()
@@ -2294,6 +2411,8 @@ static void updateSystemFont()
 			for(s32 x = 0; x < TIC_SPRITESIZE; x++)
 				if(tic_tool_peek4(&studio.tic->config.gfx.sprites[i], TIC_SPRITESIZE*(y+1) - x-1))
 					studio.tic->font.data[i*BITS_IN_BYTE+y] |= 1 << x;
+
+	studio.tic->api.invalidate(studio.tic, &studio.tic->font, sizeof(tic_font));
 }
 
 void studioConfigChanged()
@@ -2305,6 +2424,52 @@ void studioConfigChanged()
 	updateSystemFont();
 }
 
+static bool getRandomBytes(u8* data, s32 size)
+{
+#if defined(_WIN32)
+	for(s32 i = 0; i < size; i++)
+	{
+		unsigned int value = 0;
+
+		if(rand_s(&value))
+			return false;
+
+		data[i] = (u8)value;
+	}
+
+	return true;
+#else
+	FILE* file = fopen("/dev/urandom", "rb");
+	bool done = file && fread(data, size, 1, file) == 1;
+
+	if(file)
+		fclose(file);
+
+	return done;
+#endif
+}
+
+// the bytecode in saved carts is signed with a key of this studio's own, so
+// the bytecode of carts from anywhere else is never run
+static void initBinaryKey()
+{
+	u8 key[TIC_BINARY_KEY_SIZE];
+	s32 size = 0;
+	void* data = fsLoadRootFile(studio.fs, BINARY_KEY_PATH, &size);
+	bool ready = data && size == sizeof key;
+
+	if(ready)
+		SDL_memcpy(key, data, sizeof key);
+	else if((ready = getRandomBytes(key, sizeof key)))
+		fsSaveRootFile(studio.fs, BINARY_KEY_PATH, key, sizeof key, true);
+
+	if(data)
+		SDL_free(data);
+
+	if(ready)
+		studio.tic->api.trust_binary(studio.tic, key);
+}
+
 static void setWindowIcon()
 {
 	enum{ Size = 64, TileSize = 16, ColorKey = 14, Cols = TileSize / TIC_SPRITESIZE, Scale = Size/TileSize};
@@ -2384,6 +2549,7 @@ static void onFSInitialized(FileSystem* fs)
 	fsMakeDir(fs, TIC_LOCAL);
 	initConfig(&studio.config, studio.tic, studio.fs);
 	initKeymap(&studio.keymap, studio.tic, studio.fs);
+	initBinaryKey();
 
 	initStart(&studio.start, studio.tic);
 	initConsole(&studio.console, studio.tic, studio.fs, &studio.config, studio.argc, studio.argv);
@@ -2475,9 +2641,6 @@ s32 main(s32 argc, char **argv)
 	if(studio.tic80local)
 		tic80_delete((tic80*)studio.tic80local);
 
-	if(studio.floatSamples)
-		SDL_free(studio.floatSamples);
-
 	SDL_DestroyTexture(studio.gamepad.texture);
 	SDL_DestroyTexture(studio.texture);
 
@@ -2491,6 +2654,9 @@ s32 main(s32 argc, char **argv)
 	// stucks here on macos
 	SDL_CloseAudioDevice(studio.audioDevice);
 	SDL_Quit();
+
+	if(studio.audio.data)
+		SDL_free(studio.audio.data);
 #endif
 
 	SDLNet_Quit();
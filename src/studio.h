@@ -60,6 +60,17 @@
 #define KEYMAP_DAT "keymap.dat"
 #define KEYMAP_DAT_PATH TIC_LOCAL KEYMAP_DAT
 
+#define BINARY_KEY_PATH TIC_LOCAL "binary.key"
+
+// audio latency in ms, set with AUDIO_LATENCY in the config
+#define AUDIO_DEFAULT_LATENCY 40
+#define AUDIO_MIN_LATENCY 10
+#define AUDIO_MAX_LATENCY 250
+
+// ms a running cart gets per frame before it is stopped, set with CPU_BUDGET in the config,
+// a negative value turns the limit off
+#define CPU_DEFAULT_BUDGET 2000
+
 typedef struct
 {
 	struct
@@ -98,11 +109,22 @@ typedef struct
 
 	s32 gifScale;
 	s32 gifLength;
+	s32 audioLatency;
+	s32 cpuBudget;
 	
 	bool checkNewVersion;
 
 } StudioConfig;
 
+typedef struct
+{
+	s32 freq;
+	s32 latency;
+	s32 queued;
+	u32 underruns;
+	u32 overruns;
+} AudioStats;
+
 typedef enum
 {
 	TIC_START_MODE,
@@ -175,6 +197,8 @@ void showTooltip(const char* text);
 SDL_Scancode* getKeymap();
 
 const StudioConfig* getConfig();
+AudioStats getAudioStats();
+s32 getCpuBudget();
 
 void setSpritePixel(tic_tile* tiles, s32 x, s32 y, u8 color);
 u8 getSpritePixel(tic_tile* tiles, s32 x, s32 y);
@@ -31,6 +31,34 @@
 #include "machine.h"
 #include "ext/gif.h"
 
+#if defined(__SSE2__) || defined(_M_X64)
+#	define TIC_BLIT_SSE2
+#	include <emmintrin.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#	define TIC_BLIT_AVX2
+#	include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#	define TIC_BLIT_NEON
+#	define TIC_NEON_TARGET
+#	include <arm_neon.h>
+#elif defined(__arm__) && defined(__ARM_LINUX__) && defined(__ARM_FP) && defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 8
+// the arm build doesn't pass -mfpu=neon, so only the NEON kernels are compiled
+// for it (arm_neon.h enables it for its own intrinsics since GCC 8) and they
+// are picked when AT_HWCAP says the cpu has it
+#	define TIC_BLIT_NEON
+#	define TIC_NEON_TARGET __attribute__((target("fpu=neon")))
+#	include <arm_neon.h>
+#endif
+
+#if defined(TIC_BLIT_NEON) && defined(__arm__) && defined(__ARM_LINUX__)
+#	include <sys/auxv.h>
+#	include <asm/hwcap.h>
+#endif
+
 #define CLOCKRATE (TIC_FRAMERATE*30000)
 #define MIN_PERIOD_VALUE 10
 #define MAX_PERIOD_VALUE 4096
@@ -39,6 +67,7 @@
 #define ENVELOPE_FREQ_SCALE 2
 #define NOTES_PER_MUNUTE (TIC_FRAMERATE / NOTES_PER_BEET * 60)
 #define min(a,b) (a < b ? a : b)
+#define max(a,b) (a > b ? a : b)
 
 typedef enum
 {
@@ -57,6 +86,8 @@ typedef enum
 	CHUNK_PALETTE, 	// 12
 	CHUNK_PATTERNS, // 13
 	CHUNK_MUSIC,	// 14
+	CHUNK_BINARY,	// 15
+	CHUNK_FLAGS,	// 16
 
 } ChunkType;
 
@@ -73,14 +104,21 @@ STATIC_ASSERT(tic_track_pattern, sizeof(tic_track_pattern) == 3*MUSIC_PATTERN_RO
 STATIC_ASSERT(tic_track, sizeof(tic_track) == 3*MUSIC_FRAMES+3);
 STATIC_ASSERT(tic_vram, sizeof(tic_vram) == TIC_VRAM_SIZE);
 STATIC_ASSERT(tic_ram, sizeof(tic_ram) == TIC_RAM_SIZE);
+STATIC_ASSERT(tic_raster, sizeof(tic_raster) == TIC_RASTER_SIZE);
+STATIC_ASSERT(tic_flags, sizeof(tic_flags) * BITS_IN_BYTE == TIC_BANK_SPRITES * TIC_TILE_FLAGS);
 STATIC_ASSERT(tic_sound_register, sizeof(tic_sound_register) == 16+2);
 STATIC_ASSERT(tic80_input, sizeof(tic80_input) == 2);
 
 static void update_amp(blip_buffer_t* blip, tic_sound_register_data* data, s32 new_amp )
 {
 	s32 delta = new_amp - data->amp;
-	data->amp += delta;
-	blip_add_delta( blip, data->time, delta );
+
+	// a zero delta adds nothing to the buffer
+	if(delta)
+	{
+		data->amp += delta;
+		blip_add_delta( blip, data->time, delta );
+	}
 }
 
 inline s32 freq2note(double freq)
@@ -113,30 +151,70 @@ inline s32 getAmp(const tic_sound_register* reg, s32 amp)
 	return amp * MaxAmp * reg->volume / MAX_VOLUME;
 }
 
-static void runEnvelope(blip_buffer_t* blip, tic_sound_register* reg, tic_sound_register_data* data, s32 end_time )
+static inline s32 getNoteFreq(const SoundTables* tables, s32 note)
+{
+	s32 index = note - NOTE_TABLE_START;
+
+	return index >= 0 && index < NOTE_TABLE_SIZE
+		? tables->notes[index]
+		: (s32)note2freq(note);
+}
+
+static void runEnvelope(blip_buffer_t* blip, const SoundTables* tables, tic_sound_register* reg, tic_sound_register_data* data, s32 end_time )
 {
-	s32 period = freq2period(reg->freq * ENVELOPE_FREQ_SCALE);
+	s32 period = tables->envelopePeriods[reg->freq];
+
+	if(data->time >= end_time) return;
+
+	if(reg->volume == 0)
+	{
+		// every step is silent, land on the same phase and time in one go
+		s32 steps = (end_time - data->time + period - 1) / period;
+
+		update_amp(blip, data, 0);
+		data->phase = (data->phase + steps) % ENVELOPE_VALUES;
+		data->time += steps * period;
+		return;
+	}
+
+	s32 amps[ENVELOPE_VALUES];
+	for(s32 i = 0; i < ENVELOPE_VALUES; i++)
+		amps[i] = getAmp(reg, tic_tool_peek4(reg->waveform.data, i));
 
 	for ( ; data->time < end_time; data->time += period )
 	{
 		data->phase = (data->phase + 1) % ENVELOPE_VALUES;
 
-		update_amp(blip, data, getAmp(reg, tic_tool_peek4(reg->waveform.data, data->phase)));
+		update_amp(blip, data, amps[data->phase]);
 	}
 }
 
-static void runNoise(blip_buffer_t* blip, tic_sound_register* reg, tic_sound_register_data* data, s32 end_time )
+static void runNoise(blip_buffer_t* blip, const SoundTables* tables, tic_sound_register* reg, tic_sound_register_data* data, s32 end_time )
 {
 	// phase is noise LFSR, which must never be zero
 	if ( data->phase == 0 )
 		data->phase = 1;
 
-	s32 period = freq2period(reg->freq);
+	s32 period = tables->noisePeriods[reg->freq];
+
+	if(reg->volume == 0)
+	{
+		// keep the LFSR running so the noise resumes where it would have
+		if(data->time < end_time)
+			update_amp(blip, data, 0);
+
+		for ( ; data->time < end_time; data->time += period )
+			data->phase = ((data->phase & 1) * (0b11 << 13)) ^ (data->phase >> 1);
+
+		return;
+	}
+
+	s32 amp = getAmp(reg, MAX_VOLUME);
 
 	for ( ; data->time < end_time; data->time += period )
 	{
 		data->phase = ((data->phase & 1) * (0b11 << 13)) ^ (data->phase >> 1);
-		update_amp(blip, data, getAmp(reg, (data->phase & 1) ? MAX_VOLUME : 0));
+		update_amp(blip, data, (data->phase & 1) ? amp : 0);
 	}
 }
 
@@ -147,48 +225,172 @@ static void resetPalette(tic_mem* memory)
 	memcpy(memory->ram.vram.mapping, DefaultMapping, sizeof DefaultMapping);
 	memset(&memory->ram.vram.vars, 0, sizeof memory->ram.vram.vars);
 	memory->ram.vram.vars.mask.data = TIC_GAMEPAD_MASK;
+	memset(&memory->ram.raster, 0, sizeof memory->ram.raster);
+}
+
+static inline u8 mapColor(tic_machine* machine, u8 color)
+{
+	return tic_tool_peek4(machine->memory.ram.vram.mapping, color);
+}
+
+// writes an already mapped color to the shadow screen or to VRAM,
+// callers set shadow.dirty once before they start drawing
+static inline void writePixel(tic_machine* machine, bool shadow, s32 index, u8 color)
+{
+	if(shadow)
+	{
+		machine->shadow.data[index] = color;
+		return;
+	}
+
+	u8* val = machine->memory.ram.vram.screen.data + (index >> 1);
+	*val = index & 1 ? (*val & 0x0f) | (color << TIC_PALETTE_BPP) : (*val & 0xf0) | color;
+}
+
+static inline void putPixel(tic_machine* machine, s32 index, u8 color)
+{
+	writePixel(machine, machine->shadow.enabled, index, color);
 }
 
 static void setPixel(tic_machine* machine, s32 x, s32 y, u8 color)
 {
 	if(x < machine->state.clip.l || y < machine->state.clip.t || x >= machine->state.clip.r || y >= machine->state.clip.b) return;
 
-	tic_tool_poke4(machine->memory.ram.vram.screen.data, y * TIC80_WIDTH + x, tic_tool_peek4(machine->memory.ram.vram.mapping, color));
+	machine->shadow.dirty = true;
+	putPixel(machine, y * TIC80_WIDTH + x, mapColor(machine, color));
 }
 
 static u8 getPixel(tic_machine* machine, s32 x, s32 y)
 {
 	if(x < 0 || y < 0 || x >= TIC80_WIDTH || y >= TIC80_HEIGHT) return 0;
 
-	return tic_tool_peek4(machine->memory.ram.vram.mapping, tic_tool_peek4(machine->memory.ram.vram.screen.data, y * TIC80_WIDTH + x));
+	s32 index = y * TIC80_WIDTH + x;
+
+	return mapColor(machine, machine->shadow.enabled
+		? machine->shadow.data[index]
+		: tic_tool_peek4(machine->memory.ram.vram.screen.data, index));
+}
+
+// VRAM screen bytes [start, end) overlapped by the address range, false if none
+static bool getScreenRange(tic_machine* machine, const void* address, s32 size, s32* start, s32* end)
+{
+	const u8* screen = machine->memory.ram.vram.screen.data;
+	const u8* from = address;
+
+	*start = max((s32)(from - screen), 0);
+	*end = min((s32)(from + size - screen), (s32)sizeof(tic_screen));
+
+	return from < screen + sizeof(tic_screen) && from + size > screen && *start < *end;
+}
+
+static void packShadow(tic_machine* machine)
+{
+	ShadowScreen* shadow = &machine->shadow;
+
+	if(!shadow->enabled || !shadow->dirty) return;
+
+	u8* dst = machine->memory.ram.vram.screen.data;
+	const u8* src = shadow->data;
+
+	for(s32 i = 0; i < sizeof(tic_screen); i++, src += 2)
+		dst[i] = src[0] | (src[1] << TIC_PALETTE_BPP);
+
+	shadow->dirty = false;
+}
+
+// reloads the shadow from VRAM screen bytes [start, end) after they were written directly
+static void unpackShadow(tic_machine* machine, s32 start, s32 end)
+{
+	const u8* src = machine->memory.ram.vram.screen.data;
+	u8* dst = machine->shadow.data;
+
+	for(s32 i = start; i < end; i++)
+	{
+		dst[i << 1] = src[i] & 0x0f;
+		dst[(i << 1) + 1] = src[i] >> TIC_PALETTE_BPP;
+	}
+}
+
+// fills screen pixels [start, end) with already mapped color,
+// only the odd leading and trailing nibbles are written by hand
+static void drawSpan(tic_machine* machine, s32 start, s32 end, u8 color)
+{
+	u8* screen = machine->memory.ram.vram.screen.data;
+
+	color &= 0x0f;
+
+	if(start >= end) return;
+
+	machine->shadow.dirty = true;
+
+	if(machine->shadow.enabled)
+	{
+		memset(machine->shadow.data + start, color, end - start);
+		return;
+	}
+
+	if(start & 1)
+	{
+		u8* val = screen + (start >> 1);
+		*val = (*val & 0x0f) | (color << TIC_PALETTE_BPP);
+		start++;
+	}
+
+	if(end & 1 && start < end)
+	{
+		end--;
+		u8* val = screen + (end >> 1);
+		*val = (*val & 0xf0) | color;
+	}
+
+	if(start < end)
+		memset(screen + (start >> 1), color | (color << TIC_PALETTE_BPP), (end - start) >> 1);
 }
 
 static void drawHLine(tic_machine* machine, s32 x, s32 y, s32 width, u8 color)
 {
-	if(y < 0 || y >= TIC80_HEIGHT) return;
+	const Clip* clip = &machine->state.clip;
 
-	s32 xl = x < 0 ? 0 : x;
-	s32 xr = x + width >= TIC80_WIDTH ? TIC80_WIDTH : x + width;
+	if(y < clip->t || y >= clip->b) return;
 
-	for(s32 i = xl; i < xr; ++i)
-		setPixel(machine, i, y, color);
+	s32 xl = max(x, clip->l);
+	s32 xr = min(x + width, clip->r);
+
+	if(xl < xr)
+		drawSpan(machine, y * TIC80_WIDTH + xl, y * TIC80_WIDTH + xr, mapColor(machine, color));
 }
 
 static void drawVLine(tic_machine* machine, s32 x, s32 y, s32 height, u8 color)
 {
-	if(x < 0 || x >= TIC80_WIDTH) return;
+	const Clip* clip = &machine->state.clip;
+
+	if(x < clip->l || x >= clip->r) return;
 
-	s32 yl = y < 0 ? 0 : y;
-	s32 yr = y + height >= TIC80_HEIGHT ? TIC80_HEIGHT : y + height;
+	s32 yl = max(y, clip->t);
+	s32 yr = min(y + height, clip->b);
+
+	color = mapColor(machine, color);
+	machine->shadow.dirty = true;
 
 	for(s32 i = yl; i < yr; ++i)
-		setPixel(machine, x, i, color);
+		putPixel(machine, i * TIC80_WIDTH + x, color);
 }
 
 static void drawRect(tic_machine* machine, s32 x, s32 y, s32 width, s32 height, u8 color)
 {
-	for(s32 i = y; i < y + height; ++i)
-		drawHLine(machine, x, i, width, color);
+	const Clip* clip = &machine->state.clip;
+
+	s32 xl = max(x, clip->l);
+	s32 xr = min(x + width, clip->r);
+	s32 yl = max(y, clip->t);
+	s32 yr = min(y + height, clip->b);
+
+	if(xl >= xr) return;
+
+	color = mapColor(machine, color);
+
+	for(s32 i = yl; i < yr; ++i)
+		drawSpan(machine, i * TIC80_WIDTH + xl, i * TIC80_WIDTH + xr, color);
 }
 
 static void drawRectBorder(tic_machine* machine, s32 x, s32 y, s32 width, s32 height, u8 color)
@@ -200,65 +402,197 @@ static void drawRectBorder(tic_machine* machine, s32 x, s32 y, s32 width, s32 he
 	drawVLine(machine, x + width - 1, y, height, color);
 }
 
-static void drawRectRev(tic_machine* machine, s32 y, s32 x, s32 height, s32 width, u8 color)
+static void decodeTile(const tic_tile* tile, TileCache* cache)
 {
-	drawRect(machine, x, y, width, height, color);
+	cache->colors = 0;
+
+	for(s32 i = 0; i < sizeof(tic_tile); i++)
+	{
+		u8 val = tile->data[i];
+		u8 lo = val & 0x0f;
+		u8 hi = val >> TIC_PALETTE_BPP;
+
+		cache->pixels[i << 1] = lo;
+		cache->pixels[(i << 1) + 1] = hi;
+		cache->colors |= 1 << lo | 1 << hi;
+	}
+}
+
+static const TileCache* getTileCache(tic_machine* machine, const tic_tile* tile, TileCache* temp)
+{
+	const tic_tile* tiles = machine->memory.ram.gfx.tiles;
+
+	if(tile >= tiles && tile < tiles + TIC_SPRITES)
+	{
+		s32 index = (s32)(tile - tiles);
+		TileCache* cache = &machine->tiles.cache[index];
+
+		if(!machine->tiles.valid[index])
+		{
+			decodeTile(tile, cache);
+			machine->tiles.valid[index] = true;
+		}
+
+		return cache;
+	}
+
+	decodeTile(tile, temp);
+
+	return temp;
+}
+
+static void invalidateTiles(tic_machine* machine, const void* address, s32 size)
+{
+	const u8* start = (const u8*)machine->memory.ram.gfx.tiles;
+	const u8* end = start + TIC_SPRITES * sizeof(tic_tile);
+	const u8* from = (const u8*)address;
+	const u8* to = from + size;
+
+	if(size <= 0 || to <= start || from >= end) return;
+
+	if(from < start) from = start;
+	if(to > end) to = end;
+
+	s32 first = (s32)(from - start) / sizeof(tic_tile);
+	s32 last = (s32)(to - start - 1) / sizeof(tic_tile);
+
+	memset(machine->tiles.valid + first, false, (last - first + 1) * sizeof(bool));
 }
 
+typedef void(*BlitTileFunc)(tic_machine* machine, const u8* pixels, s32 x, s32 y, u16 transparent, const u8* palette);
+
+// the screen mode is a constant in each copy of the walk, so the per pixel write has no branch
+#define BLIT_TILE_ROWS(Shadow, StepX, StepY)															\
+	for(s32 row = r0; row < r1; row++)																	\
+	{																									\
+		const u8* src = pixels + Start + row * StepY + c0 * StepX;										\
+		s32 index = (y + row) * TIC80_WIDTH + x + c0;													\
+																										\
+		for(s32 col = c0; col < c1; col++, src += StepX, index++)										\
+		{																								\
+			u8 color = *src;																			\
+			if(transparent & 1 << color) continue;														\
+																										\
+			writePixel(machine, Shadow, index, palette[color]);											\
+		}																								\
+	}
+
+// every flip/rotate combination at scale 1 is one of 8 source walks,
+// the source index of the destination pixel (col, row) is start + col * StepX + row * StepY
+#define BLIT_TILE_FUNC(NAME, StepX, StepY)																\
+static void NAME(tic_machine* machine, const u8* pixels, s32 x, s32 y, u16 transparent, const u8* palette)	\
+{																										\
+	enum {Size = TIC_SPRITESIZE, Last = TIC_SPRITESIZE - 1};											\
+	enum {Start = (StepX < 0 ? -StepX * Last : 0) + (StepY < 0 ? -StepY * Last : 0)};					\
+	const Clip* clip = &machine->state.clip;															\
+	s32 c0 = max(clip->l - x, 0), c1 = min(clip->r - x, Size);											\
+	s32 r0 = max(clip->t - y, 0), r1 = min(clip->b - y, Size);											\
+																										\
+	machine->shadow.dirty = true;																		\
+																										\
+	if(machine->shadow.enabled)																			\
+	{																									\
+		BLIT_TILE_ROWS(true, StepX, StepY)																\
+	}																									\
+	else																								\
+	{																									\
+		BLIT_TILE_ROWS(false, StepX, StepY)																\
+	}																									\
+}
+
+BLIT_TILE_FUNC(blitTileNormal, 1, TIC_SPRITESIZE)
+BLIT_TILE_FUNC(blitTileHorz, -1, TIC_SPRITESIZE)
+BLIT_TILE_FUNC(blitTileVert, 1, -TIC_SPRITESIZE)
+BLIT_TILE_FUNC(blitTileHorzVert, -1, -TIC_SPRITESIZE)
+BLIT_TILE_FUNC(blitTileTranspose, TIC_SPRITESIZE, 1)
+BLIT_TILE_FUNC(blitTileTransposeHorz, -TIC_SPRITESIZE, 1)
+BLIT_TILE_FUNC(blitTileTransposeVert, TIC_SPRITESIZE, -1)
+BLIT_TILE_FUNC(blitTileTransposeHorzVert, -TIC_SPRITESIZE, -1)
+
+#undef BLIT_TILE_FUNC
+#undef BLIT_TILE_ROWS
+
+static const struct
+{
+	BlitTileFunc blit;
+	s32 start;
+	s32 stepX;
+	s32 stepY;
+} TileWalks[4][4] =
+{
+	// [flip][rotate]
+	{
+		{blitTileNormal, 0, 1, 8},
+		{blitTileTransposeHorz, 56, -8, 1},
+		{blitTileHorzVert, 63, -1, -8},
+		{blitTileTransposeVert, 7, 8, -1},
+	},
+	{
+		{blitTileHorz, 7, -1, 8},
+		{blitTileTranspose, 0, 8, 1},
+		{blitTileVert, 56, 1, -8},
+		{blitTileTransposeHorzVert, 63, -8, -1},
+	},
+	{
+		{blitTileVert, 56, 1, -8},
+		{blitTileTransposeHorzVert, 63, -8, -1},
+		{blitTileHorz, 7, -1, 8},
+		{blitTileTranspose, 0, 8, 1},
+	},
+	{
+		{blitTileHorzVert, 63, -1, -8},
+		{blitTileTransposeVert, 7, 8, -1},
+		{blitTileNormal, 0, 1, 8},
+		{blitTileTransposeHorz, 56, -8, 1},
+	},
+};
+
 static void drawTile(tic_machine* machine, const tic_tile* buffer, s32 x, s32 y, u8* colors, s32 count, s32 scale, tic_flip flip, tic_rotate rotate)
 {
 	flip &= 0b11;
 	rotate &= 0b11;
 
-	s32 a = flip & tic_horz_flip ? -scale : scale;
-	s32 b = flip & tic_vert_flip ? -scale : scale;
+	const s32 size = TIC_SPRITESIZE * scale;
+	const Clip* clip = &machine->state.clip;
 
-	void(*drawRectFunc)(tic_machine*, s32, s32, s32, s32, u8) = drawRect;
+	if(scale <= 0 || x >= clip->r || y >= clip->b || x + size <= clip->l || y + size <= clip->t) return;
 
-	if(rotate == tic_90_rotate) a = -a;
-	else if(rotate == tic_180_rotate) a = -a, b = -b;
-	else if(rotate == tic_270_rotate) b = -b;
+	u16 transparent = 0;
+	for(s32 i = 0; i < count; i++)
+		if(colors[i] < TIC_PALETTE_SIZE)
+			transparent |= 1 << colors[i];
 
-	x += (scale - a) * (TIC_SPRITESIZE - 1) >> 1;
-	y += (scale - b) * (TIC_SPRITESIZE - 1) >> 1;
+	TileCache temp;
+	const TileCache* tile = getTileCache(machine, buffer, &temp);
 
-	if(rotate == tic_90_rotate || rotate == tic_270_rotate)
-	{
-		s32 t = a; a = b; b = t;
-		t = x; x = y; y = t;
-		drawRectFunc = drawRectRev;
-	}
+	if(!(tile->colors & ~transparent)) return;
 
-	for(s32 i = 0, px = 0, xx = x; i < TIC_SPRITESIZE * TIC_SPRITESIZE; px++, xx += a, i++)
+	if(scale == 1)
 	{
-		if(px == TIC_SPRITESIZE) px = 0, xx = x, y += b;
+		u8 palette[TIC_PALETTE_SIZE];
+		for(s32 i = 0; i < TIC_PALETTE_SIZE; i++)
+			palette[i] = mapColor(machine, i);
 
-		u8 color = tic_tool_peek4(buffer, i);
+		TileWalks[flip][rotate].blit(machine, tile->pixels, x, y, transparent, palette);
+	}
+	else
+	{
+		const s32 start = TileWalks[flip][rotate].start;
+		const s32 stepX = TileWalks[flip][rotate].stepX;
+		const s32 stepY = TileWalks[flip][rotate].stepY;
 
-		if(count == 1)
-		{
-			if(*colors != color)
-				drawRectFunc(machine, xx, y, scale, scale, color);
-		}
-		else
-		{
-			bool draw = true;
-			for(s32 i = 0; i < count; i++)
+		for(s32 row = 0, yy = y; row < TIC_SPRITESIZE; row++, yy += scale)
+			for(s32 col = 0, xx = x; col < TIC_SPRITESIZE; col++, xx += scale)
 			{
-				if(color == colors[i])
-				{
-					draw = false;
-					break;
-				}
-			}
+				u8 color = tile->pixels[start + col * stepX + row * stepY];
 
-			if(draw)
-				drawRectFunc(machine, xx, y, scale, scale, color);
-		}
+				if(!(transparent & 1 << color))
+					drawRect(machine, xx, yy, scale, scale, color);
+			}
 	}
 }
 
-static void drawMap(tic_machine* machine, const tic_gfx* src, s32 x, s32 y, s32 width, s32 height, s32 sx, s32 sy, u8 chromakey, s32 scale, RemapFunc remap, void* data)
+static void drawMap(tic_machine* machine, const tic_gfx* src, s32 x, s32 y, s32 width, s32 height, s32 sx, s32 sy, u8 chromakey, s32 scale, const RemapResult* table, RemapFunc remap, void* data)
 {
 	const s32 size = TIC_SPRITESIZE * scale;
 
@@ -276,6 +610,9 @@ static void drawMap(tic_machine* machine, const tic_gfx* src, s32 x, s32 y, s32
 			s32 index = mi + mj * TIC_MAP_WIDTH;
 			RemapResult tile = { *(src->map.data + index), tic_no_flip, tic_no_rotate };
 
+			if(table)
+				tile = table[tile.index];
+
 			if (remap){
 				remap(data, mi, mj, &tile);
 			}
@@ -305,10 +642,11 @@ static void channelSfx(tic_mem* memory, s32 index, s32 note, s32 octave, s32 dur
 	// start index of idealized piano
 	enum {PianoStart = -8};
 
-	s32 freq = (s32)note2freq(note + octave * NOTES + PianoStart);
+	s32 freq = getNoteFreq(&machine->sound, note + octave * NOTES + PianoStart);
 
 	c->duration = duration;
 	c->freq = freq;
+	c->note = freq2note(c->freq);
 	c->index = index;
 
 	resetSfx(c);
@@ -420,12 +758,131 @@ static void api_clip(tic_mem* memory, s32 x, s32 y, s32 width, s32 height)
 	if(machine->state.clip.b > TIC80_HEIGHT) machine->state.clip.b = TIC80_HEIGHT;
 }
 
+#define PARTICLE_SEED 0x2545F491
+
+static void api_particle_clear(tic_mem* memory)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	memset(&machine->state.particles, 0, sizeof(ParticlePool));
+	machine->state.particles.seed = PARTICLE_SEED;
+}
+
+static void api_particle_emitter(tic_mem* memory, s32 id, const tic_particle_emitter* emitter)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	if(id < 0 || id >= PARTICLE_EMITTERS) return;
+
+	tic_particle_emitter* dst = &machine->state.particles.emitters[id];
+
+	*dst = *emitter;
+
+	if(dst->life < 1) dst->life = 1;
+	if(dst->life > UINT16_MAX) dst->life = UINT16_MAX;
+	if(dst->count < 0) dst->count = 0;
+	if(dst->count > TIC_PARTICLE_COLORS) dst->count = TIC_PARTICLE_COLORS;
+}
+
+// xorshift, the pool is seeded on reset so a cart sees the same particles every run
+static float getParticleRandom(ParticlePool* pool)
+{
+	u32 x = pool->seed ? pool->seed : PARTICLE_SEED;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	pool->seed = x;
+
+	return (x >> 8) / (float)(1 << 24);
+}
+
+static void api_particle_emit(tic_mem* memory, s32 id, s32 x, s32 y, s32 count)
+{
+	tic_machine* machine = (tic_machine*)memory;
+	ParticlePool* pool = &machine->state.particles;
+
+	if(id < 0 || id >= PARTICLE_EMITTERS) return;
+
+	const tic_particle_emitter* emitter = &pool->emitters[id];
+
+	for(s32 i = 0; i < count && pool->count < PARTICLES_COUNT; i++)
+	{
+		Particle* p = &pool->items[pool->count++];
+		float angle = emitter->angle + (getParticleRandom(pool) - 0.5f) * emitter->spread;
+
+		p->x = (float)x;
+		p->y = (float)y;
+		p->vx = cosf(angle) * emitter->speed;
+		p->vy = sinf(angle) * emitter->speed;
+		p->age = 0;
+		p->life = emitter->life;
+		p->emitter = id;
+	}
+}
+
+static void updateParticles(tic_machine* machine)
+{
+	// past 2^24 floats skip whole pixels, so particles that far off are dropped,
+	// as are those that went inf or NaN, before draw converts them to s32
+	enum {Limit = 1 << 24};
+
+	ParticlePool* pool = &machine->state.particles;
+
+	for(s32 i = 0; i < pool->count;)
+	{
+		Particle* p = &pool->items[i];
+
+		if(++p->age < p->life)
+		{
+			p->vy += pool->emitters[p->emitter].gravity;
+			p->x += p->vx;
+			p->y += p->vy;
+
+			if(fabsf(p->x) < Limit && fabsf(p->y) < Limit)
+			{
+				i++;
+				continue;
+			}
+		}
+
+		*p = pool->items[--pool->count];
+	}
+}
+
+static s32 api_particle_draw(tic_mem* memory)
+{
+	tic_machine* machine = (tic_machine*)memory;
+	ParticlePool* pool = &machine->state.particles;
+
+	for(s32 i = 0; i < pool->count; i++)
+	{
+		const Particle* p = &pool->items[i];
+		const tic_particle_emitter* emitter = &pool->emitters[p->emitter];
+		s32 x = (s32)floorf(p->x);
+		s32 y = (s32)floorf(p->y);
+
+		if(emitter->sprite >= 0)
+		{
+			if(emitter->sprite < TIC_SPRITES)
+			{
+				u8 transparent = 0;
+				drawTile(machine, memory->ram.gfx.tiles + emitter->sprite, x, y, &transparent, 1, 1, tic_no_flip, tic_no_rotate);
+			}
+		}
+		else if(emitter->count)
+			setPixel(machine, x, y, emitter->colors[p->age * emitter->count / p->life]);
+	}
+
+	return pool->count;
+}
+
 static void api_reset(tic_mem* memory)
 {
 	resetPalette(memory);
 	api_clip(memory, 0, 0, TIC80_WIDTH, TIC80_HEIGHT);
 
 	soundClear(memory);
+	api_particle_clear(memory);
 
 	tic_machine* machine = (tic_machine*)memory;
 	machine->state.initialized = false;
@@ -442,7 +899,10 @@ static void api_pause(tic_mem* memory)
 	memcpy(&machine->pause.state, &machine->state, sizeof(MachineState));
 	memcpy(&machine->pause.registers, &memory->ram.registers, sizeof memory->ram.registers);
 	memcpy(&machine->pause.music_pos, &memory->ram.music_pos, sizeof memory->ram.music_pos);
+
+	packShadow(machine);
 	memcpy(&machine->pause.vram, &memory->ram.vram, sizeof memory->ram.vram);
+	memcpy(&machine->pause.raster, &memory->ram.raster, sizeof memory->ram.raster);
 }
 
 static void api_resume(tic_mem* memory)
@@ -454,6 +914,45 @@ static void api_resume(tic_mem* memory)
 	memcpy(&memory->ram.registers, &machine->pause.registers, sizeof memory->ram.registers);
 	memcpy(&memory->ram.music_pos, &machine->pause.music_pos, sizeof memory->ram.music_pos);
 	memcpy(&memory->ram.vram, &machine->pause.vram, sizeof memory->ram.vram);
+	memcpy(&memory->ram.raster, &machine->pause.raster, sizeof memory->ram.raster);
+
+	if(machine->shadow.enabled)
+	{
+		unpackShadow(machine, 0, sizeof(tic_screen));
+		machine->shadow.dirty = false;
+	}
+}
+
+// the VMs share the machine heap, so a new one starts only after all of them are gone
+static void closeScripts(tic_machine* machine)
+{
+	closeWren(machine);
+	closeJavascript(machine);
+	closeLua(machine);
+}
+
+bool writeCodeChunk(CodeChunk* chunk, const void* data, s32 size)
+{
+	if(chunk->size + size > chunk->capacity)
+	{
+		s32 capacity = chunk->capacity ? chunk->capacity : 1024;
+
+		while(chunk->size + size > capacity)
+			capacity *= 2;
+
+		u8* grown = realloc(chunk->data, capacity);
+
+		if(!grown)
+			return false;
+
+		chunk->data = grown;
+		chunk->capacity = capacity;
+	}
+
+	memcpy(chunk->data + chunk->size, data, size);
+	chunk->size += size;
+
+	return true;
 }
 
 void tic_close(tic_mem* memory)
@@ -462,11 +961,13 @@ void tic_close(tic_mem* memory)
 
 	machine->state.initialized = false;
 
-	closeWren(machine);
-	closeJavascript(machine);
-	closeLua(machine);
+	closeScripts(machine);
 	blip_delete(machine->blip);
 
+	free(machine->moonscript.compiler.data);
+	free(machine->moonscript.code.data);
+	free(machine->binary.chunk.data);
+
 	free(memory->samples.buffer);
 	free(machine);
 }
@@ -491,7 +992,7 @@ static void api_clear(tic_mem* memory, u8 color)
 	if(memcmp(&machine->state.clip, &EmptyClip, sizeof(Clip)) == 0)
 	{
 		color &= 0b00001111;
-		memset(memory->ram.vram.screen.data, color | (color << TIC_PALETTE_BPP), sizeof(memory->ram.vram.screen.data));
+		drawSpan(machine, 0, TIC80_WIDTH * TIC80_HEIGHT, color);
 	}
 	else
 	{
@@ -501,96 +1002,205 @@ static void api_clear(tic_mem* memory, u8 color)
 	memory->ram.vram.vars.bg = color & 0xf;
 }
 
-static s32 drawChar(tic_mem* memory, u8 symbol, s32 x, s32 y, s32 width, s32 height, u8 color, s32 scale)
+static void buildGlyph(const u8* ptr, FontGlyph* glyph)
 {
-	const u8* ptr = memory->font.data + symbol*BITS_IN_BYTE;
-	x += (BITS_IN_BYTE - 1)*scale;
+	u8 lit = 0;
 
-	for(s32 i = 0, ys = y; i < TIC_FONT_HEIGHT; i++, ptr++, ys += scale)
-		for(s32 col = BITS_IN_BYTE - TIC_FONT_WIDTH, xs = x - col; col < BITS_IN_BYTE; col++, xs -= scale)
-			if(*ptr & 1 << col)
-				api_rect(memory, xs, ys, scale, scale, color);
+	for(s32 i = 0; i < TIC_FONT_HEIGHT; i++)
+	{
+		u8 row = 0;
 
-	return TIC_FONT_WIDTH*scale;
-}
+		for(s32 col = 0; col < TIC_FONT_WIDTH; col++)
+			if(ptr[i] & 0b10000000 >> col)
+				row |= 1 << col;
 
-static s32 api_draw_char(tic_mem* memory, u8 symbol, s32 x, s32 y, u8 color)
-{
-	return drawChar(memory, symbol, x, y, TIC_FONT_WIDTH, TIC_FONT_HEIGHT, color, 1);
-}
+		glyph->rows[i] = row;
+		lit |= row;
+	}
 
-s32 drawText(tic_mem* memory, const char* text, s32 x, s32 y, s32 width, s32 height, u8 color, s32 scale, DrawCharFunc* func)
-{
-	s32 pos = x;
-	s32 max = x;
-	char sym = 0;
+	glyph->start = glyph->end = 0;
 
-	while((sym = *text++))
+	if(lit)
 	{
-		if(sym == '\n')
-		{
-			if(pos > max)
-				max = pos;
+		while(!(lit & 1 << glyph->start)) glyph->start++;
 
-			pos = x;
-			y += height * scale;
-		}
-		else pos += func(memory, sym, pos, y, width, height, color, scale);
+		glyph->end = TIC_FONT_WIDTH;
+		while(!(lit & 1 << (glyph->end - 1))) glyph->end--;
 	}
+}
 
-	return pos > max ? pos - x : max - x;
+static void updateFontCache(tic_machine* machine)
+{
+	FontCache* cache = &machine->font;
+	const tic_font* font = &machine->memory.font;
+
+	if(cache->valid)
+		return;
+
+	for(s32 i = 0; i < TIC_FONT_CHARS; i++)
+		buildGlyph(font->data + i*BITS_IN_BYTE, &cache->glyphs[i]);
+
+	cache->valid = true;
 }
 
-static s32 api_fixed_text(tic_mem* memory, const char* text, s32 x, s32 y, u8 color)
+static const FontGlyph* getGlyph(tic_machine* machine, u8 symbol)
 {
-	return drawText(memory, text, x, y, TIC_FONT_WIDTH, TIC_FONT_HEIGHT, color, 1, drawChar);
+	static const FontGlyph Blank;
+
+	// symbols past the font table have no bitmap and render as blanks
+	return symbol < TIC_FONT_CHARS ? &machine->font.glyphs[symbol] : &Blank;
 }
 
-static s32 drawNonFixedChar(tic_mem* memory, u8 symbol, s32 x, s32 y, s32 width, s32 height, u8 color, s32 scale)
+// draws columns [first, last) of the glyph with column 'first' at x
+static void drawGlyph(tic_machine* machine, const FontGlyph* glyph, s32 first, s32 last, s32 x, s32 y, u8 color, s32 scale)
 {
-	const u8* ptr = memory->font.data + (symbol)*BITS_IN_BYTE;
+	const Clip* clip = &machine->state.clip;
 
-	s32 start = 0;
-	s32 end = TIC_FONT_WIDTH;
-	s32 i = 0;
+	if(first >= last || scale <= 0) return;
 
-	for(s32 col = 0; col < TIC_FONT_WIDTH; col++)
-	{
-		for(i = 0; i < TIC_FONT_HEIGHT; i++)
-			if(*(ptr + i) & 0b10000000 >> col) break;
+	s32 right = x + (last - first) * scale;
+	s32 bottom = y + TIC_FONT_HEIGHT * scale;
 
-		if(i < TIC_FONT_HEIGHT)	break; else start++;
-	}
+	if(x >= clip->r || right <= clip->l || y >= clip->b || bottom <= clip->t) return;
 
-	x -= start * scale;
+	bool inside = x >= clip->l && right <= clip->r && y >= clip->t && bottom <= clip->b;
+
+	color = mapColor(machine, color);
 
-	for(s32 col = TIC_FONT_WIDTH - 1; col >= start; col--)
+	for(s32 i = 0, ys = y; i < TIC_FONT_HEIGHT; i++, ys += scale)
 	{
-		for(i = 0; i < TIC_FONT_HEIGHT; i++)
-			if(*(ptr + i) & 0b10000000 >> col) break;
+		u8 row = glyph->rows[i];
 
-		if(i < TIC_FONT_HEIGHT)	break; else end--;
-	}
+		if(!row) continue;
 
-	for(s32 ys = y, i = 0; i < TIC_FONT_HEIGHT; i++, ptr++, ys += scale)
-		for(s32 col = start, xs = x + start*scale; col < end; col++, xs += scale)
-			if(*ptr & 0b10000000 >> col)
-				api_rect(memory, xs, ys, scale, scale, color);
+		s32 yl = ys, yr = ys + scale;
 
-	s32 size = end - start;
+		if(!inside)
+		{
+			yl = max(yl, clip->t);
+			yr = min(yr, clip->b);
+
+			if(yl >= yr) continue;
+		}
+
+		for(s32 col = first; col < last;)
+		{
+			if(!(row & 1 << col))
+			{
+				col++;
+				continue;
+			}
+
+			s32 end = col + 1;
+			while(end < last && row & 1 << end) end++;
+
+			s32 xl = x + (col - first) * scale;
+			s32 xr = x + (end - first) * scale;
+
+			if(!inside)
+			{
+				xl = max(xl, clip->l);
+				xr = min(xr, clip->r);
+			}
+
+			for(s32 yy = yl; yy < yr; yy++)
+				drawSpan(machine, yy * TIC80_WIDTH + xl, yy * TIC80_WIDTH + xr, color);
+
+			col = end;
+		}
+	}
+}
+
+static s32 drawChar(tic_mem* memory, u8 symbol, s32 x, s32 y, s32 width, s32 height, u8 color, s32 scale)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	// glyph bits are right aligned in the byte, the first column lands at x + 2*scale - 2
+	drawGlyph(machine, getGlyph(machine, symbol), 0, TIC_FONT_WIDTH, x + (BITS_IN_BYTE - TIC_FONT_WIDTH)*scale - (BITS_IN_BYTE - TIC_FONT_WIDTH), y, color, scale);
+
+	return TIC_FONT_WIDTH*scale;
+}
+
+static s32 fixedCharWidth(tic_mem* memory, u8 symbol, s32 x, s32 y, s32 width, s32 height, u8 color, s32 scale)
+{
+	return TIC_FONT_WIDTH*scale;
+}
+
+static s32 api_draw_char(tic_mem* memory, u8 symbol, s32 x, s32 y, u8 color)
+{
+	updateFontCache((tic_machine*)memory);
+
+	return drawChar(memory, symbol, x, y, TIC_FONT_WIDTH, TIC_FONT_HEIGHT, color, 1);
+}
+
+s32 drawText(tic_mem* memory, const char* text, s32 x, s32 y, s32 width, s32 height, u8 color, s32 scale, DrawCharFunc* func)
+{
+	s32 pos = x;
+	s32 max = x;
+	char sym = 0;
+
+	while((sym = *text++))
+	{
+		if(sym == '\n')
+		{
+			if(pos > max)
+				max = pos;
+
+			pos = x;
+			y += height * scale;
+		}
+		else pos += func(memory, sym, pos, y, width, height, color, scale);
+	}
+
+	return pos > max ? pos - x : max - x;
+}
+
+static s32 api_fixed_text(tic_mem* memory, const char* text, s32 x, s32 y, u8 color)
+{
+	updateFontCache((tic_machine*)memory);
+
+	return drawText(memory, text, x, y, TIC_FONT_WIDTH, TIC_FONT_HEIGHT, color, 1, drawChar);
+}
+
+static s32 nonFixedCharWidth(tic_mem* memory, u8 symbol, s32 x, s32 y, s32 width, s32 height, u8 color, s32 scale)
+{
+	const FontGlyph* glyph = getGlyph((tic_machine*)memory, symbol);
+
+	s32 size = glyph->end - glyph->start;
 	return (size ? size + 1 : TIC_FONT_WIDTH - 2) * scale;
 }
 
+static s32 drawNonFixedChar(tic_mem* memory, u8 symbol, s32 x, s32 y, s32 width, s32 height, u8 color, s32 scale)
+{
+	tic_machine* machine = (tic_machine*)memory;
+	const FontGlyph* glyph = getGlyph(machine, symbol);
+
+	drawGlyph(machine, glyph, glyph->start, glyph->end, x, y, color, scale);
+
+	return nonFixedCharWidth(memory, symbol, x, y, width, height, color, scale);
+}
+
 static s32 api_text(tic_mem* memory, const char* text, s32 x, s32 y, u8 color)
 {
+	updateFontCache((tic_machine*)memory);
+
 	return drawText(memory, text, x, y, TIC_FONT_WIDTH, TIC_FONT_HEIGHT, color, 1, drawNonFixedChar);
 }
 
 static s32 api_text_ex(tic_mem* memory, const char* text, s32 x, s32 y, u8 color, bool fixed, s32 scale)
 {
+	updateFontCache((tic_machine*)memory);
+
 	return drawText(memory, text, x, y, TIC_FONT_WIDTH, TIC_FONT_HEIGHT, color, scale, fixed ? drawChar : drawNonFixedChar);
 }
 
+static s32 api_text_width(tic_mem* memory, const char* text, bool fixed, s32 scale)
+{
+	updateFontCache((tic_machine*)memory);
+
+	return drawText(memory, text, 0, 0, TIC_FONT_WIDTH, TIC_FONT_HEIGHT, 0, scale, fixed ? fixedCharWidth : nonFixedCharWidth);
+}
+
 static void drawSprite(tic_mem* memory, const tic_gfx* src, s32 index, s32 x, s32 y, u8* colors, s32 count, s32 scale, tic_flip flip, tic_rotate rotate)
 {
 	if(index < TIC_SPRITES)
@@ -648,7 +1258,8 @@ s32 drawSpriteFont(tic_mem* memory, u8 symbol, s32 x, s32 y, s32 width, s32 heig
 
 s32 drawFixedSpriteFont(tic_mem* memory, u8 index, s32 x, s32 y, s32 width, s32 height, u8 chromakey, s32 scale)
 {
-	const u8* ptr = memory->ram.gfx.sprites[index].data;
+	TileCache temp;
+	const u8* ptr = getTileCache((tic_machine*)memory, &memory->ram.gfx.sprites[index], &temp)->pixels;
 
 	enum {Size = TIC_SPRITESIZE};
 
@@ -659,7 +1270,7 @@ s32 drawFixedSpriteFont(tic_mem* memory, u8 index, s32 x, s32 y, s32 width, s32
 	for(s32 col = 0; col < Size; col++)
 	{
 		for(i = 0; i < Size*Size; i += Size)
-			if(tic_tool_peek4(ptr, col + i) != chromakey) break;
+			if(ptr[col + i] != chromakey) break;
 
 		if(i < Size*Size) break; else start++;
 	}
@@ -669,7 +1280,7 @@ s32 drawFixedSpriteFont(tic_mem* memory, u8 index, s32 x, s32 y, s32 width, s32
 	for(s32 col = Size - 1; col >= start; col--)
 	{
 		for(i = 0; i < Size*Size; i += Size)
-			if(tic_tool_peek4(ptr, col + i) != chromakey) break;
+			if(ptr[col + i] != chromakey) break;
 
 		if(i < Size*Size) break; else end--;
 	}
@@ -678,7 +1289,7 @@ s32 drawFixedSpriteFont(tic_mem* memory, u8 index, s32 x, s32 y, s32 width, s32
 	{
 		for(s32 col = start, xs = x + start*scale; col < end; col++, xs += scale)
 		{
-			u8 color = tic_tool_peek4(ptr, col + row * Size);
+			u8 color = ptr[col + row * Size];
 
 			if(color != chromakey)
 				api_rect(memory, xs, ys, scale, scale, color);
@@ -710,282 +1321,881 @@ static void api_rect_border(tic_mem* memory, s32 x, s32 y, s32 width, s32 height
 	drawRectBorder(machine, x, y, width, height, color);
 }
 
-static struct
+static void initSidesBuffer(SidesBuffer* sides)
 {
-	s16 Left[TIC80_HEIGHT];
-	s16 Right[TIC80_HEIGHT];
-	float ULeft[TIC80_HEIGHT];
-	float VLeft[TIC80_HEIGHT];
-	float URight[TIC80_HEIGHT];
-	float VRight[TIC80_HEIGHT];
-} SidesBuffer;
+	for(s32 i = 0; i < COUNT_OF(sides->Left); i++)
+		sides->Left[i] = TIC80_WIDTH, sides->Right[i] = -1;
+}
 
-static void initSidesBuffer()
+static void setSidePixel(SidesBuffer* sides, s32 x, s32 y)
 {
-	for(s32 i = 0; i < COUNT_OF(SidesBuffer.Left); i++)
-		SidesBuffer.Left[i] = TIC80_WIDTH, SidesBuffer.Right[i] = -1;
+	if(y >= 0 && y < TIC80_HEIGHT)
+	{
+		// spans are clipped anyway, keep far away points in the s16 range
+		x = min(max(x, -1), TIC80_WIDTH);
+
+		if(x < sides->Left[y]) sides->Left[y] = x;
+		if(x > sides->Right[y]) sides->Right[y] = x;
+	}
 }
 
-static void setSidePixel(s32 x, s32 y)
+// true when the whole clip rect is further than 'radius' inside the circle
+static bool clipInsideCircle(const Clip* clip, s32 xm, s32 ym, s32 radius)
 {
-	if(y >= 0 && y < TIC80_HEIGHT)
+	if(radius <= 0) return false;
+
+	s64 l = clip->l - xm, r = clip->r - 1 - xm;
+	s64 t = clip->t - ym, b = clip->b - 1 - ym;
+	s64 dx = max(l * l, r * r);
+	s64 dy = max(t * t, b * b);
+
+	return dx + dy < (s64)radius * radius;
+}
+
+static bool clipOutsideCircle(const Clip* clip, s32 xm, s32 ym, s32 radius)
+{
+	return (s64)xm + radius < clip->l || (s64)xm - radius >= clip->r
+		|| (s64)ym + radius < clip->t || (s64)ym - radius >= clip->b;
+}
+
+static inline s64 isqrt64(s64 value)
+{
+	s64 root = (s64)sqrt((double)value);
+
+	while(root * root > value) root--;
+	while((root + 1) * (root + 1) <= value) root++;
+
+	return root;
+}
+
+// Circles are Zingl's Bresenham walk: x goes from -radius to 0 while y goes
+// from 0 to radius, and every (x, y) it visits is drawn in all 4 quadrants.
+// Where the walk leaves row y only depends on the pixel it came in on and on
+// where row y crosses the circle, and restarting the walk on the curve two
+// rows up always comes in on the same pixel (checked for every radius up to
+// 30000, tests/test_circle.c checks huge ones), so any row can be worked out
+// without walking from the top and a clipped circle only costs its visible rows.
+
+// where the walk leaves row y, unless it came in further right: the first x
+// with (x + 1)^2 <= r^2 - y^2 - y - 1, 0 past the bottom of the circle
+static s32 circleRowExit(s64 r2, s32 y)
+{
+	s64 k = r2 - (s64)y * y - y - 1;
+
+	return k < 0 ? 0 : -(s32)isqrt64(k) - 1;
+}
+
+// one step of the walk from its last pixel on row y, returns x on row y + 1
+static s32 circleStep(s64 r2, s32 x, s32 y)
+{
+	s64 err = (s64)(x + 1) * (x + 1) - r2 + (s64)(y + 1) * (y + 1);
+	s64 e = err;
+
+	if (e <= y) err += ++y*2+1;
+	if (e > x || err > y) x++;
+
+	return x;
+}
+
+// where the walk comes in on row y
+static s32 circleRowEntry(s64 r2, s32 radius, s32 y)
+{
+	s32 x = -radius;
+
+	if(y > 1) x = circleStep(r2, circleRowExit(r2, y - 2), y - 2);
+
+	if(y > 0)
+	{
+		s32 exit = circleRowExit(r2, y - 1);
+		x = circleStep(r2, max(x, exit), y - 1);
+	}
+
+	return x;
+}
+
+typedef void(CircleRowFunc)(tic_machine* machine, s32 xm, s32 y, s32 first, s32 last, u8 color);
+
+// calls 'func' for the rows of the circle inside the clip rect, 'first' and
+// 'last' are the walk's x range on that row, -radius <= first <= last <= 0
+static void drawCircle(tic_machine* machine, s32 xm, s32 ym, s32 radius, u8 color, CircleRowFunc* func)
+{
+	const Clip* clip = &machine->state.clip;
+
+	s64 top = max((s64)ym - radius, clip->t);
+	s64 bottom = min((s64)ym + radius, clip->b - 1);
+
+	if(top > bottom) return;
+
+	s64 r2 = (s64)radius * radius;
+
+	// both halves go down from the centre row, as the walk does
+	s32 from = top > ym ? top - ym : bottom < ym ? ym - bottom : 0;
+	s32 to = max(ym - top, bottom - ym);
+
+	s32 first = circleRowEntry(r2, radius, from);
+
+	for(s32 y = from; y <= to; y++)
+	{
+		s32 exit = circleRowExit(r2, y);
+		s32 last = max(first, exit);
+
+		if((s64)ym + y <= bottom) func(machine, xm, ym + y, first, last, color);
+		if(y && (s64)ym - y >= top) func(machine, xm, ym - y, first, last, color);
+
+		first = circleStep(r2, last, y);
+	}
+}
+
+// span from x0 to x1 inclusive, the ends can be far off screen
+static void drawClippedSpan(tic_machine* machine, s64 x0, s64 x1, s32 y, u8 color)
+{
+	const Clip* clip = &machine->state.clip;
+
+	s32 left = max(x0, clip->l);
+	s32 right = min(x1, clip->r - 1);
+
+	if(left <= right)
+		drawSpan(machine, y * TIC80_WIDTH + left, y * TIC80_WIDTH + right + 1, color);
+}
+
+static void drawCircleRow(tic_machine* machine, s32 xm, s32 y, s32 first, s32 last, u8 color)
+{
+	drawClippedSpan(machine, (s64)xm + first, (s64)xm - first, y, color);
+}
+
+static void drawCircleBorderRow(tic_machine* machine, s32 xm, s32 y, s32 first, s32 last, u8 color)
+{
+	drawClippedSpan(machine, (s64)xm + first, (s64)xm + last, y, color);
+	drawClippedSpan(machine, (s64)xm - last, (s64)xm - first, y, color);
+}
+
+static void api_circle(tic_mem* memory, s32 xm, s32 ym, u32 radius, u8 color)
+{
+	tic_machine* machine = (tic_machine*)memory;
+	const Clip* clip = &machine->state.clip;
+
+	if(clipOutsideCircle(clip, xm, ym, radius + 1)) return;
+
+	if(clipInsideCircle(clip, xm, ym, radius - 2))
+	{
+		drawRect(machine, clip->l, clip->t, clip->r - clip->l, clip->b - clip->t, color);
+		return;
+	}
+
+	drawCircle(machine, xm, ym, radius, mapColor(machine, color), drawCircleRow);
+}
+
+static void api_circle_border(tic_mem* memory, s32 xm, s32 ym, u32 radius, u8 color)
+{
+	tic_machine* machine = (tic_machine*)memory;
+	const Clip* clip = &machine->state.clip;
+
+	if(clipOutsideCircle(clip, xm, ym, radius + 1)) return;
+	if(clipInsideCircle(clip, xm, ym, radius - 2)) return;
+
+	drawCircle(machine, xm, ym, radius, mapColor(machine, color), drawCircleBorderRow);
+}
+
+enum
+{
+	OutLeft = 1 << 0,
+	OutRight = 1 << 1,
+	OutTop = 1 << 2,
+	OutBottom = 1 << 3,
+};
+
+static u8 outCode(const Clip* clip, s32 x, s32 y)
+{
+	return (x < clip->l ? OutLeft : x >= clip->r ? OutRight : 0)
+		| (y < clip->t ? OutTop : y >= clip->b ? OutBottom : 0);
+}
+
+static inline s64 floorDiv(s64 a, s64 b)
+{
+	return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+// Bresenham line expressed along its major axis: step k moves the major
+// coordinate by k and the minor one by ceil((k * minor - err) / major),
+// which lets the walk start and stop anywhere without iterating
+typedef struct
+{
+	s32 x, y;
+	s32 sx, sy;
+	s64 major;
+	s64 minor;
+	s64 err;
+	bool steep;
+} LineWalk;
+
+static void initLineWalk(LineWalk* walk, s32 x0, s32 y0, s32 x1, s32 y1)
+{
+	s64 dx = x1 > x0 ? (s64)x1 - x0 : (s64)x0 - x1;
+	s64 dy = y1 > y0 ? (s64)y1 - y0 : (s64)y0 - y1;
+
+	walk->x = x0;
+	walk->y = y0;
+	walk->sx = x0 < x1 ? 1 : -1;
+	walk->sy = y0 < y1 ? 1 : -1;
+	walk->steep = !(dx > dy);
+	walk->major = walk->steep ? dy : dx;
+	walk->minor = walk->steep ? dx : dy;
+	walk->err = walk->major / 2;
+}
+
+static inline s64 lineMinorAt(const LineWalk* walk, s64 k)
+{
+	return -floorDiv(walk->err - k * walk->minor, walk->major);
+}
+
+// first step whose minor offset is >= m
+static s64 lineFirstStep(const LineWalk* walk, s64 m)
+{
+	if(walk->minor == 0) return m <= 0 ? 0 : walk->major + 1;
+
+	return floorDiv((m - 1) * walk->major + walk->err, walk->minor) + 1;
+}
+
+// last step whose minor offset is <= m
+static s64 lineLastStep(const LineWalk* walk, s64 m)
+{
+	if(walk->minor == 0) return m >= 0 ? walk->major : -1;
+
+	return floorDiv(m * walk->major + walk->err, walk->minor);
+}
+
+// offsets n for which start + step * n lies in [lo, hi]
+static void axisRange(s32 start, s32 step, s32 lo, s32 hi, s64* from, s64* to)
+{
+	*from = step > 0 ? (s64)lo - start : (s64)start - hi;
+	*to = step > 0 ? (s64)hi - start : (s64)start - lo;
+}
+
+static bool clipLineWalk(const LineWalk* walk, const Clip* clip, s64* first, s64* last)
+{
+	s64 from, to;
+
+	if(walk->steep)
+		axisRange(walk->y, walk->sy, clip->t, clip->b - 1, &from, &to);
+	else axisRange(walk->x, walk->sx, clip->l, clip->r - 1, &from, &to);
+
+	*first = max(from, 0);
+	*last = min(to, walk->major);
+
+	if(walk->steep)
+		axisRange(walk->x, walk->sx, clip->l, clip->r - 1, &from, &to);
+	else axisRange(walk->y, walk->sy, clip->t, clip->b - 1, &from, &to);
+
+	*first = max(*first, lineFirstStep(walk, from));
+	*last = min(*last, lineLastStep(walk, to));
+
+	return *first <= *last;
+}
+
+static void drawLine(tic_machine* machine, s32 x0, s32 y0, s32 x1, s32 y1, u8 color)
+{
+	const Clip* clip = &machine->state.clip;
+
+	if(outCode(clip, x0, y0) & outCode(clip, x1, y1)) return;
+
+	LineWalk walk;
+	initLineWalk(&walk, x0, y0, x1, y1);
+
+	if(walk.major == 0)
+	{
+		setPixel(machine, x0, y0, color);
+		return;
+	}
+
+	s64 k, last;
+	if(!clipLineWalk(&walk, clip, &k, &last)) return;
+
+	s64 m = lineMinorAt(&walk, k);
+	s64 err = m * walk.major + walk.err - k * walk.minor;
+
+	s32 x = walk.x + walk.sx * (s32)(walk.steep ? m : k);
+	s32 y = walk.y + walk.sy * (s32)(walk.steep ? k : m);
+
+	s32 majorStep = walk.steep ? walk.sy * TIC80_WIDTH : walk.sx;
+	s32 minorStep = walk.steep ? walk.sx : walk.sy * TIC80_WIDTH;
+
+	color = mapColor(machine, color);
+	machine->shadow.dirty = true;
+
+	for(s32 pos = y * TIC80_WIDTH + x; k <= last; k++, pos += majorStep)
 	{
-		if(x < SidesBuffer.Left[y]) SidesBuffer.Left[y] = x;
-		if(x > SidesBuffer.Right[y]) SidesBuffer.Right[y] = x;
+		putPixel(machine, pos, color);
+
+		err -= walk.minor;
+		if(err < 0)
+		{
+			err += walk.major;
+			pos += minorStep;
+		}
 	}
 }
 
-static void setSideTexPixel(s32 x, s32 y, float u, float v)
+// records the leftmost and rightmost pixel of the line on every clipped row
+static void setSideLine(SidesBuffer* sides, const Clip* clip, s32 x0, s32 y0, s32 x1, s32 y1)
 {
-	s32 yy = (s32)y;
-	if (yy >= 0 && yy < TIC80_HEIGHT)
+	LineWalk walk;
+	initLineWalk(&walk, x0, y0, x1, y1);
+
+	if(walk.major == 0)
 	{
-		if (x < SidesBuffer.Left[yy])
+		setSidePixel(sides, x0, y0);
+		return;
+	}
+
+	s64 from, to;
+	axisRange(walk.y, walk.sy, clip->t, clip->b - 1, &from, &to);
+
+	if(walk.steep)
+	{
+		for(s64 k = max(from, 0), last = min(to, walk.major); k <= last; k++)
+			setSidePixel(sides, walk.x + walk.sx * (s32)lineMinorAt(&walk, k), walk.y + walk.sy * (s32)k);
+	}
+	else
+	{
+		for(s64 m = max(from, 0), last = min(to, walk.minor); m <= last; m++)
 		{
-			SidesBuffer.Left[yy] = x;
-			SidesBuffer.ULeft[yy] = u;
-			SidesBuffer.VLeft[yy] = v;
+			s64 first = max(lineFirstStep(&walk, m), 0);
+			s64 end = min(lineLastStep(&walk, m), walk.major);
+			s32 y = walk.y + walk.sy * (s32)m;
+
+			if(first > end) continue;
+
+			setSidePixel(sides, walk.x + walk.sx * (s32)first, y);
+			setSidePixel(sides, walk.x + walk.sx * (s32)end, y);
 		}
-		if (x > SidesBuffer.Right[yy])
+	}
+}
+
+static void api_tri(tic_mem* memory, s32 x1, s32 y1, s32 x2, s32 y2, s32 x3, s32 y3, u8 color)
+{
+	tic_machine* machine = (tic_machine*)memory;
+	SidesBuffer* sides = &machine->sides;
+	const Clip* clip = &machine->state.clip;
+
+	s32 top = max(min(min(y1, y2), y3), clip->t);
+	s32 bottom = min(max(max(y1, y2), y3), clip->b - 1);
+
+	if(top > bottom) return;
+
+	initSidesBuffer(sides);
+
+	setSideLine(sides, clip, x1, y1, x2, y2);
+	setSideLine(sides, clip, x2, y2, x3, y3);
+	setSideLine(sides, clip, x3, y3, x1, y1);
+
+	color = mapColor(machine, color);
+
+	for(s32 y = top; y <= bottom; y++)
+	{
+		s32 left = max(sides->Left[y], clip->l);
+		s32 right = min(sides->Right[y], clip->r - 1);
+
+		drawSpan(machine, y * TIC80_WIDTH + left, y * TIC80_WIDTH + right + 1, color);
+	}
+}
+
+
+enum {TexSegment = 8};
+
+// attribute plane a(x, y) = a0 + dx * x + dy * y in screen space
+typedef struct
+{
+	double a0;
+	double dx;
+	double dy;
+} TexPlane;
+
+static void initTexPlane(TexPlane* plane, const double* x, const double* y, const double* a, double det)
+{
+	plane->dx = ((a[1] - a[0]) * (y[2] - y[0]) - (a[2] - a[0]) * (y[1] - y[0])) / det;
+	plane->dy = ((a[2] - a[0]) * (x[1] - x[0]) - (a[1] - a[0]) * (x[2] - x[0])) / det;
+	plane->a0 = a[0] - plane->dx * x[0] - plane->dy * y[0];
+}
+
+static inline double texPlaneAt(const TexPlane* plane, double x, double y)
+{
+	return plane->a0 + plane->dx * x + plane->dy * y;
+}
+
+// 16.16 fixed point, clamped so wild coordinates or degenerate gradients can't overflow
+static inline s64 toTexFixed(double value)
+{
+	enum {Limit = 1 << 30};
+
+	if(value != value) return 0;
+
+	value = value < -Limit ? -Limit : value > Limit ? Limit : value;
+
+	return (s64)(value * (1 << 16));
+}
+
+// x of an edge at the centers of the rows it crosses, in 16.16
+typedef struct
+{
+	s64 x;
+	s64 step;
+
+	// too far off or too steep for 16.16, evaluated in double at every row instead
+	bool far;
+	double xa, ya, slope;
+} TexEdge;
+
+static void initTexEdge(TexEdge* edge, double xa, double ya, double xb, double yb, s32 row)
+{
+	enum {Limit = 1 << 24};
+
+	double slope = yb > ya ? (xb - xa) / (yb - ya) : 0;
+	double x = xa + (row + 0.5 - ya) * slope;
+
+	edge->far = !(fabs(x) < Limit && fabs(slope) < Limit);
+	edge->xa = xa;
+	edge->ya = ya;
+	edge->slope = slope;
+
+	edge->x = toTexFixed(x);
+	edge->step = toTexFixed(slope);
+}
+
+static inline void stepTexEdge(TexEdge* edge, s32 row)
+{
+	if(edge->far)
+		edge->x = toTexFixed(edge->xa + (row + 0.5 - edge->ya) * edge->slope);
+	else edge->x += edge->step;
+}
+
+// first pixel whose center is at or right of x, x is clamped to a pixel past the clip
+// rect first so edges far off screen don't wrap around s32
+static inline s32 texEdgePixel(s64 x, s32 left, s32 right)
+{
+	s64 from = (s64)(left - 1) << 16, to = (s64)(right + 1) << 16;
+
+	x = x < from ? from : x > to ? to : x;
+
+	return (s32)((x - (1 << 15) + 0xffff) >> 16);
+}
+
+typedef struct
+{
+	bool useMap;
+	u8 chroma;
+	u8 palette[TIC_PALETTE_SIZE];
+} TexSampler;
+
+static inline const u8* getTileTexels(tic_machine* machine, s32 index)
+{
+	return getTileCache(machine, &machine->memory.ram.gfx.tiles[index], NULL)->pixels;
+}
+
+// keeps a 16.16 coordinate in [0, size) while stepping, so the walk never divides
+static inline s64 wrapTexFixed(s64 value, s64 size)
+{
+	value %= size;
+	return value < 0 ? value + size : value;
+}
+
+static void drawTexSpan(tic_machine* machine, const TexSampler* sampler, s32 offset, s32 count, s64 u, s64 v, s64 du, s64 dv)
+{
+	const u8* texels = NULL;
+	s32 tile = -1;
+
+	machine->shadow.dirty = true;
+
+	if(sampler->useMap)
+	{
+		enum {MapWidth = TIC_MAP_WIDTH * TIC_SPRITESIZE, MapHeight = TIC_MAP_HEIGHT * TIC_SPRITESIZE};
+
+		const s64 width = (s64)MapWidth << 16, height = (s64)MapHeight << 16;
+		const u8* map = machine->memory.ram.gfx.map.data;
+
+		u = wrapTexFixed(u, width);
+		v = wrapTexFixed(v, height);
+		du %= width;
+		dv %= height;
+
+		for(; count > 0; count--, offset++)
+		{
+			s32 iu = (s32)(u >> 16);
+			s32 iv = (s32)(v >> 16);
+			s32 cell = (iv >> 3) * TIC_MAP_WIDTH + (iu >> 3);
+
+			if(cell != tile)
+			{
+				tile = cell;
+				texels = getTileTexels(machine, map[cell]);
+			}
+
+			u8 color = texels[(iu & 7) + ((iv & 7) << 3)];
+
+			if(color != sampler->chroma)
+				putPixel(machine, offset, sampler->palette[color]);
+
+			u += du;
+			v += dv;
+
+			if(u >= width) u -= width; else if(u < 0) u += width;
+			if(v >= height) v -= height; else if(v < 0) v += height;
+		}
+	}
+	else
+	{
+		enum {SheetWidth = TIC_SPRITESHEET_SIZE, SheetHeight = TIC_SPRITESHEET_SIZE * TIC_SPRITE_BANKS};
+
+		for(; count > 0; count--, offset++, u += du, v += dv)
 		{
-			SidesBuffer.Right[yy] = x;
-			SidesBuffer.URight[yy] = u;
-			SidesBuffer.VRight[yy] = v;
+			s32 iu = (s32)(u >> 16) & (SheetWidth - 1);
+			s32 iv = (s32)(v >> 16) & (SheetHeight - 1);
+			s32 index = (iu >> 3) + ((iv >> 3) << 4);
+
+			if(index != tile)
+			{
+				tile = index;
+				texels = getTileTexels(machine, index);
+			}
+
+			u8 color = texels[(iu & 7) + ((iv & 7) << 3)];
+
+			if(color != sampler->chroma)
+				putPixel(machine, offset, sampler->palette[color]);
 		}
 	}
 }
 
-static void api_circle(tic_mem* memory, s32 xm, s32 ym, u32 radius, u8 color)
+// Samples pixel centers with a top-left fill rule: a pixel is drawn when its
+// center is inside the triangle or on a top or left edge, so triangles sharing
+// an edge never overlap or leave gaps. The old float walk took the pixels its
+// edges truncated to and texels at their left edges, which differs on about a
+// fifth of the pixels of arbitrary triangles, see tests/test_textri.c.
+// Edges and spans are stepped in 16.16 and attributes are plane equations set
+// up once per triangle. With depth, u/z, v/z and 1/z are interpolated and
+// divided every TexSegment pixels.
+static void api_textri(tic_mem* memory, float x1, float y1, float x2, float y2, float x3, float y3, float u1, float v1, float u2, float v2, float u3, float v3, bool use_map, u8 chroma, float z1, float z2, float z3, bool depth)
 {
 	tic_machine* machine = (tic_machine*)memory;
+	const Clip* clip = &machine->state.clip;
+
+	const double x[] = {x1, x2, x3};
+	const double y[] = {y1, y2, y3};
+
+	double det = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+
+	if(det == 0 || det != det) return;
+
+	bool perspective = depth && z1 > 0 && z2 > 0 && z3 > 0;
+
+	const double w[] = {perspective ? 1.0 / z1 : 1.0, perspective ? 1.0 / z2 : 1.0, perspective ? 1.0 / z3 : 1.0};
+	const double u[] = {u1 * w[0], u2 * w[1], u3 * w[2]};
+	const double v[] = {v1 * w[0], v2 * w[1], v3 * w[2]};
+
+	TexPlane pu, pv, pw;
+	initTexPlane(&pu, x, y, u, det);
+	initTexPlane(&pv, x, y, v, det);
+	initTexPlane(&pw, x, y, w, det);
+
+	// vertices by y, the long edge a-c is on one side of every row, a-b and then b-c on the other
+	s32 a = 0, b = 1, c = 2;
+
+	if(y[b] < y[a]) {s32 t = a; a = b; b = t;}
+	if(y[c] < y[b]) {s32 t = b; b = c; c = t;}
+	if(y[b] < y[a]) {s32 t = a; a = b; b = t;}
+
+	s32 first = (s32)ceil(max(y[a], (double)clip->t) - 0.5);
+	s32 last = (s32)ceil(min(y[c], (double)clip->b) - 0.5) - 1;
+
+	first = max(first, clip->t);
+	last = min(last, clip->b - 1);
+
+	if(first > last) return;
+
+	TexSampler sampler = {.useMap = use_map, .chroma = chroma};
+
+	for(s32 i = 0; i < TIC_PALETTE_SIZE; i++)
+		sampler.palette[i] = mapColor(machine, i);
+
+	TexEdge longEdge, shortEdge;
+	bool lower = first + 0.5 >= y[b];
 
-	initSidesBuffer();
+	initTexEdge(&longEdge, x[a], y[a], x[c], y[c], first);
 
-	s32 r = radius;
-	s32 x = -r, y = 0, err = 2-2*r;
-	do
+	if(lower)
+		initTexEdge(&shortEdge, x[b], y[b], x[c], y[c], first);
+	else initTexEdge(&shortEdge, x[a], y[a], x[b], y[b], first);
+
+	for(s32 row = first; row <= last; row++, stepTexEdge(&longEdge, row), stepTexEdge(&shortEdge, row))
 	{
-		setSidePixel(xm-x, ym+y);
-		setSidePixel(xm-y, ym-x);
-		setSidePixel(xm+x, ym-y);
-		setSidePixel(xm+y, ym+x);
+		double yc = row + 0.5;
+
+		if(!lower && yc >= y[b])
+		{
+			initTexEdge(&shortEdge, x[b], y[b], x[c], y[c], row);
+			lower = true;
+		}
+
+		s32 start = texEdgePixel(min(longEdge.x, shortEdge.x), clip->l, clip->r);
+		s32 end = texEdgePixel(max(longEdge.x, shortEdge.x), clip->l, clip->r);
+
+		start = max(start, clip->l);
+		end = min(end, clip->r);
 
-		r = err;
-		if (r <= y) err += ++y*2+1;
-		if (r > x || err > y) err += ++x*2+1;
-	} while (x < 0);
+		if(start >= end) continue;
+
+		s32 offset = row * TIC80_WIDTH + start;
+		double xc = start + 0.5;
+
+		if(perspective)
+		{
+			double uw = texPlaneAt(&pu, xc, yc);
+			double vw = texPlaneAt(&pv, xc, yc);
+			double ww = texPlaneAt(&pw, xc, yc);
+			double su = uw / ww, sv = vw / ww;
+
+			for(s32 x = start; x < end; x += TexSegment)
+			{
+				s32 count = min(TexSegment, end - x);
 
-	for(s32 y = 0; y < TIC80_HEIGHT; y++)
-		for(s32 x = SidesBuffer.Left[y]; x <= SidesBuffer.Right[y]; ++x)
-			setPixel(machine, x, y, color);
+				uw += pu.dx * count;
+				vw += pv.dx * count;
+				ww += pw.dx * count;
+
+				double eu = uw / ww, ev = vw / ww;
+
+				drawTexSpan(machine, &sampler, offset + (x - start), count,
+					toTexFixed(su), toTexFixed(sv), toTexFixed((eu - su) / count), toTexFixed((ev - sv) / count));
+
+				su = eu;
+				sv = ev;
+			}
+		}
+		else drawTexSpan(machine, &sampler, offset, end - start,
+			toTexFixed(texPlaneAt(&pu, xc, yc)), toTexFixed(texPlaneAt(&pv, xc, yc)), toTexFixed(pu.dx), toTexFixed(pv.dx));
+	}
+}
+
+static void api_sprite(tic_mem* memory, const tic_gfx* src, s32 index, s32 x, s32 y, u8* colors, s32 count, s32 scale, tic_flip flip, tic_rotate rotate)
+{
+	drawSprite(memory, src, index, x, y, colors, count, scale, flip, rotate);
 }
 
-static void api_circle_border(tic_mem* memory, s32 xm, s32 ym, u32 radius, u8 color)
+static void api_map(tic_mem* memory, const tic_gfx* src, s32 x, s32 y, s32 width, s32 height, s32 sx, s32 sy, u8 chromakey, s32 scale)
 {
-	s32 r = radius;
-	s32 x = -r, y = 0, err = 2-2*r;
-	do {
-		api_pixel(memory, xm-x, ym+y, color);
-		api_pixel(memory, xm-y, ym-x, color);
-		api_pixel(memory, xm+x, ym-y, color);
-		api_pixel(memory, xm+y, ym+x, color);
-		r = err;
-		if (r <= y) err += ++y*2+1;
-		if (r > x || err > y) err += ++x*2+1;
-	} while (x < 0);
+	drawMap((tic_machine*)memory, src, x, y, width, height, sx, sy, chromakey, scale, NULL, NULL, NULL);
 }
 
-typedef void(*linePixelFunc)(tic_mem* memory, s32 x, s32 y, u8 color);
-static void ticLine(tic_mem* memory, s32 x0, s32 y0, s32 x1, s32 y1, u8 color, linePixelFunc func)
+static void api_remap(tic_mem* memory, const tic_gfx* src, s32 x, s32 y, s32 width, s32 height, s32 sx, s32 sy, u8 chromakey, s32 scale, RemapFunc remap, void* data)
 {
-	s32 dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
-	s32 dy = abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
-	s32 err = (dx > dy ? dx : -dy) / 2, e2;
-
-	for(;;)
-	{
-		func(memory, x0, y0, color);
-		if (x0 == x1 && y0 == y1) break;
-		e2 = err;
-		if (e2 >-dx) { err -= dy; x0 += sx; }
-		if (e2 < dy) { err += dx; y0 += sy; }
-	}
+	drawMap((tic_machine*)memory, src, x, y, width, height, sx, sy, chromakey, scale, NULL, remap, data);
 }
 
-static void triPixelFunc(tic_mem* memory, s32 x, s32 y, u8 color)
+static void api_remap_table(tic_mem* memory, const tic_gfx* src, s32 x, s32 y, s32 width, s32 height, s32 sx, s32 sy, u8 chromakey, s32 scale, const RemapResult* table)
 {
-	setSidePixel(x, y);
+	drawMap((tic_machine*)memory, src, x, y, width, height, sx, sy, chromakey, scale, table, NULL, NULL);
 }
 
-static void api_tri(tic_mem* memory, s32 x1, s32 y1, s32 x2, s32 y2, s32 x3, s32 y3, u8 color)
+// TIC_REMAP_SIZE tile indices followed by as many attribute bytes, flip in bits 0-1 and rotate in bits 2-3
+bool loadRemapTable(tic_machine* machine, s32 address, RemapResult* table)
 {
-	tic_machine* machine = (tic_machine*)memory;
-
-	initSidesBuffer();
+	tic_mem* memory = &machine->memory;
 
-	ticLine(memory, x1, y1, x2, y2, color, triPixelFunc);
-	ticLine(memory, x2, y2, x3, y3, color, triPixelFunc);
-	ticLine(memory, x3, y3, x1, y1, color, triPixelFunc);
+	if(address < 0 || address > (s32)sizeof(tic_ram) - TIC_REMAP_SIZE * 2)
+		return false;
 
-	for(s32 y = 0; y < TIC80_HEIGHT; y++)
-		for(s32 x = SidesBuffer.Left[y]; x <= SidesBuffer.Right[y]; ++x)
-			setPixel(machine, x, y, color);
-}
+	const u8* index = (const u8*)&memory->ram + address;
+	const u8* attr = index + TIC_REMAP_SIZE;
 
+	memory->api.observe(memory, index, TIC_REMAP_SIZE * 2);
 
-typedef struct
-{
-	float x, y, u, v;
-} TexVert;
+	for(s32 i = 0; i < TIC_REMAP_SIZE; i++)
+	{
+		table[i].index = index[i];
+		table[i].flip = attr[i] & 0b11;
+		table[i].rotate = (attr[i] >> 2) & 0b11;
+	}
 
+	return true;
+}
 
-static void ticTexLine(tic_mem* memory, TexVert *v0, TexVert *v1)
+static void api_map_set(tic_mem* memory, tic_gfx* src, s32 x, s32 y, u8 value)
 {
-	TexVert *top = v0;
-	TexVert *bot = v1;
-
-	if (bot->y < top->y)
-	{
-		top = v1;
-		bot = v0;
-	}
+	if(x < 0 || x >= TIC_MAP_WIDTH || y < 0 || y >= TIC_MAP_HEIGHT) return;
 
-	float dy = bot->y - top->y;
-	if ((s32)dy == 0)	return;
-	if ((s32)dy > TIC80_HEIGHT)	return;	//	reject large polys
+	*(src->map.data + y * TIC_MAP_WIDTH + x) = value;
+}
 
-	float step_x = (bot->x - top->x) / dy;
-	float step_u = (bot->u - top->u) / dy;
-	float step_v = (bot->v - top->v) / dy;
+static u8 api_map_get(tic_mem* memory, const tic_gfx* src, s32 x, s32 y)
+{
+	if(x < 0 || x >= TIC_MAP_WIDTH || y < 0 || y >= TIC_MAP_HEIGHT) return 0;
 
-	float x = top->x;
-	float y = top->y;
-	float u = top->u;
-	float v = top->v;
-	for (; y < (s32)bot->y; y++)
-	{
-		setSideTexPixel(x, y, u, v);
-		x += step_x;
-		u += step_u;
-		v += step_v;
-	}
+	return *(src->map.data + y * TIC_MAP_WIDTH + x);
 }
 
-static void api_textri(tic_mem* memory, float x1, float y1, float x2, float y2, float x3, float y3, float u1, float v1, float u2, float v2, float u3, float v3, bool use_map, u8 chroma)
+// the rect is in map pixels, every cell it touches whose tile has a flag from mask is a hit,
+// the first count hits are stored and the total is returned, cells outside the map never hit
+static s32 api_map_hits(tic_mem* memory, const tic_gfx* src, const tic_flags* flags, s32 x, s32 y, s32 width, s32 height, u8 mask, tic_map_hit* hits, s32 count)
 {
-	tic_machine* machine = (tic_machine*)memory;
-	TexVert V0, V1, V2;
-	const u8* ptr = memory->ram.gfx.tiles[0].data;
-	const u8* map = memory->ram.gfx.map.data;
+	s32 left = max(x, 0);
+	s32 top = max(y, 0);
+	s32 right = min(x + width, TIC_MAP_WIDTH * TIC_SPRITESIZE);
+	s32 bottom = min(y + height, TIC_MAP_HEIGHT * TIC_SPRITESIZE);
 
-	V0.x = (float)x1; 	V0.y = (float)y1; 	V0.u = (float)u1; 	V0.v = (float)v1;
-	V1.x = (float)x2; 	V1.y = (float)y2; 	V1.u = (float)u2; 	V1.v = (float)v2;
-	V2.x = (float)x3; 	V2.y = (float)y3; 	V2.u = (float)u3; 	V2.v = (float)v3;
-	initSidesBuffer();
+	if(left >= right || top >= bottom || !mask) return 0;
 
-	ticTexLine(memory, &V0, &V1);
-	ticTexLine(memory, &V1, &V2);
-	ticTexLine(memory, &V2, &V0);
+	left /= TIC_SPRITESIZE;
+	top /= TIC_SPRITESIZE;
+	right = (right - 1) / TIC_SPRITESIZE;
+	bottom = (bottom - 1) / TIC_SPRITESIZE;
 
+	s32 total = 0;
+
+	for(s32 j = top; j <= bottom; j++)
 	{
-		for (s32 y = 0; y < TIC80_HEIGHT; y++)
+		const u8* row = src->map.data + j * TIC_MAP_WIDTH;
+
+		for(s32 i = left; i <= right; i++)
 		{
-			float width = SidesBuffer.Right[y] - SidesBuffer.Left[y];
-			if (width > 0)
+			u8 index = row[i];
+
+			if(flags->data[index] & mask)
 			{
-				float du = (SidesBuffer.URight[y] - SidesBuffer.ULeft[y]) / width;
-				float dv = (SidesBuffer.VRight[y] - SidesBuffer.VLeft[y]) / width;
-				float u = SidesBuffer.ULeft[y];
-				float v = SidesBuffer.VLeft[y];
+				if(total < count)
+					hits[total] = (tic_map_hit){i, j, index};
 
-				for (s32 x = (s32)SidesBuffer.Left[y]; x <= (s32)SidesBuffer.Right[y]; ++x)
-				{
-					if ((x >= 0) && (x < TIC80_WIDTH))
-					{
-						if (use_map == true)
-						{
-							enum {MapWidth = TIC_MAP_WIDTH * TIC_SPRITESIZE, MapHeight = TIC_MAP_HEIGHT * TIC_SPRITESIZE};
-
-							s32 iu = (s32)u % MapWidth;
-							s32 iv = (s32)v % MapHeight;
-
-							u8 tile = map[(iv>>3) * TIC_MAP_WIDTH + (iu>>3)];
-							const u8 *buffer = &ptr[tile << 5];
-							u8 color = tic_tool_peek4(buffer, (iu & 7) + ((iv & 7) << 3));
-							if (color != chroma)
-								setPixel(machine, x, y, color);
-						}
-						else
-						{
-							enum{SheetWidth = TIC_SPRITESHEET_SIZE, SheetHeight = TIC_SPRITESHEET_SIZE * TIC_SPRITE_BANKS};
-
-							s32 iu = (s32)(u) & (SheetWidth - 1);
-							s32 iv = (s32)(v) & (SheetHeight - 1);
-							const u8 *buffer = &ptr[((iu >> 3) + ((iv >> 3) << 4)) << 5];
-							u8 color = tic_tool_peek4(buffer, (iu & 7) + ((iv & 7) << 3));
-							if (color != chroma)
-								setPixel(machine, x, y, color);
-						}
-					}
-					u += du;
-					v += dv;
-				}
+				total++;
 			}
 		}
 	}
-}
 
+	return total;
+}
 
-static void api_sprite(tic_mem* memory, const tic_gfx* src, s32 index, s32 x, s32 y, u8* colors, s32 count, s32 scale, tic_flip flip, tic_rotate rotate)
+static void api_flag_set(tic_mem* memory, tic_flags* flags, s32 index, s32 flag, bool value)
 {
-	drawSprite(memory, src, index, x, y, colors, count, scale, flip, rotate);
+	if(index < 0 || index >= TIC_BANK_SPRITES || flag < 0 || flag >= TIC_TILE_FLAGS) return;
+
+	if(value) flags->data[index] |= 1 << flag;
+	else flags->data[index] &= ~(1 << flag);
 }
 
-static void api_map(tic_mem* memory, const tic_gfx* src, s32 x, s32 y, s32 width, s32 height, s32 sx, s32 sy, u8 chromakey, s32 scale)
+static bool api_flag_get(tic_mem* memory, const tic_flags* flags, s32 index, s32 flag)
 {
-	drawMap((tic_machine*)memory, src, x, y, width, height, sx, sy, chromakey, scale, NULL, NULL);
+	if(index < 0 || index >= TIC_BANK_SPRITES || flag < 0 || flag >= TIC_TILE_FLAGS) return false;
+
+	return flags->data[index] & (1 << flag);
 }
 
-static void api_remap(tic_mem* memory, const tic_gfx* src, s32 x, s32 y, s32 width, s32 height, s32 sx, s32 sy, u8 chromakey, s32 scale, RemapFunc remap, void* data)
+static void api_line(tic_mem* memory, s32 x0, s32 y0, s32 x1, s32 y1, u8 color)
 {
-	drawMap((tic_machine*)memory, src, x, y, width, height, sx, sy, chromakey, scale, remap, data);
+	drawLine((tic_machine*)memory, x0, y0, x1, y1, color);
 }
 
-static void api_map_set(tic_mem* memory, tic_gfx* src, s32 x, s32 y, u8 value)
+static s32 calcLoopPos(const tic_sound_loop* loop, s32 pos)
 {
-	if(x < 0 || x >= TIC_MAP_WIDTH || y < 0 || y >= TIC_MAP_HEIGHT) return;
+	if(loop->size > 0)
+	{
+		// runs straight up to the loop end, then cycles through [start, end]
+		s32 end = loop->start + loop->size - 1;
 
-	*(src->map.data + y * TIC_MAP_WIDTH + x) = value;
+		if(pos <= 0) return 0;
+		if(pos <= end) return pos;
+
+		return loop->start + (pos - end - 1) % loop->size;
+	}
+
+	return pos >= SFX_TICKS ? SFX_TICKS - 1 : pos;
 }
 
-static u8 api_map_get(tic_mem* memory, const tic_gfx* src, s32 x, s32 y)
+static void readSfxStep(const tic_sound_effect* effect, s32 pos, SfxStep* step)
 {
-	if(x < 0 || x >= TIC_MAP_WIDTH || y < 0 || y >= TIC_MAP_HEIGHT) return 0;
+	for(s32 i = 0; i < sizeof(tic_sfx_pos); i++)
+		*(step->pos.data+i) = calcLoopPos(effect->loops + i, pos);
 
-	return *(src->map.data + y * TIC_MAP_WIDTH + x);
+	step->volume = MAX_VOLUME - effect->data[step->pos.volume].volume;
+	step->wave = effect->data[step->pos.wave].wave;
+	step->arpeggio = effect->data[step->pos.arpeggio].arpeggio * (effect->reverse ? -1 : 1);
+	step->pitch = effect->data[step->pos.pitch].pitch * (effect->pitch16x ? 16 : 1);
 }
 
-static void api_line(tic_mem* memory, s32 x0, s32 y0, s32 x1, s32 y1, u8 color)
+static s32 gcd(s32 a, s32 b)
 {
-	ticLine(memory, x0, y0, x1, y1, color, api_pixel);
+	while(b)
+	{
+		s32 t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
 }
 
-static s32 calcLoopPos(const tic_sound_loop* loop, s32 pos)
+static void compileSfx(SfxProgram* program, const tic_sound_effect* effect)
 {
-	s32 offset = 0;
+	// looped parameters cycle once past their loop end, the others hold the last step
+	s32 prefix = 0, period = 1;
 
-	if(loop->size > 0)
+	for(s32 i = 0; i < sizeof(tic_sfx_pos); i++)
 	{
-		for(s32 i = 0; i < pos; i++)
+		const tic_sound_loop* loop = effect->loops + i;
+
+		if(loop->size > 0)
 		{
-			if(offset < (loop->start + loop->size-1))
-				offset++;
-			else offset = loop->start;
+			prefix = max(prefix, loop->start + loop->size);
+			period = period / gcd(period, loop->size) * loop->size;
 		}
+		else prefix = max(prefix, SFX_TICKS - 1);
+	}
+
+	memcpy(&program->source, effect, sizeof(tic_sound_effect));
+	program->valid = true;
+	program->prefix = prefix;
+	program->period = prefix + period <= SFX_PROGRAM_SIZE ? period : 0;
+
+	if(program->period)
+		for(s32 pos = 0; pos < prefix + period; pos++)
+			readSfxStep(effect, pos, program->steps + pos);
+}
+
+static const SfxProgram* getSfxProgram(tic_machine* machine, s32 index)
+{
+	const tic_sound* src = machine->soundSrc;
+
+	if(machine->sfx.src != src)
+	{
+		for(s32 i = 0; i < SFX_COUNT; i++)
+			machine->sfx.programs[i].valid = false;
+
+		machine->sfx.src = src;
 	}
-	else offset = pos >= SFX_TICKS ? SFX_TICKS - 1 : pos;
 
-	return offset;
+	SfxProgram* program = machine->sfx.programs + index;
+	const tic_sound_effect* effect = src->sfx.data + index;
+
+	// RAM writes come through invalidate, the studio edits its cart and config sounds directly
+	if(!program->valid || (src != &machine->memory.ram.sound && memcmp(&program->source, effect, sizeof(tic_sound_effect))))
+		compileSfx(program, effect);
+
+	return program;
+}
+
+static void invalidateSfx(tic_machine* machine, const void* address, s32 size)
+{
+	const u8* start = (const u8*)machine->memory.ram.sound.sfx.data;
+	const u8* end = start + SFX_COUNT * sizeof(tic_sound_effect);
+	const u8* from = (const u8*)address;
+	const u8* to = from + size;
+
+	if(size <= 0 || to <= start || from >= end) return;
+
+	if(from < start) from = start;
+	if(to > end) to = end;
+
+	s32 first = (s32)(from - start) / sizeof(tic_sound_effect);
+	s32 last = (s32)(to - start - 1) / sizeof(tic_sound_effect);
+
+	for(s32 i = first; i <= last; i++)
+		machine->sfx.programs[i].valid = false;
 }
 
 static void sfx(tic_mem* memory, s32 index, s32 freq, Channel* channel, tic_sound_register* reg)
@@ -1001,7 +2211,7 @@ static void sfx(tic_mem* memory, s32 index, s32 freq, Channel* channel, tic_soun
 		return;
 	}
 
-	const tic_sound_effect* effect = &machine->soundSrc->sfx.data[index];
+	const SfxProgram* program = getSfxProgram(machine, index);
 	s32 pos = ++channel->tick;
 
 	s8 speed = channel->speed;
@@ -1012,24 +2222,27 @@ static void sfx(tic_mem* memory, s32 index, s32 freq, Channel* channel, tic_soun
 		else pos /= 1 - speed;
 	}
 
-	for(s32 i = 0; i < sizeof(tic_sfx_pos); i++)
-		*(channel->pos.data+i) = calcLoopPos(effect->loops + i, pos);
+	SfxStep temp;
+	const SfxStep* step = &temp;
+
+	if(program->period)
+		step = program->steps + (pos < program->prefix ? max(pos, 0) : program->prefix + (pos - program->prefix) % program->period);
+	else readSfxStep(&program->source, pos, &temp);
+
+	channel->pos = step->pos;
 
-	u8 volume = (MAX_VOLUME - effect->data[channel->pos.volume].volume) * channel->volume / MAX_VOLUME;
+	u8 volume = step->volume * channel->volume / MAX_VOLUME;
 
 	if(volume > 0)
 	{
-		s8 arp = effect->data[channel->pos.arpeggio].arpeggio * (effect->reverse ? -1 : 1);
+		if(step->arpeggio) freq = getNoteFreq(&machine->sound, channel->note + step->arpeggio);
 
-		if(arp) freq = (s32)note2freq(freq2note(freq)+arp);
-
-		freq += effect->data[channel->pos.pitch].pitch * (effect->pitch16x ? 16 : 1);
+		freq += step->pitch;
 
 		reg->freq = freq;
 		reg->volume = volume;
 
-		u8 wave = effect->data[channel->pos.wave].wave;
-		const tic_waveform* waveform = &machine->soundSrc->sfx.waveform.envelopes[wave];
+		const tic_waveform* waveform = &machine->soundSrc->sfx.waveform.envelopes[step->wave];
 		memcpy(reg->waveform.data, waveform->data, sizeof(tic_waveform));
 	}
 }
@@ -1136,11 +2349,9 @@ static bool isNoiseWaveform(const tic_waveform* wave)
 	return memcmp(&NoiseWave.data, &wave->data, sizeof(tic_waveform)) == 0;
 }
 
-static void api_tick_start(tic_mem* memory, const tic_sound* src)
+static void startSoundFrame(tic_machine* machine)
 {
-	tic_machine* machine = (tic_machine*)memory;
-
-	machine->soundSrc = src;
+	tic_mem* memory = &machine->memory;
 
 	for (s32 i = 0; i < TIC_SOUND_CHANNELS; ++i )
 		memset(&memory->ram.registers[i], 0, sizeof(tic_sound_register));
@@ -1154,6 +2365,17 @@ static void api_tick_start(tic_mem* memory, const tic_sound* src)
 		if(c->index >= 0)
 			sfx(memory, c->index, c->freq, c, &memory->ram.registers[i]);
 	}
+}
+
+static void api_tick_start(tic_mem* memory, const tic_sound* src)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	machine->soundSrc = src;
+
+	// pulled sound advances the registers itself, see api_sound_pull
+	if(!machine->soundPull)
+		startSoundFrame(machine);
 
 	// process gamepad
 	for(s32 i = 0; i < COUNT_OF(machine->state.gamepad.holds); i++)
@@ -1168,11 +2390,9 @@ static void api_tick_start(tic_mem* memory, const tic_sound* src)
 	}
 }
 
-static void api_tick_end(tic_mem* memory)
+static void endSoundFrame(tic_machine* machine)
 {
-	tic_machine* machine = (tic_machine*)memory;
-
-	machine->state.gamepad.previous.data = machine->memory.ram.vram.input.gamepad.data;
+	tic_mem* memory = &machine->memory;
 
 	enum {EndTime = CLOCKRATE / TIC_FRAMERATE};
 	for (s32 i = 0; i < TIC_SOUND_CHANNELS; ++i )
@@ -1181,16 +2401,112 @@ static void api_tick_end(tic_mem* memory)
 		tic_sound_register_data* data = &machine->state.registers[i];
 
 		isNoiseWaveform(&reg->waveform)
-			? runNoise(machine->blip, reg, data, EndTime)
-			: runEnvelope(machine->blip, reg, data, EndTime);
+			? runNoise(machine->blip, &machine->sound, reg, data, EndTime)
+			: runEnvelope(machine->blip, &machine->sound, reg, data, EndTime);
 
 		data->time -= EndTime;
 	}
 
 	blip_end_frame(machine->blip, EndTime);
-	blip_read_samples(machine->blip, machine->memory.samples.buffer, machine->samplerate / TIC_FRAMERATE);
 }
 
+static inline s32 getBlipFormat(s32 format)
+{
+	return (format & TIC80_SOUND_STEREO ? blip_stereo : blip_mono) | (format & TIC80_SOUND_FLOAT ? blip_float : 0);
+}
+
+static void api_tick_end(tic_mem* memory)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	machine->state.gamepad.previous.data = machine->memory.ram.vram.input.gamepad.data;
+
+	if(machine->soundPull) return;
+
+	endSoundFrame(machine);
+
+	s32 count = machine->samplerate / TIC_FRAMERATE;
+
+	if(machine->soundOutput.buffer)
+	{
+		s32 format = machine->soundOutput.format;
+
+		blip_read_samples_ex(machine->blip, machine->soundOutput.buffer, count, getBlipFormat(format));
+	}
+	else blip_read_samples(machine->blip, machine->memory.samples.buffer, count);
+}
+
+// The host takes samples at its own pace. Whole frames are synthesized with the
+// registers of the last tick boundary, then the music and sfx advance one tick,
+// what the host didn't take waits in the blip buffer for the next call.
+static s32 api_sound_pull(tic_mem* memory, void* buffer, s32 count, s32 format)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	machine->soundPull = true;
+
+	s32 size = (format & TIC80_SOUND_FLOAT ? sizeof(float) : sizeof(s16)) * (format & TIC80_SOUND_STEREO ? 2 : 1);
+	u8* ptr = buffer;
+	s32 done = 0;
+
+	while(done < count)
+	{
+		if(blip_samples_avail(machine->blip) == 0)
+		{
+			endSoundFrame(machine);
+			startSoundFrame(machine);
+		}
+
+		s32 read = blip_read_samples_ex(machine->blip, ptr, count - done, getBlipFormat(format));
+
+		ptr += read * size;
+		done += read;
+	}
+
+	return done;
+}
+
+static void api_sound_output(tic_mem* memory, void* buffer, s32 format)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	machine->soundOutput.buffer = buffer;
+	machine->soundOutput.format = format;
+}
+
+static bool isSoundPlaying(tic_machine* machine)
+{
+	if(machine->state.music.play != MusicStop)
+		return true;
+
+	for (s32 i = 0; i < TIC_SOUND_CHANNELS; ++i )
+	{
+		const Channel* c = &machine->state.channels[i];
+
+		if(c->index >= 0 && c->duration != 0)
+			return true;
+	}
+
+	return false;
+}
+
+// runs only the synth, as fast as it goes, until the music and sfx stop or the buffer is full
+static s32 api_render_sound(tic_mem* memory, s16* buffer, s32 frames)
+{
+	tic_machine* machine = (tic_machine*)memory;
+	s32 samples = machine->samplerate / TIC_FRAMERATE;
+	s32 frame = 0;
+
+	for(; frame < frames && isSoundPlaying(machine); frame++)
+	{
+		api_tick_start(memory, &memory->ram.sound);
+		endSoundFrame(machine);
+
+		blip_read_samples(machine->blip, buffer + frame * samples, samples);
+	}
+
+	return frame;
+}
 
 static tic_sfx_pos api_sfx_pos(tic_mem* memory, s32 channel)
 {
@@ -1241,12 +2557,15 @@ static void initCover(tic_mem* tic)
 			{
 				enum { Size = TIC80_WIDTH * TIC80_HEIGHT };
 
+				tic_machine* machine = (tic_machine*)tic;
+				machine->shadow.dirty = true;
+
 				for (s32 i = 0; i < Size; i++)
 				{
 					const gif_color* c = &image->palette[image->buffer[i]];
 					tic_rgb rgb = { c->r, c->g, c->b };
 					u8 color = tic_tool_find_closest_color(tic->cart.palette.colors, &rgb);
-					tic_tool_poke4(tic->ram.vram.screen.data, i, color);
+					putPixel(machine, i, color);
 				}
 			}
 
@@ -1258,7 +2577,10 @@ static void initCover(tic_mem* tic)
 static void cart2ram(tic_mem* memory)
 {
 	memcpy(&memory->ram.gfx, &memory->cart.gfx, sizeof memory->ram.gfx);
+	invalidateTiles((tic_machine*)memory, &memory->ram.gfx, sizeof memory->ram.gfx);
+	memcpy(&memory->ram.flags, &memory->cart.flags, sizeof memory->ram.flags);
 	memcpy(&memory->ram.sound, &memory->cart.sound, sizeof memory->ram.sound);
+	invalidateSfx((tic_machine*)memory, &memory->ram.sound, sizeof memory->ram.sound);
 
 	initCover(memory);
 }
@@ -1367,15 +2689,229 @@ static void updateSaveid(tic_mem* memory)
 		strcpy(memory->saveid, saveid);
 		free((void*)saveid);
 	}
-	else
+	else
+	{
+		const char* saveid = readMetatag(memory->code.data, "saveid", TagFormatJS);
+		if(saveid)
+		{
+			strcpy(memory->saveid, saveid);
+			free((void*)saveid);
+		}
+	}
+}
+
+static u64 getCounter(tic_machine* machine)
+{
+	return machine->data->counter(machine->data->data);
+}
+
+static void startCpuFrame(tic_machine* machine)
+{
+	CpuBudget* cpu = &machine->cpu;
+
+	cpu->start = getCounter(machine);
+	cpu->deadline = cpu->limit.ms > 0 ? cpu->start + cpu->limit.ms * machine->data->freq(machine->data->data) / 1000 : 0;
+	cpu->instructions = 0;
+	cpu->exceeded = false;
+}
+
+// scanline() isn't in the stats, it runs on whatever budget TIC() left for the frame
+static void endCpuFrame(tic_machine* machine)
+{
+	CpuBudget* cpu = &machine->cpu;
+
+	cpu->stats.instructions = cpu->instructions;
+	cpu->stats.ms = (double)((getCounter(machine) - cpu->start) * 1000) / machine->data->freq(machine->data->data);
+}
+
+bool checkCpuBudget(tic_machine* machine, u32 instructions)
+{
+	CpuBudget* cpu = &machine->cpu;
+
+	cpu->instructions += instructions;
+
+	// stays set until the next frame, so the VM keeps failing while it unwinds
+	if(!cpu->exceeded)
+		cpu->exceeded = (cpu->limit.instructions && cpu->instructions > cpu->limit.instructions)
+			|| (cpu->deadline && getCounter(machine) > cpu->deadline);
+
+	return cpu->exceeded;
+}
+
+void getCpuBudgetError(tic_machine* machine, char* buffer, s32 size)
+{
+	const CpuBudget* cpu = &machine->cpu;
+
+	if(cpu->limit.instructions && cpu->instructions > cpu->limit.instructions)
+		snprintf(buffer, size, "the frame is over the cpu budget of %llu instructions", (unsigned long long)cpu->limit.instructions);
+	else snprintf(buffer, size, "the frame is over the cpu budget of %i ms", cpu->limit.ms);
+}
+
+// block sizes with the header, VmClassIndex maps (size + 15) / 16 to the smallest that fits
+static const u32 VmClasses[VM_HEAP_CLASSES] = {16, 32, 48, 64, 96, 128, 192, 256, 384, 512};
+static const u8 VmClassIndex[] = {0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7, 8, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9, 9};
+
+STATIC_ASSERT(vm_heap_classes, COUNT_OF(VmClassIndex) == 512 / 16 + 1);
+
+// -1 for blocks that go straight to malloc
+static s32 getVmClass(size_t block)
+{
+	return block <= VmClasses[VM_HEAP_CLASSES - 1] ? VmClassIndex[(block + 15) / 16] : -1;
+}
+
+static bool reserveVmHeap(VmHeap* heap, size_t size)
+{
+	if(heap->capped && heap->limit && heap->current + size > heap->limit)
+		return false;
+
+	heap->current += size;
+
+	if(heap->current > heap->peak)
+		heap->peak = heap->current;
+
+	return true;
+}
+
+// free blocks keep the list link where the header was
+static void* takeVmBlock(VmHeap* heap, s32 index)
+{
+	u32 block = VmClasses[index];
+	void* ptr = heap->free[index];
+
+	if(ptr)
+	{
+		heap->free[index] = *(void**)ptr;
+		return ptr;
+	}
+
+	if((size_t)(heap->end - heap->next) < block)
+	{
+		VmPage* page = (VmPage*)malloc(VM_HEAP_PAGE_SIZE);
+
+		if(!page) return NULL;
+
+		page->next = heap->pages;
+		heap->pages = page;
+		heap->next = (u8*)(page + 1);
+		heap->end = (u8*)page + VM_HEAP_PAGE_SIZE;
+	}
+
+	ptr = heap->next;
+	heap->next += block;
+
+	return ptr;
+}
+
+static void* allocVmBlock(VmHeap* heap, size_t size)
+{
+	size_t block = size + sizeof(VmHeader);
+	s32 index = getVmClass(block);
+
+	if(index >= 0)
+		block = VmClasses[index];
+
+	if(!reserveVmHeap(heap, block))
+		return NULL;
+
+	VmHeader* header = index >= 0 ? takeVmBlock(heap, index) : malloc(block);
+
+	if(!header)
+	{
+		heap->current -= block;
+		return NULL;
+	}
+
+	header->size = block - sizeof(VmHeader);
+
+	return header + 1;
+}
+
+static void freeVmBlock(VmHeap* heap, void* ptr)
+{
+	if(!ptr) return;
+
+	VmHeader* header = (VmHeader*)ptr - 1;
+	size_t block = header->size + sizeof(VmHeader);
+	s32 index = getVmClass(block);
+
+	heap->current -= block;
+
+	if(index >= 0)
+	{
+		*(void**)header = heap->free[index];
+		heap->free[index] = header;
+	}
+	else free(header);
+}
+
+// realloc for the script VMs, size 0 frees; a grow that fails leaves ptr as it was
+void* vmRealloc(VmHeap* heap, void* ptr, size_t size)
+{
+	if(!size)
+	{
+		freeVmBlock(heap, ptr);
+		return NULL;
+	}
+
+	if(!ptr)
+		return allocVmBlock(heap, size);
+
+	VmHeader* header = (VmHeader*)ptr - 1;
+	size_t old = header->size + sizeof(VmHeader);
+	size_t block = size + sizeof(VmHeader);
+	s32 from = getVmClass(old);
+	s32 to = getVmClass(block);
+
+	if(from >= 0 && from == to)
+		return ptr;
+
+	if(from < 0 && to < 0)
+	{
+		if(block > old && !reserveVmHeap(heap, block - old))
+			return NULL;
+
+		VmHeader* resized = realloc(header, block);
+
+		if(!resized)
+		{
+			if(block > old) heap->current -= block - old;
+
+			return block > old ? NULL : ptr;
+		}
+
+		if(block < old) heap->current -= old - block;
+
+		resized->size = size;
+
+		return resized + 1;
+	}
+
+	void* moved = allocVmBlock(heap, size);
+
+	// Lua counts on a shrink never failing, the old block still fits
+	if(!moved)
+		return size < header->size ? ptr : NULL;
+
+	memcpy(moved, ptr, min(size, header->size));
+	freeVmBlock(heap, ptr);
+
+	return moved;
+}
+
+// the VM has freed its blocks by now, so the pages can go with the free lists in them
+void closeVmHeap(VmHeap* heap)
+{
+	for(VmPage* page = heap->pages; page;)
 	{
-		const char* saveid = readMetatag(memory->code.data, "saveid", TagFormatJS);
-		if(saveid)
-		{
-			strcpy(memory->saveid, saveid);
-			free((void*)saveid);
-		}
+		VmPage* next = page->next;
+		free(page);
+		page = next;
 	}
+
+	size_t limit = heap->limit;
+
+	memset(heap, 0, sizeof(VmHeap));
+	heap->limit = limit;
 }
 
 static void api_tick(tic_mem* memory, tic_tick_data* data)
@@ -1384,6 +2920,8 @@ static void api_tick(tic_mem* memory, tic_tick_data* data)
 
 	machine->data = data;
 
+	startCpuFrame(machine);
+
 	if(!machine->state.initialized)
 	{
 		cart2ram(memory);
@@ -1402,6 +2940,8 @@ static void api_tick(tic_mem* memory, tic_tick_data* data)
 
 			memory->script = tic_script_lua;
 
+			closeScripts(machine);
+
 			if (isMoonscript(code))
 			{
 				if(!initMoonscript(machine, code))
@@ -1439,6 +2979,7 @@ static void api_tick(tic_mem* memory, tic_tick_data* data)
 				machine->state.scanline = callJavascriptScanline;
 			   	break;
 			case tic_script_lua :
+			case tic_script_moon :
 				machine->state.scanline = callLuaScanline;
 			  	break;
 			case tic_script_wren :
@@ -1451,11 +2992,14 @@ static void api_tick(tic_mem* memory, tic_tick_data* data)
 		machine->state.initialized = true;
 	}
 
+	updateParticles(machine);
+
 	switch(memory->script) {
 		case tic_script_js :
 			callJavascriptTick(machine);
 		   	break;
 		case tic_script_lua :
+		case tic_script_moon :
 			callLuaTick(machine);
 		   	break;
 		case tic_script_wren :
@@ -1465,20 +3009,63 @@ static void api_tick(tic_mem* memory, tic_tick_data* data)
 			break;
    }
 
+	endCpuFrame(machine);
 }
 
 static void api_scanline(tic_mem* memory, s32 row)
 {
 	tic_machine* machine = (tic_machine*)memory;
 
-	if(machine->state.initialized)
+	if(row == 0)
+		machine->scanlineCall.defined = false;
+
+	if(machine->state.initialized && machine->state.scanline)
 		machine->state.scanline(memory, row);
 }
 
 static double api_time(tic_mem* memory)
 {
 	tic_machine* machine = (tic_machine*)memory;
-	return (double)((machine->data->counter() - machine->data->start)*1000)/machine->data->freq();
+	return (double)((machine->data->counter(machine->data->data) - machine->data->start)*1000)/machine->data->freq(machine->data->data);
+}
+
+static void api_cpu_budget(tic_mem* memory, tic_cpu_budget budget)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	machine->cpu.limit = budget;
+}
+
+static tic_cpu_stats api_cpu_stats(tic_mem* memory)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	return machine->cpu.stats;
+}
+
+// 0 is no limit, Lua and JS get an out of memory error past it, Wren is only counted
+static void api_vm_memory_limit(tic_mem* memory, u32 bytes)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	machine->heap.limit = bytes;
+}
+
+static tic_vm_memory api_vm_memory(tic_mem* memory)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	return (tic_vm_memory){(u32)machine->heap.current, (u32)machine->heap.peak};
+}
+
+static void api_trust_binary(tic_mem* memory, const u8* key)
+{
+	tic_machine* machine = (tic_machine*)memory;
+
+	machine->binaryKey.set = key != NULL;
+
+	if(key)
+		memcpy(machine->binaryKey.data, key, TIC_BINARY_KEY_SIZE);
 }
 
 static void api_sync(tic_mem* tic, bool toCart)
@@ -1486,15 +3073,60 @@ static void api_sync(tic_mem* tic, bool toCart)
 	if(toCart)
 	{
 		memcpy(&tic->cart.gfx, &tic->ram.gfx, sizeof tic->cart.gfx);
+		memcpy(&tic->cart.flags, &tic->ram.flags, sizeof tic->cart.flags);
 		memcpy(&tic->cart.sound, &tic->ram.sound, sizeof tic->cart.sound);
 	}
 	else
 	{
 		memcpy(&tic->ram.gfx, &tic->cart.gfx, sizeof tic->cart.gfx);
+		memcpy(&tic->ram.flags, &tic->cart.flags, sizeof tic->cart.flags);
 		memcpy(&tic->ram.sound, &tic->cart.sound, sizeof tic->cart.sound);
+
+		invalidateTiles((tic_machine*)tic, &tic->ram.gfx, sizeof tic->ram.gfx);
+		invalidateSfx((tic_machine*)tic, &tic->ram.sound, sizeof tic->ram.sound);
 	}
 }
 
+static void api_invalidate(tic_mem* tic, const void* address, s32 size)
+{
+	tic_machine* machine = (tic_machine*)tic;
+	s32 start, end;
+
+	invalidateTiles(machine, address, size);
+	invalidateSfx(machine, address, size);
+
+	if((const u8*)address < (const u8*)(&tic->font + 1) && (const u8*)address + size > (const u8*)&tic->font)
+		machine->font.valid = false;
+
+	// whole bytes were written, so the rest of the shadow stays valid even if VRAM is behind it
+	if(machine->shadow.enabled && getScreenRange(machine, address, size, &start, &end))
+		unpackShadow(machine, start, end);
+}
+
+// bindings call it before reading RAM directly, VRAM screen is packed from the shadow on demand
+static void api_observe(tic_mem* tic, const void* address, s32 size)
+{
+	tic_machine* machine = (tic_machine*)tic;
+	s32 start, end;
+
+	if(machine->shadow.dirty && getScreenRange(machine, address, size, &start, &end))
+		packShadow(machine);
+}
+
+static void api_shadow_screen(tic_mem* tic, bool enabled)
+{
+	tic_machine* machine = (tic_machine*)tic;
+
+	if(machine->shadow.enabled == enabled) return;
+
+	if(enabled)
+		unpackShadow(machine, 0, sizeof(tic_screen));
+	else packShadow(machine);
+
+	machine->shadow.enabled = enabled;
+	machine->shadow.dirty = false;
+}
+
 static u32 api_btnp(tic_mem* tic, s32 index, s32 hold, s32 period)
 {
 	tic_machine* machine = (tic_machine*)tic;
@@ -1541,6 +3173,7 @@ static void api_load(tic_cartridge* cart, const u8* buffer, s32 size, bool palet
 		case CHUNK_TILES: 		LOAD_CHUNK(cart->gfx.tiles); 					break;
 		case CHUNK_SPRITES: 	LOAD_CHUNK(cart->gfx.sprites); 					break;
 		case CHUNK_MAP: 		LOAD_CHUNK(cart->gfx.map); 						break;
+		case CHUNK_FLAGS: 		LOAD_CHUNK(cart->flags); 						break;
 		case CHUNK_CODE: 		LOAD_CHUNK(cart->code); 						break;
 		case CHUNK_SOUND: 		LOAD_CHUNK(cart->sound.sfx.data); 				break;
 		case CHUNK_WAVEFORM:	LOAD_CHUNK(cart->sound.sfx.waveform);			break;
@@ -1601,6 +3234,107 @@ static u8* saveChunk(u8* buffer, ChunkType type, const void* from, s32 size)
 	return saveFixedChunk(buffer, type, from, chunkSize);
 }
 
+static void api_compile(tic_mem* memory)
+{
+	tic_machine* machine = (tic_machine*)memory;
+	const char* code = memory->cart.code.data;
+	CodeBinary* binary = &machine->binary;
+
+	binary->hash = 0;
+	binary->chunk.size = 0;
+
+	if(!strlen(code) || isWren(code))
+		return;
+
+	if(isMoonscript(code))
+		compileMoonscript(code, binary);
+	else if(isJavascript(code))
+		compileJavascript(code, binary);
+	else compileLua(code, binary);
+}
+
+// covers the hash, the source and the bytecode, so none of them can be swapped
+// for another without the key
+static u64 signBinary(tic_machine* machine, u64 hash, const char* code, const u8* data, s32 size)
+{
+	s32 codeSize = (s32)strlen(code);
+	tic_mac mac;
+
+	tic_tool_mac_start(&mac, machine->binaryKey.data);
+	tic_tool_mac_add(&mac, &hash, sizeof hash);
+	tic_tool_mac_add(&mac, &codeSize, sizeof codeSize);
+	tic_tool_mac_add(&mac, code, codeSize);
+	tic_tool_mac_add(&mac, data, size);
+
+	return tic_tool_mac_end(&mac);
+}
+
+enum {BinaryHeaderSize = sizeof(u64) * 2}; // hash and signature, the rest of the chunk is the bytecode
+
+// only a chunk signed with the trusted key for the code already in memory->cart is kept
+static void api_load_binary(tic_mem* memory, const u8* buffer, s32 size)
+{
+	tic_machine* machine = (tic_machine*)memory;
+	CodeBinary* binary = &machine->binary;
+	const u8* end = buffer + size;
+
+	binary->hash = 0;
+	binary->chunk.size = 0;
+
+	if(!machine->binaryKey.set)
+		return;
+
+	while(buffer + sizeof(Chunk) <= end)
+	{
+		Chunk chunk;
+		memcpy(&chunk, buffer, sizeof(Chunk));
+		buffer += sizeof(Chunk);
+
+		if(chunk.type == CHUNK_BINARY && chunk.size > BinaryHeaderSize && buffer + chunk.size <= end)
+		{
+			u64 hash, signature;
+			memcpy(&hash, buffer, sizeof hash);
+			memcpy(&signature, buffer + sizeof hash, sizeof signature);
+
+			const u8* data = buffer + BinaryHeaderSize;
+			s32 dataSize = chunk.size - BinaryHeaderSize;
+
+			if(signBinary(machine, hash, memory->cart.code.data, data, dataSize) == signature
+				&& writeCodeChunk(&binary->chunk, data, dataSize))
+				binary->hash = hash;
+			else binary->chunk.size = 0;
+
+			break;
+		}
+
+		buffer += chunk.size;
+	}
+}
+
+// with no buffer only the size is returned, nothing is saved without a key to sign it
+static s32 api_save_binary(tic_mem* memory, u8* buffer)
+{
+	tic_machine* machine = (tic_machine*)memory;
+	const CodeBinary* binary = &machine->binary;
+	s32 size = BinaryHeaderSize + binary->chunk.size;
+
+	if(!machine->binaryKey.set || !binary->chunk.size || size >= 1 << 24)
+		return 0;
+
+	if(buffer)
+	{
+		Chunk chunk = {CHUNK_BINARY, size};
+		u64 signature = signBinary(machine, binary->hash, memory->cart.code.data, binary->chunk.data, binary->chunk.size);
+
+		memcpy(buffer, &chunk, sizeof(Chunk));
+		memcpy(buffer + sizeof(Chunk), &binary->hash, sizeof binary->hash);
+		memcpy(buffer + sizeof(Chunk) + sizeof binary->hash, &signature, sizeof signature);
+		memcpy(buffer + sizeof(Chunk) + BinaryHeaderSize, binary->chunk.data, binary->chunk.size);
+	}
+
+	return sizeof(Chunk) + size;
+}
+
 static s32 api_save(const tic_cartridge* cart, u8* buffer)
 {
 	u8* start = buffer;
@@ -1610,6 +3344,7 @@ static s32 api_save(const tic_cartridge* cart, u8* buffer)
 	buffer = SAVE_CHUNK(CHUNK_TILES, 	cart->gfx.tiles);
 	buffer = SAVE_CHUNK(CHUNK_SPRITES, 	cart->gfx.sprites);
 	buffer = SAVE_CHUNK(CHUNK_MAP, 		cart->gfx.map);
+	buffer = SAVE_CHUNK(CHUNK_FLAGS, 	cart->flags);
 	buffer = SAVE_CHUNK(CHUNK_CODE, 	cart->code);
 	buffer = SAVE_CHUNK(CHUNK_SOUND, 	cart->sound.sfx.data);
 	buffer = SAVE_CHUNK(CHUNK_WAVEFORM, cart->sound.sfx.waveform);
@@ -1653,71 +3388,374 @@ inline void memset4(void *dst, u32 val, u32 dwords)
 #endif
 }
 
-static u32* paletteBlit(tic_mem* tic)
+static void blitRowScalar(const u8* src, u32* dst, s32 size, const BlitPalette* palette)
+{
+	for(const u8* end = src + size; src != end; src++, dst += 2)
+		memcpy(dst, palette->pairs[*src], sizeof palette->pairs[0]);
+}
+
+static void blitPixelsScalar(const u8* src, u32* dst, s32 size, const BlitPalette* palette)
+{
+	for(const u8* end = src + size; src != end; src++)
+		*dst++ = palette->colors[*src];
+}
+
+#if defined(TIC_BLIT_AVX2) || defined(TIC_BLIT_NEON)
+
+static void blitRowTail(const u8* src, u32* dst, s32 size, const BlitPalette* palette)
+{
+	for(const u8* end = src + size; src != end; src++)
+	{
+		*dst++ = palette->colors[*src & 0x0f];
+		*dst++ = palette->colors[*src >> 4];
+	}
+}
+
+#endif
+
+#if defined(TIC_BLIT_SSE2)
+
+static void blitRowSse2(const u8* src, u32* dst, s32 size, const BlitPalette* palette)
+{
+	s32 i = 0;
+
+	for(; i + 2 <= size; i += 2, dst += 4)
+	{
+		__m128i lo = _mm_loadl_epi64((const __m128i*)palette->pairs[src[i]]);
+		__m128i hi = _mm_loadl_epi64((const __m128i*)palette->pairs[src[i+1]]);
+		_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi64(lo, hi));
+	}
+
+	blitRowScalar(src + i, dst, size - i, palette);
+}
+
+#endif
+
+#if defined(TIC_BLIT_AVX2)
+
+// shuffles 32 color indices (lane 0 holds pixels 0..15, lane 1 holds pixels 16..31)
+// through the channel planes and interleaves them into BGRA
+__attribute__((target("avx2")))
+static inline void expandAvx2(__m256i index, u32* dst, __m256i b, __m256i g, __m256i r)
+{
+	const __m256i alpha = _mm256_set1_epi8((char)0xff);
+
+	__m256i pb = _mm256_shuffle_epi8(b, index);
+	__m256i pg = _mm256_shuffle_epi8(g, index);
+	__m256i pr = _mm256_shuffle_epi8(r, index);
+
+	__m256i bgLo = _mm256_unpacklo_epi8(pb, pg);
+	__m256i bgHi = _mm256_unpackhi_epi8(pb, pg);
+	__m256i raLo = _mm256_unpacklo_epi8(pr, alpha);
+	__m256i raHi = _mm256_unpackhi_epi8(pr, alpha);
+
+	__m256i p0 = _mm256_unpacklo_epi16(bgLo, raLo); // 0..3 | 16..19
+	__m256i p1 = _mm256_unpackhi_epi16(bgLo, raLo); // 4..7 | 20..23
+	__m256i p2 = _mm256_unpacklo_epi16(bgHi, raHi); // 8..11 | 24..27
+	__m256i p3 = _mm256_unpackhi_epi16(bgHi, raHi); // 12..15 | 28..31
+
+	_mm256_storeu_si256((__m256i*)(dst + 0), _mm256_permute2x128_si256(p0, p1, 0x20));
+	_mm256_storeu_si256((__m256i*)(dst + 8), _mm256_permute2x128_si256(p2, p3, 0x20));
+	_mm256_storeu_si256((__m256i*)(dst + 16), _mm256_permute2x128_si256(p0, p1, 0x31));
+	_mm256_storeu_si256((__m256i*)(dst + 24), _mm256_permute2x128_si256(p2, p3, 0x31));
+}
+
+// expands 16 screen bytes to 32 pixels
+__attribute__((target("avx2")))
+static void blitRowAvx2(const u8* src, u32* dst, s32 size, const BlitPalette* palette)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	const __m256i b = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)palette->planes[0]));
+	const __m256i g = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)palette->planes[1]));
+	const __m256i r = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)palette->planes[2]));
+
+	s32 i = 0;
+
+	for(; i + 16 <= size; i += 16, dst += 32)
+	{
+		__m128i bytes = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i lo = _mm_and_si128(bytes, mask);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), mask);
+
+		expandAvx2(_mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi8(lo, hi)), _mm_unpackhi_epi8(lo, hi), 1), dst, b, g, r);
+	}
+
+	blitRowTail(src + i, dst, size - i, palette);
+}
+
+// shadow screen rows are color indices already, 32 of them are loaded at once
+__attribute__((target("avx2")))
+static void blitPixelsAvx2(const u8* src, u32* dst, s32 size, const BlitPalette* palette)
+{
+	const __m256i b = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)palette->planes[0]));
+	const __m256i g = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)palette->planes[1]));
+	const __m256i r = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)palette->planes[2]));
+
+	s32 i = 0;
+
+	for(; i + 32 <= size; i += 32, dst += 32)
+		expandAvx2(_mm256_loadu_si256((const __m256i*)(src + i)), dst, b, g, r);
+
+	blitPixelsScalar(src + i, dst, size - i, palette);
+}
+
+#endif
+
+#if defined(TIC_BLIT_NEON)
+
+// expands 8 screen bytes to 16 pixels with table lookups per channel and an interleaved store
+TIC_NEON_TARGET
+static void blitRowNeon(const u8* src, u32* dst, s32 size, const BlitPalette* palette)
+{
+	const uint8x8x2_t b = {{vld1_u8(palette->planes[0]), vld1_u8(palette->planes[0] + 8)}};
+	const uint8x8x2_t g = {{vld1_u8(palette->planes[1]), vld1_u8(palette->planes[1] + 8)}};
+	const uint8x8x2_t r = {{vld1_u8(palette->planes[2]), vld1_u8(palette->planes[2] + 8)}};
+	const uint8x8_t mask = vdup_n_u8(0x0f);
+	const uint8x8_t alpha = vdup_n_u8(0xff);
+
+	s32 i = 0;
+
+	for(; i + 8 <= size; i += 8, dst += 16)
+	{
+		uint8x8_t bytes = vld1_u8(src + i);
+		uint8x8x2_t index = vzip_u8(vand_u8(bytes, mask), vshr_n_u8(bytes, 4));
+
+		for(s32 h = 0; h < 2; h++)
+		{
+			uint8x8x4_t pixels;
+			pixels.val[0] = vtbl2_u8(b, index.val[h]);
+			pixels.val[1] = vtbl2_u8(g, index.val[h]);
+			pixels.val[2] = vtbl2_u8(r, index.val[h]);
+			pixels.val[3] = alpha;
+
+			vst4_u8((u8*)(dst + h * 8), pixels);
+		}
+	}
+
+	blitRowTail(src + i, dst, size - i, palette);
+}
+
+TIC_NEON_TARGET
+static void blitPixelsNeon(const u8* src, u32* dst, s32 size, const BlitPalette* palette)
+{
+	const uint8x8x2_t b = {{vld1_u8(palette->planes[0]), vld1_u8(palette->planes[0] + 8)}};
+	const uint8x8x2_t g = {{vld1_u8(palette->planes[1]), vld1_u8(palette->planes[1] + 8)}};
+	const uint8x8x2_t r = {{vld1_u8(palette->planes[2]), vld1_u8(palette->planes[2] + 8)}};
+	const uint8x8_t alpha = vdup_n_u8(0xff);
+
+	s32 i = 0;
+
+	for(; i + 8 <= size; i += 8, dst += 8)
+	{
+		uint8x8_t index = vld1_u8(src + i);
+
+		uint8x8x4_t pixels;
+		pixels.val[0] = vtbl2_u8(b, index);
+		pixels.val[1] = vtbl2_u8(g, index);
+		pixels.val[2] = vtbl2_u8(r, index);
+		pixels.val[3] = alpha;
+
+		vst4_u8((u8*)dst, pixels);
+	}
+
+	blitPixelsScalar(src + i, dst, size - i, palette);
+}
+
+#endif
+
+static void initSoundTables(SoundTables* tables)
+{
+	for(s32 i = 0; i < NOTE_TABLE_SIZE; i++)
+		tables->notes[i] = (s32)note2freq(i + NOTE_TABLE_START);
+
+	for(s32 i = 0; i < COUNT_OF(tables->noisePeriods); i++)
+	{
+		tables->noisePeriods[i] = freq2period(i);
+		tables->envelopePeriods[i] = freq2period(i * ENVELOPE_FREQ_SCALE);
+	}
+}
+
+static void initBlitTables(BlitTables* tables)
+{
+	tables->row = blitRowScalar;
+	tables->pixels = blitPixelsScalar;
+	tables->usePairs = true;
+
+#if defined(TIC_BLIT_SSE2)
+	tables->row = blitRowSse2;
+#endif
+
+#if defined(TIC_BLIT_AVX2)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2"))
+	{
+		tables->row = blitRowAvx2;
+		tables->pixels = blitPixelsAvx2;
+		tables->usePairs = false;
+	}
+#endif
+
+#if defined(TIC_BLIT_NEON)
+#	if defined(__arm__) && defined(__ARM_LINUX__)
+	if(getauxval(AT_HWCAP) & HWCAP_NEON)
+#	endif
+	{
+		tables->row = blitRowNeon;
+		tables->pixels = blitPixelsNeon;
+		tables->usePairs = false;
+	}
+#endif
+}
+
+// tables are rebuilt only when the palette differs from the one they were built from
+static const BlitPalette* paletteBlit(BlitTables* tables, s32 slot, const tic_palette* palette)
+{
+	BlitPalette* blit = &tables->palettes[slot];
+
+	if(blit->valid && memcmp(&blit->source, palette, sizeof(tic_palette)) == 0)
+		return blit;
+
+	memcpy(&blit->source, palette, sizeof(tic_palette));
+	blit->valid = true;
+
+	for(s32 i = 0; i < TIC_PALETTE_SIZE; i++)
+	{
+		const tic_rgb* rgb = &palette->colors[i];
+		u8* dst = (u8*)&blit->colors[i];
+
+		dst[0] = blit->planes[0][i] = rgb->b;
+		dst[1] = blit->planes[1][i] = rgb->g;
+		dst[2] = blit->planes[2][i] = rgb->r;
+		dst[3] = 0xff;
+	}
+
+	if(tables->usePairs)
+		for(s32 i = 0; i < COUNT_OF(blit->pairs); i++)
+		{
+			blit->pairs[i][0] = blit->colors[i & 0x0f];
+			blit->pairs[i][1] = blit->colors[i >> 4];
+		}
+
+	return blit;
+}
+
+// screen offset and raster offset are applied as a shift of the whole converted row
+static void blitRow(tic_machine* machine, u32* dst, s32 row, const BlitPalette* palette)
 {
-	static u32 pal[TIC_PALETTE_SIZE] = {0};
+	const tic_vram* vram = &machine->memory.ram.vram;
+	const tic_raster* raster = &machine->memory.ram.raster;
+	const BlitTables* tables = &machine->blit;
+	const u32 bg = palette->colors[vram->vars.bg];
+
+	s32 y = row + vram->vars.offset.y + raster->offset[row].y;
+	s32 x = vram->vars.offset.x + raster->offset[row].x;
+
+	if(y < 0 || y >= TIC80_HEIGHT || x <= -TIC80_WIDTH || x >= TIC80_WIDTH)
+	{
+		memset4(dst, bg, TIC80_WIDTH);
+		return;
+	}
 
-	const u8* src = tic->ram.vram.palette.data;
+	// the shadow screen is converted directly, VRAM is not packed for it
+	const bool shadow = machine->shadow.enabled;
+	const u8* src = shadow ? machine->shadow.data + y * TIC80_WIDTH : vram->screen.data + y * TIC80_WIDTH / 2;
+	BlitRowFunc* convert = shadow ? tables->pixels : tables->row;
+	const s32 size = shadow ? TIC80_WIDTH : TIC80_WIDTH / 2;
 
-	memset(pal, 0xff, sizeof pal);
+	if(x == 0)
+	{
+		convert(src, dst, size, palette);
+		return;
+	}
 
-	u8* dst = (u8*)pal;
-	const u8* end = src + sizeof(tic_palette);
+	// shadow rows are shifted by converting a part of the row in place
+	if(shadow)
+	{
+		if(x > 0)
+		{
+			convert(src + x, dst, TIC80_WIDTH - x, palette);
+			memset4(dst + TIC80_WIDTH - x, bg, x);
+		}
+		else
+		{
+			memset4(dst, bg, -x);
+			convert(src, dst - x, TIC80_WIDTH + x, palette);
+		}
 
-	enum{RGB = sizeof(tic_rgb)};
+		return;
+	}
 
-	for(; src != end; dst++, src+=RGB)
-		for(s32 j = 0; j < RGB; j++)
-			*dst++ = *(src+(RGB-1)-j);
+	u32 line[TIC80_WIDTH];
+	convert(src, line, size, palette);
 
-	return pal;
+	if(x > 0)
+	{
+		memcpy(dst, line + x, (TIC80_WIDTH - x) * sizeof(u32));
+		memset4(dst + TIC80_WIDTH - x, bg, x);
+	}
+	else
+	{
+		memset4(dst, bg, -x);
+		memcpy(dst - x, line, (TIC80_WIDTH + x) * sizeof(u32));
+	}
 }
 
+// Rows use the VRAM palette unless the raster table selects an override.
+// Palette tables are checked on first use and again after every scanline
+// callback, so a frame without callbacks compares each palette once.
 static void api_blit(tic_mem* tic, u32* out, tic_scanline scanline)
 {
-	const u32* pal = paletteBlit(tic);
+	tic_machine* machine = (tic_machine*)tic;
+	const tic_raster* raster = &tic->ram.raster;
 
 	if(scanline)
 	{
 		scanline(tic, 0);
-		pal = paletteBlit(tic);
+
+		// nothing to call per row when the script has no scanline function
+		if(scanline == api_scanline && !machine->scanlineCall.defined)
+			scanline = NULL;
 	}
 
+	const BlitPalette* palettes[1 + TIC_RASTER_PALETTES] = {NULL};
+	palettes[0] = paletteBlit(&machine->blit, 0, &tic->ram.vram.palette);
+
 	enum {Top = (TIC80_FULLHEIGHT-TIC80_HEIGHT)/2, Bottom = Top};
 	enum {Left = (TIC80_FULLWIDTH-TIC80_WIDTH)/2, Right = Left};
 
-	memset4(&out[0 * TIC80_FULLWIDTH], pal[tic->ram.vram.vars.border], TIC80_FULLWIDTH*Top);
+	memset4(&out[0 * TIC80_FULLWIDTH], palettes[0]->colors[tic->ram.vram.vars.border], TIC80_FULLWIDTH*Top);
 
 	for(s32 r = 0; r < TIC80_HEIGHT; r++)
 	{
-		memset4(&out[(r+Top) * TIC80_FULLWIDTH], pal[tic->ram.vram.vars.border], Left);
-		memset4(&out[(r+Top) * TIC80_FULLWIDTH + Left], pal[tic->ram.vram.vars.bg], TIC80_WIDTH);
-
-		{
-			s32 y = r + tic->ram.vram.vars.offset.y;
+		u32* line = &out[(r+Top) * TIC80_FULLWIDTH];
 
-			if(y < 0 || y >= TIC80_HEIGHT) continue;
+		s32 index = raster->palette[r];
 
-			for(s32 c = 0; c < TIC80_WIDTH; c++)
-			{
-				s32 x = c + tic->ram.vram.vars.offset.x;
+		if(index > TIC_RASTER_PALETTES)
+			index = 0;
 
-				if(x < 0 || x >= TIC80_WIDTH) continue;
+		if(!palettes[index])
+			palettes[index] = paletteBlit(&machine->blit, index, &raster->palettes[index - 1]);
 
-				out[(c + Left) + (r+Top) * TIC80_FULLWIDTH] = pal[tic_tool_peek4(tic->ram.vram.screen.data, x + y * TIC80_WIDTH)];
-			}
-		}
+		const BlitPalette* palette = palettes[index];
+		const u32 border = palette->colors[tic->ram.vram.vars.border];
 
-		memset4(&out[(r+Top) * TIC80_FULLWIDTH + (TIC80_FULLWIDTH-Right)], pal[tic->ram.vram.vars.border], Right);
+		memset4(line, border, Left);
+		blitRow(machine, line + Left, r, palette);
+		memset4(line + (TIC80_FULLWIDTH-Right), border, Right);
 
 		if(scanline && (r < TIC80_HEIGHT-1))
 		{
 			scanline(tic, r+1);
-			pal = paletteBlit(tic);
+
+			palettes[0] = paletteBlit(&machine->blit, 0, &tic->ram.vram.palette);
+
+			for(s32 i = 1; i < COUNT_OF(palettes); i++)
+				palettes[i] = NULL;
 		}
 	}
 
-	memset4(&out[(TIC80_FULLHEIGHT-Bottom) * TIC80_FULLWIDTH], pal[tic->ram.vram.vars.border], TIC80_FULLWIDTH*Bottom);
+	memset4(&out[(TIC80_FULLHEIGHT-Bottom) * TIC80_FULLWIDTH], palettes[0]->colors[tic->ram.vram.vars.border], TIC80_FULLWIDTH*Bottom);
 }
 
 static void initApi(tic_api* api)
@@ -1728,6 +3766,7 @@ static void initApi(tic_api* api)
 	INIT_API(text);
 	INIT_API(fixed_text);
 	INIT_API(text_ex);
+	INIT_API(text_width);
 	INIT_API(clear);
 	INIT_API(pixel);
 	INIT_API(get_pixel);
@@ -1738,13 +3777,21 @@ static void initApi(tic_api* api)
 	INIT_API(sprite_ex);
 	INIT_API(map);
 	INIT_API(remap);
+	INIT_API(remap_table);
 	INIT_API(map_set);
 	INIT_API(map_get);
+	INIT_API(map_hits);
+	INIT_API(flag_set);
+	INIT_API(flag_get);
 	INIT_API(circle);
 	INIT_API(circle_border);
 	INIT_API(tri);
 	INIT_API(textri);
 	INIT_API(clip);
+	INIT_API(particle_emitter);
+	INIT_API(particle_emit);
+	INIT_API(particle_draw);
+	INIT_API(particle_clear);
 	INIT_API(sfx);
 	INIT_API(sfx_stop);
 	INIT_API(sfx_ex);
@@ -1759,11 +3806,25 @@ static void initApi(tic_api* api)
 	INIT_API(resume);
 	INIT_API(get_script);
 	INIT_API(sync);
+	INIT_API(invalidate);
+	INIT_API(observe);
+	INIT_API(shadow_screen);
+	INIT_API(cpu_budget);
+	INIT_API(cpu_stats);
+	INIT_API(vm_memory_limit);
+	INIT_API(vm_memory);
+	INIT_API(trust_binary);
 	INIT_API(btnp);
 	INIT_API(load);
 	INIT_API(save);
+	INIT_API(compile);
+	INIT_API(load_binary);
+	INIT_API(save_binary);
 	INIT_API(tick_start);
 	INIT_API(tick_end);
+	INIT_API(render_sound);
+	INIT_API(sound_output);
+	INIT_API(sound_pull);
 	INIT_API(blit);
 
 #undef INIT_API
@@ -1780,6 +3841,8 @@ tic_mem* tic_create(s32 samplerate)
 	machine->soundSrc = &machine->memory.ram.sound;
 
 	initApi(&machine->memory.api);
+	initBlitTables(&machine->blit);
+	initSoundTables(&machine->sound);
 
 	machine->samplerate = samplerate;
 	machine->memory.samples.size = samplerate / TIC_FRAMERATE * sizeof(s16);
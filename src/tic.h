@@ -52,7 +52,10 @@
 #define TIC_COPYRIGHT "http://" TIC_HOST " (C) 2017"
 
 #define TIC_VRAM_SIZE (16*1024) //16K
-#define TIC_RAM_SIZE (80*1024) //80K
+#define TIC_RAM_SIZE (82*1024) //82K
+#define TIC_RASTER_SIZE 1024
+#define TIC_RASTER_PALETTES 8
+#define TIC_TILE_FLAGS 8
 #define TIC_FONT_WIDTH 6
 #define TIC_FONT_HEIGHT 6
 #define TIC_PALETTE_BPP 4
@@ -106,13 +109,15 @@
 #define ENVELOPE_SIZE (ENVELOPE_VALUES * ENVELOPE_VALUE_BITS / BITS_IN_BYTE)
 
 #define TIC_CODE_SIZE (0x10000)
+#define TIC_BINARY_KEY_SIZE 16
 
 #define SFX_NOTES {"C-", "C#", "D-", "D#", "E-", "F-", "F#", "G-", "G#", "A-", "A#", "B-"}
 
 #define API_KEYWORDS {"TIC", "scanline", "print", "cls", "pix", "line", "rect", "rectb", \
 	"spr", "btn", "btnp", "sfx", "map", "mget", "mset", "peek", "poke", "peek4", "poke4", \
 	"memcpy", "memset", "trace", "pmem", "time", "exit", "font", "mouse", "circ", "circb", "tri", "textri", \
-	"clip", "music", "sync"}
+	"clip", "music", "sync", "memread", "memwrite", \
+	"sprlist", "pixlist", "rectlist", "pemitter", "pemit", "pdraw", "pclear", "fget", "fset", "mhit"}
 
 #define TIC_FONT_CHARS 128
 
@@ -125,7 +130,7 @@ enum
 	NoteStart,
 };
 
-enum
+typedef enum
 {
 	tic_color_black,		// 0
 	tic_color_dark_red,		// 1
@@ -301,6 +306,12 @@ typedef struct
 	tic_map map;
 } tic_gfx;
 
+// bit N of data[index] is flag N of tile index, see map_hits
+typedef struct
+{
+	u8 data[TIC_BANK_SPRITES];
+} tic_flags;
+
 typedef struct
 {
 	char data[TIC_CODE_SIZE];
@@ -335,6 +346,7 @@ typedef struct
 typedef struct
 {
 	tic_gfx gfx;
+	tic_flags flags;
 	tic_sound sound;
 	tic_code code;
 	tic_cover_image cover;
@@ -400,6 +412,26 @@ typedef struct
 	s32 data[TIC_PERSISTENT_SIZE];
 } tic_persistent;
 
+// per row effects applied by blit on top of the VRAM vars, zeroes change nothing
+typedef union
+{
+	struct
+	{
+		struct
+		{
+			s8 x;
+			s8 y;
+		} offset[TIC80_HEIGHT];
+
+		// N in 1..TIC_RASTER_PALETTES selects palettes[N-1], other values keep the VRAM palette
+		u8 palette[TIC80_HEIGHT];
+
+		tic_palette palettes[TIC_RASTER_PALETTES];
+	};
+
+	u8 data[TIC_RASTER_SIZE];
+} tic_raster;
+
 typedef union
 {
 	struct
@@ -410,6 +442,8 @@ typedef union
 		tic_sound_register registers[TIC_SOUND_CHANNELS];
 		tic_sound sound;
 		tic_music_pos music_pos;
+		tic_raster raster;
+		tic_flags flags;
 	};
 
 	u8 data[TIC_RAM_SIZE];
@@ -26,6 +26,9 @@
 
 typedef struct { u8 index; tic_flip flip; tic_rotate rotate; } RemapResult;
 typedef void(*RemapFunc)(void*, s32 x, s32 y, RemapResult* result);
+
+// one entry per tile index, remap_table applies it to every map cell without a callback
+#define TIC_REMAP_SIZE 256
 typedef struct
 {
 	union
@@ -42,9 +45,56 @@ typedef struct
 	};
 } tic_sfx_pos;
 
+// per frame limits for the cart's code, 0 means no limit
+typedef struct
+{
+	u64 instructions; // counted by Lua and JS, Wren can only be stopped by time
+	s32 ms; // measured with the tick data counter
+} tic_cpu_budget;
+
+typedef struct
+{
+	u64 instructions; // Lua is only counted while there is a budget
+	double ms;
+} tic_cpu_stats;
+
+// bytes the cart's script VM holds, counted since the VM was created
+typedef struct
+{
+	u32 current;
+	u32 peak;
+} tic_vm_memory;
+
+#define TIC_PARTICLE_COLORS 8
+
+// template for the particles an emitter spawns, they are moved once a tick in C
+typedef struct
+{
+	s32 life; // ticks
+	float speed; // pixels a tick
+	float angle; // radians, 0 points right and the angle grows clockwise
+	float spread; // particles leave at a random angle this wide around it
+	float gravity; // added to the vertical speed every tick
+	s32 sprite; // drawn instead of a pixel when it's >= 0, 0 is the transparent color
+	u8 colors[TIC_PARTICLE_COLORS]; // pixel color from birth to death
+	s32 count;
+} tic_particle_emitter;
+
+// hits the bindings collect on the stack, more than that are allocated
+#define TIC_MAP_HITS 64
+
+// a map cell found by map_hits, x and y are in cells
+typedef struct
+{
+	s32 x;
+	s32 y;
+	u8 index;
+} tic_map_hit;
+
 typedef void(*TraceOutput)(void*, const char*, u8 color);
 typedef void(*ErrorOutput)(void*, const char*);
 typedef void(*ExitCallback)(void*);
+typedef u64(*CounterCallback)(void*);
 
 typedef struct
 {
@@ -52,8 +102,8 @@ typedef struct
 	ErrorOutput error;
 	ExitCallback exit;
 	
-	u64 (*counter)();
-	u64 (*freq)();
+	CounterCallback counter;
+	CounterCallback freq;
 	u64 start;
 
 	void* data;
@@ -68,6 +118,7 @@ typedef struct
 	s32  (*text)				(tic_mem* memory, const char* text, s32 x, s32 y, u8 color);
 	s32  (*fixed_text)			(tic_mem* memory, const char* text, s32 x, s32 y, u8 color);
 	s32  (*text_ex)				(tic_mem* memory, const char* text, s32 x, s32 y, u8 color, bool fixed, s32 scale);
+	s32  (*text_width)			(tic_mem* memory, const char* text, bool fixed, s32 scale);
 	void (*clear)				(tic_mem* memory, u8 color);
 	void (*pixel)				(tic_mem* memory, s32 x, s32 y, u8 color);
 	u8   (*get_pixel)			(tic_mem* memory, s32 x, s32 y);
@@ -78,13 +129,21 @@ typedef struct
 	void (*sprite_ex)			(tic_mem* memory, const tic_gfx* src, s32 index, s32 x, s32 y, s32 w, s32 h, u8* colors, s32 count, s32 scale, tic_flip flip, tic_rotate rotate);
 	void (*map)					(tic_mem* memory, const tic_gfx* src, s32 x, s32 y, s32 width, s32 height, s32 sx, s32 sy, u8 chromakey, s32 scale);
 	void (*remap)				(tic_mem* memory, const tic_gfx* src, s32 x, s32 y, s32 width, s32 height, s32 sx, s32 sy, u8 chromakey, s32 scale, RemapFunc remap, void* data);
+	void (*remap_table)			(tic_mem* memory, const tic_gfx* src, s32 x, s32 y, s32 width, s32 height, s32 sx, s32 sy, u8 chromakey, s32 scale, const RemapResult* table);
 	void (*map_set)				(tic_mem* memory, tic_gfx* src, s32 x, s32 y, u8 value);
 	u8   (*map_get)				(tic_mem* memory, const tic_gfx* src, s32 x, s32 y);
+	s32  (*map_hits)			(tic_mem* memory, const tic_gfx* src, const tic_flags* flags, s32 x, s32 y, s32 width, s32 height, u8 mask, tic_map_hit* hits, s32 count);
+	void (*flag_set)			(tic_mem* memory, tic_flags* flags, s32 index, s32 flag, bool value);
+	bool (*flag_get)			(tic_mem* memory, const tic_flags* flags, s32 index, s32 flag);
 	void (*circle)				(tic_mem* memory, s32 x, s32 y, u32 radius, u8 color);
 	void (*circle_border)		(tic_mem* memory, s32 x, s32 y, u32 radius, u8 color);
 	void (*tri)					(tic_mem* memory, s32 x1, s32 y1, s32 x2, s32 y2, s32 x3, s32 y3, u8 color);
-	void(*textri)				(tic_mem* memory, float x1, float y1, float x2, float y2, float x3, float y3, float u1, float v1, float u2, float v2, float u3, float v3, bool use_map, u8 chroma);
+	void(*textri)				(tic_mem* memory, float x1, float y1, float x2, float y2, float x3, float y3, float u1, float v1, float u2, float v2, float u3, float v3, bool use_map, u8 chroma, float z1, float z2, float z3, bool depth);
 	void (*clip)				(tic_mem* memory, s32 x, s32 y, s32 width, s32 height);
+	void (*particle_emitter)	(tic_mem* memory, s32 id, const tic_particle_emitter* emitter);
+	void (*particle_emit)		(tic_mem* memory, s32 id, s32 x, s32 y, s32 count);
+	s32  (*particle_draw)		(tic_mem* memory);
+	void (*particle_clear)		(tic_mem* memory);
 	void (*sfx)					(tic_mem* memory, s32 index, s32 note, s32 octave, s32 duration, s32 channel);
 	void (*sfx_stop)			(tic_mem* memory, s32 channel);
 	void (*sfx_ex)				(tic_mem* memory, s32 index, s32 note, s32 octave, s32 duration, s32 channel, s32 volume, s32 speed);
@@ -98,13 +157,27 @@ typedef struct
 	void (*pause)				(tic_mem* memory);
 	void (*resume)				(tic_mem* memory);
 	void (*sync)				(tic_mem* memory, bool toCart);
+	void (*invalidate)			(tic_mem* memory, const void* address, s32 size);
+	void (*observe)				(tic_mem* memory, const void* address, s32 size);
+	void (*shadow_screen)		(tic_mem* memory, bool enabled);
 	u32 (*btnp)					(tic_mem* memory, s32 id, s32 hold, s32 period);
+	void (*cpu_budget)			(tic_mem* memory, tic_cpu_budget budget);
+	tic_cpu_stats (*cpu_stats)	(tic_mem* memory);
+	void (*vm_memory_limit)		(tic_mem* memory, u32 bytes);
+	tic_vm_memory (*vm_memory)	(tic_mem* memory);
+	void (*trust_binary)		(tic_mem* memory, const u8* key);
 
 	void (*load)				(tic_cartridge* rom, const u8* buffer, s32 size, bool palette);
 	s32  (*save)				(const tic_cartridge* rom, u8* buffer);
+	void (*compile)				(tic_mem* memory);
+	void (*load_binary)			(tic_mem* memory, const u8* buffer, s32 size);
+	s32  (*save_binary)			(tic_mem* memory, u8* buffer);
 
 	void (*tick_start)			(tic_mem* memory, const tic_sound* src);
 	void (*tick_end)			(tic_mem* memory);
+	s32  (*render_sound)		(tic_mem* memory, s16* buffer, s32 frames);
+	void (*sound_output)		(tic_mem* memory, void* buffer, s32 format);
+	s32  (*sound_pull)			(tic_mem* memory, void* buffer, s32 count, s32 format);
 	void (*blit)				(tic_mem* tic, u32* out, tic_scanline scanline);
 
 	tic_script_lang (*get_script)(tic_mem* memory);
@@ -117,7 +190,7 @@ struct tic_mem
 	tic_cartridge 		config;
 	tic_input_method 	input;
 	tic_script_lang 	script;
-	tic_font 			font;
+	tic_font 			font; // hosts call api.invalidate on it after writing it
 	tic_api 			api;
 	tic_code			code;
 
@@ -138,4 +211,5 @@ typedef struct
 	tic80 tic;
 	tic_mem* memory;
 	tic_tick_data tickData;
+	u64 tickCounter;
 } tic80_local;
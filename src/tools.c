@@ -105,3 +105,126 @@ u32 tic_tool_find_closest_color(const tic_rgb* palette, const tic_rgb* color)
 
 	return closetColor;
 }
+
+static void writeLE(u8* dst, u32 value, s32 size)
+{
+	for(s32 i = 0; i < size; i++)
+		dst[i] = (u8)(value >> (i * BITS_IN_BYTE));
+}
+
+// header of a mono 16-bit PCM .wav holding 'samples' samples
+void tic_tool_wav_header(u8* header, s32 samplerate, s32 samples)
+{
+	enum {Channels = 1, Bits = 16, BlockAlign = Channels * Bits / BITS_IN_BYTE};
+
+	u32 size = samples * BlockAlign;
+
+	memcpy(header, "RIFF", 4);
+	writeLE(header + 4, TIC_WAV_HEADER_SIZE - 8 + size, 4);
+	memcpy(header + 8, "WAVEfmt ", 8);
+	writeLE(header + 16, 16, 4);
+	writeLE(header + 20, 1, 2);
+	writeLE(header + 22, Channels, 2);
+	writeLE(header + 24, samplerate, 4);
+	writeLE(header + 28, samplerate * BlockAlign, 4);
+	writeLE(header + 32, BlockAlign, 2);
+	writeLE(header + 34, Bits, 2);
+	memcpy(header + 36, "data", 4);
+	writeLE(header + 40, size, 4);
+}
+
+// FNV-1a, the seed tells apart hashes of the same data made for different purposes
+u64 tic_tool_hash(const void* data, s32 size, u64 seed)
+{
+	const u8* ptr = (const u8*)data;
+	u64 hash = 14695981039346656037ULL ^ seed;
+
+	for(s32 i = 0; i < size; i++)
+	{
+		hash ^= ptr[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+#define ROTL64(x, b) (u64)(((x) << (b)) | ((x) >> (64 - (b))))
+
+static void sipRounds(u64* v, s32 rounds)
+{
+	while(rounds--)
+	{
+		v[0] += v[1]; v[1] = ROTL64(v[1], 13); v[1] ^= v[0]; v[0] = ROTL64(v[0], 32);
+		v[2] += v[3]; v[3] = ROTL64(v[3], 16); v[3] ^= v[2];
+		v[0] += v[3]; v[3] = ROTL64(v[3], 21); v[3] ^= v[0];
+		v[2] += v[1]; v[1] = ROTL64(v[1], 17); v[1] ^= v[2]; v[2] = ROTL64(v[2], 32);
+	}
+}
+
+static void sipCompress(u64* v, u64 m)
+{
+	v[3] ^= m;
+	sipRounds(v, 2);
+	v[0] ^= m;
+}
+
+static u64 readLE64(const u8* ptr)
+{
+	u64 value = 0;
+
+	for(s32 i = 7; i >= 0; i--)
+		value = value << 8 | ptr[i];
+
+	return value;
+}
+
+void tic_tool_mac_start(tic_mac* mac, const u8* key)
+{
+	u64 k0 = readLE64(key);
+	u64 k1 = readLE64(key + 8);
+
+	mac->v[0] = k0 ^ 0x736f6d6570736575ULL;
+	mac->v[1] = k1 ^ 0x646f72616e646f6dULL;
+	mac->v[2] = k0 ^ 0x6c7967656e657261ULL;
+	mac->v[3] = k1 ^ 0x7465646279746573ULL;
+	mac->tail = 0;
+	mac->size = 0;
+}
+
+// the data of all the calls is hashed as one message
+void tic_tool_mac_add(tic_mac* mac, const void* data, s32 size)
+{
+	const u8* ptr = (const u8*)data;
+	const u8* end = ptr + size;
+
+	while(ptr < end)
+	{
+		if((mac->size & 7) == 0 && end - ptr >= 8)
+		{
+			sipCompress(mac->v, readLE64(ptr));
+			ptr += 8;
+			mac->size += 8;
+			continue;
+		}
+
+		mac->tail |= (u64)*ptr++ << (mac->size++ & 7) * 8;
+
+		if((mac->size & 7) == 0)
+		{
+			sipCompress(mac->v, mac->tail);
+			mac->tail = 0;
+		}
+	}
+}
+
+u64 tic_tool_mac_end(tic_mac* mac)
+{
+	u64* v = mac->v;
+
+	sipCompress(v, mac->tail | (u64)mac->size << 56);
+
+	v[2] ^= 0xff;
+	sipRounds(v, 4);
+
+	return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
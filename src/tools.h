@@ -24,9 +24,24 @@
 
 #include "tic.h"
 
+#define TIC_WAV_HEADER_SIZE 44
+
+// SipHash-2-4 state, a hash that can't be made without the key
+typedef struct
+{
+	u64 v[4];
+	u64 tail;
+	s32 size;
+} tic_mac;
+
 void tic_tool_poke4(void* addr, u32 index, u8 value);
 u8 tic_tool_peek4(const void* addr, u32 index);
 bool tic_tool_parse_note(const char* noteStr, s32* note, s32* octave);
 s32 tic_tool_get_pattern_id(const tic_track* track, s32 frame, s32 channel);
 void tic_tool_set_pattern_id(tic_track* track, s32 frame, s32 channel, s32 id);
-u32 tic_tool_find_closest_color(const tic_rgb* palette, const tic_rgb* color);
\ No newline at end of file
+u32 tic_tool_find_closest_color(const tic_rgb* palette, const tic_rgb* color);
+void tic_tool_wav_header(u8* header, s32 samplerate, s32 samples);
+u64 tic_tool_hash(const void* data, s32 size, u64 seed);
+void tic_tool_mac_start(tic_mac* mac, const u8* key);
+void tic_tool_mac_add(tic_mac* mac, const void* data, s32 size);
+u64 tic_tool_mac_end(tic_mac* mac);
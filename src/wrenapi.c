@@ -29,12 +29,22 @@
 
 #include "wren.h"
 
-static WrenHandle* game_class;
-static WrenHandle* new_handle;
-static WrenHandle* update_handle;
-static WrenHandle* scanline_handle;
+#if defined(TIC80_NO_WREN)
 
-static bool loaded = false;
+// built without the Wren library, Wren carts fail to start with an error
+
+void closeWren(tic_machine* machine) {}
+
+bool initWren(tic_machine* machine, const char* code)
+{
+	machine->data->error(machine->data->data, "Wren isn't supported in this build");
+	return false;
+}
+
+void callWrenTick(tic_machine* machine) {}
+void callWrenScanline(tic_mem* memory, s32 row) {}
+
+#else
 
 static char const* tic_wren_api = "                         			                            \n"
 "class Tic {                                                                                     	\n"
@@ -55,6 +65,10 @@ static char const* tic_wren_api = "
 "	foreign static spr(id, x, y, alpha_color, scale, flip)                                      	\n"
 "	foreign static spr(id, x, y, alpha_color, scale, flip, rotate)                              	\n"
 "	foreign static spr(id, x, y, alpha_color, scale, flip, rotate, cell_width, cell_height)     	\n"
+"	foreign static sprlist(list)                                                                	\n"
+"	foreign static sprlist(list, alpha_color)                                                   	\n"
+"	foreign static sprlist(list, alpha_color, scale)                                            	\n"
+"	foreign static sprlist(list, alpha_color, scale, cell_width, cell_height)                   	\n"
 "	foreign static map(cell_x, cell_y)                                                          	\n"
 "	foreign static map(cell_x, cell_y, cell_w, cell_h)                                          	\n"
 "	foreign static map(cell_x, cell_y, cell_w, cell_h, x, y)                                    	\n"
@@ -66,6 +80,7 @@ static char const* tic_wren_api = "
 "	foreign static textri(x1, y1, x2, y2, x3, y3, u1, v1, u2, v2, u3, v3)                           \n"
 "	foreign static textri(x1, y1, x2, y2, x3, y3, u1, v1, u2, v2, u3, v3, use_map)                  \n"
 "	foreign static textri(x1, y1, x2, y2, x3, y3, u1, v1, u2, v2, u3, v3, use_map, alpha_color)     \n"
+"	foreign static textri(x1, y1, x2, y2, x3, y3, u1, v1, u2, v2, u3, v3, use_map, alpha_color, z)  \n"
 "	foreign static pix(x, y)                                                                        \n"
 "	foreign static pix(x, y, color)                                                                 \n"
 "	foreign static line(x0, y0, x1, y1, color)                                                      \n"
@@ -73,6 +88,18 @@ static char const* tic_wren_api = "
 "	foreign static circb(x, y, radius, color)                                                       \n"
 "	foreign static rect(x, y, w, h, color)                                                          \n"
 "	foreign static rectb(x, y, w, h, color)                                                         \n"
+"	foreign static pixlist(list)                                                                    \n"
+"	foreign static pemitter(id, life, speed, angle, spread, gravity, colors)                        \n"
+"	foreign static pemitter(id, life, speed, angle, spread, gravity, colors, sprite)                \n"
+"	foreign static pemit(id, x, y)                                                                  \n"
+"	foreign static pemit(id, x, y, count)                                                           \n"
+"	foreign static pdraw()                                                                          \n"
+"	foreign static pclear()                                                                         \n"
+"	foreign static fget(index, flag)                                                                \n"
+"	foreign static fset(index, flag, value)                                                         \n"
+"	foreign static mhit(x, y, w, h)                                                                 \n"
+"	foreign static mhit(x, y, w, h, mask)                                                           \n"
+"	foreign static rectlist(list)                                                                   \n"
 "	foreign static tri(x1, y1, x2, y2, x3, y3, color)                                               \n"
 "	foreign static cls()                                                                            \n"
 "	foreign static cls(color)                                                                       \n"
@@ -84,6 +111,8 @@ static char const* tic_wren_api = "
 "	foreign static poke4(addr, val)                                                                 \n"
 "	foreign static memcpy(dst, src, size)                                                           \n"
 "	foreign static memset(dst, src, size)                                                           \n"
+"	foreign static memread(addr, size)                                                              \n"
+"	foreign static memwrite(addr, data)                                                             \n"
 "	foreign static pmem(index, val)                                                                 \n"
 "	foreign static sfx(id)                                                                          \n"
 "	foreign static sfx(id, note)                                                                    \n"
@@ -105,6 +134,7 @@ static char const* tic_wren_api = "
 "	foreign static trace__(msg, color)                                                          	\n"
 "	foreign static spr__(id, x, y, alpha_color, scale, flip, rotate)                            	\n"
 "	foreign static mgeti__(index)                                                                   \n"
+"	foreign static maptable__(cell_x, cell_y, cell_w, cell_h, x, y, alpha_color, scale, remap)      \n"
 "	static print(v) { Tic.print__(v.toString, 0, 0, 15, false, 1) }                             	\n"
 "	static print(v,x,y) { Tic.print__(v.toString, x, y, 15, false, 1) }                         	\n"
 "	static print(v,x,y,color) { Tic.print__(v.toString, x, y, color, false, 1) }                	\n"
@@ -113,6 +143,9 @@ static char const* tic_wren_api = "
 "	static trace(v) { Tic.trace__(v.toString, 15) }                                             	\n"
 "	static trace(v,color) { Tic.trace__(v.toString, color) }                                    	\n"
 "	static map(cell_x, cell_y, cell_w, cell_h, x, y, alpha_color, scale, remap) {               	\n"
+"		if (remap is List || remap is Num) {                                                      	\n"
+"			return Tic.maptable__(cell_x, cell_y, cell_w, cell_h, x, y, alpha_color, scale, remap)  	\n"
+"		}                                                                                         	\n"
 "		var map_w = Tic.map_width__                                                               	\n"
 "		var map_h = Tic.map_height__                                                              	\n"
 "		var size = Tic.spritesize__ * scale                                                       	\n"
@@ -146,6 +179,11 @@ static char const* tic_wren_api = "
 "		}                                                                                       	\n"
 "	}                                                                                           	\n"
 "}                                                                                               	\n"
+"class RAM {                                                                                     	\n"
+"	foreign static [addr]                                                                       	\n"
+"	foreign static [addr]=(val)                                                                 	\n"
+"	foreign static count                                                                        	\n"
+"}                                                                                               	\n"
 "class Engine {                                                                                  	\n"
 "	update(){}                                                                                  	\n"
 "	scanline(row){}                                                                             	\n"
@@ -172,30 +210,62 @@ static inline bool isList(WrenVM* vm, s32 index)
 	return wrenGetSlotType(vm, index) == WREN_TYPE_LIST;
 }
 
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+// reallocateFn gets no user data, so every call into a VM sets the heap of its machine here first
+static THREAD_LOCAL VmHeap* WrenHeap = NULL;
+
+static void* reallocWren(void* memory, size_t size)
+{
+	return vmRealloc(WrenHeap, memory, size);
+}
+
 void closeWren(tic_machine* machine)
 {
 	if(machine->wren)
 	{	
+		WrenHeap = &machine->heap;
+
 		// release handles
-		if (loaded)
+		if (machine->wrenGame.loaded)
 		{
-			wrenReleaseHandle(machine->wren, game_class);
-			wrenReleaseHandle(machine->wren, new_handle);
-			wrenReleaseHandle(machine->wren, update_handle);
-			wrenReleaseHandle(machine->wren, scanline_handle);
+			wrenReleaseHandle(machine->wren, machine->wrenGame.gameClass);
+			wrenReleaseHandle(machine->wren, machine->wrenGame.newHandle);
+			wrenReleaseHandle(machine->wren, machine->wrenGame.updateHandle);
+			wrenReleaseHandle(machine->wren, machine->wrenGame.scanlineHandle);
 		}
 
 		wrenFreeVM(machine->wren);
 		machine->wren = NULL;
 
+		closeVmHeap(&machine->heap);
 	}
-	loaded = false;
+	machine->wrenGame.loaded = false;
 }
 
+#define WREN_BUDGET_CALLS 64
+
+// Wren has no interpreter hook, so the budget can only be checked when the script calls the API.
+// Returns NULL once the fiber is aborted, the caller has to return without touching slot 0.
 static tic_machine* getWrenMachine(WrenVM* vm)
 {
 	tic_machine* machine = wrenGetUserData(vm);
 
+	if(++machine->wrenGame.calls % WREN_BUDGET_CALLS == 0 && checkCpuBudget(machine, 0))
+	{
+		char buffer[128];
+		getCpuBudgetError(machine, buffer, sizeof buffer);
+
+		wrenSetSlotString(vm, 0, buffer);
+		wrenAbortFiber(vm, 0);
+
+		return NULL;
+	}
+
 	return machine;
 }
 
@@ -220,6 +290,7 @@ static void wren_mgeti(WrenVM* vm)
 	}
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 	wrenSetSlotDouble(vm, 0, *(memory->ram.gfx.map.data + index));
 }
 
@@ -231,6 +302,7 @@ static void wren_spritesize(WrenVM* vm)
 static void wren_btn(WrenVM* vm)
 {
 	tic_machine* machine = getWrenMachine(vm);
+	if(!machine) return;
 
 	if(machine->memory.input == tic_gamepad_input)
 	{
@@ -252,6 +324,7 @@ static void wren_btn(WrenVM* vm)
 static void wren_btnp(WrenVM* vm)
 {	
 	tic_machine* machine = getWrenMachine(vm);
+	if(!machine) return;
 	tic_mem* memory = (tic_mem*)machine;
 
 	if(machine->memory.input == tic_gamepad_input)
@@ -283,6 +356,7 @@ static void wren_btnp(WrenVM* vm)
 static void wren_mouse(WrenVM* vm)
 {
 	tic_machine* machine = getWrenMachine(vm);
+	if(!machine) return;
 
 	if(machine->memory.input == tic_mouse_input)
 	{
@@ -306,6 +380,7 @@ static void wren_mouse(WrenVM* vm)
 static void wren_print(WrenVM* vm)
 {
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	const char* text = wrenGetSlotString(vm, 1);
 
@@ -333,6 +408,7 @@ static void wren_font(WrenVM* vm)
 {
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 	s32 top = wrenGetSlotCount(vm);
 
 	if(top > 1)
@@ -396,6 +472,7 @@ static void wren_font(WrenVM* vm)
 static void wren_trace(WrenVM* vm)
 {
 	tic_machine* machine = getWrenMachine(vm);
+	if(!machine) return;
 
 	const char* text = wrenGetSlotString(vm, 1);
 	u8 color = (u8)wrenGetSlotDouble(vm, 2);
@@ -403,6 +480,38 @@ static void wren_trace(WrenVM* vm)
 	machine->data->trace(machine->data->data, text, color);
 }
 
+// a single color or a list of them, slot 0 is free to read the list into
+static s32 getWrenColorKey(WrenVM* vm, s32 slot, u8* colors)
+{
+	s32 count = 0;
+
+	if(isList(vm, slot))
+	{
+		s32 size = wrenGetListCount(vm, slot);
+
+		for(s32 i = 0; i < size && i < TIC_PALETTE_SIZE; i++)
+		{
+			wrenGetListElement(vm, slot, i, 0);
+			if(isNumber(vm, 0))
+			{
+				colors[i] = getWrenNumber(vm, 0);
+				count++;
+			}
+			else
+			{
+				break;
+			}
+		}
+	}
+	else 
+	{
+		colors[0] = getWrenNumber(vm, slot);
+		count = 1;
+	}
+
+	return count;
+}
+
 static void wren_spr(WrenVM* vm)
 {	
 	s32 top = wrenGetSlotCount(vm);
@@ -415,7 +524,7 @@ static void wren_spr(WrenVM* vm)
 	s32 scale = 1;
 	tic_flip flip = tic_no_flip;
 	tic_rotate rotate = tic_no_rotate;
-	static u8 colors[TIC_PALETTE_SIZE];
+	u8 colors[TIC_PALETTE_SIZE];
 	s32 count = 0;
 
 	if(top > 1) 
@@ -429,27 +538,7 @@ static void wren_spr(WrenVM* vm)
 
 			if(top > 4)
 			{
-				if(isList(vm, 4))
-				{
-					for(s32 i = 0; i < TIC_PALETTE_SIZE; i++)
-					{
-						wrenGetListElement(vm, 4, i, 0); // todo, can be bug cause in slot 0 is object?
-						if(isNumber(vm, 0))
-						{
-							colors[i] = getWrenNumber(vm, 0);
-							count++;
-						}
-						else
-						{
-							break;
-						}
-					}
-				}
-				else 
-				{
-					colors[0] = getWrenNumber(vm, 4);
-					count = 1;
-				}
+				count = getWrenColorKey(vm, 4, colors);
 
 				if(top > 5)
 				{
@@ -476,17 +565,170 @@ static void wren_spr(WrenVM* vm)
 	}
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	memory->api.sprite_ex(memory, &memory->ram.gfx, index, x, y, w, h, colors, count, scale, flip, rotate);
 }
 
+// batch calls take a flat list of instance fields, or a list with a list per instance
+typedef struct
+{
+	s32 count;
+	s32 stride;
+	s32 slot; // two free slots past the arguments to read the instances through
+	bool nested;
+} WrenBatch;
+
+static bool getWrenBatch(WrenVM* vm, s32 stride, WrenBatch* batch)
+{
+	if(!isList(vm, 1))
+		return false;
+
+	batch->slot = wrenGetSlotCount(vm);
+	wrenEnsureSlots(vm, batch->slot + 2);
+
+	s32 length = wrenGetListCount(vm, 1);
+
+	batch->nested = false;
+
+	if(length)
+	{
+		wrenGetListElement(vm, 1, 0, batch->slot);
+		batch->nested = isList(vm, batch->slot);
+	}
+
+	batch->stride = stride;
+	batch->count = batch->nested ? length : length / stride;
+
+	return true;
+}
+
+// missing fields read as 0, an instance that isn't a list is skipped
+static bool getWrenInstance(WrenVM* vm, const WrenBatch* batch, s32 index, s32* fields)
+{
+	s32 slot = batch->slot;
+
+	if(batch->nested)
+	{
+		wrenGetListElement(vm, 1, index, slot);
+
+		if(!isList(vm, slot))
+			return false;
+
+		s32 size = wrenGetListCount(vm, slot);
+
+		for(s32 i = 0; i < batch->stride; i++)
+		{
+			if(i < size)
+			{
+				wrenGetListElement(vm, slot, i, slot + 1);
+				fields[i] = isNumber(vm, slot + 1) ? getWrenNumber(vm, slot + 1) : 0;
+			}
+			else fields[i] = 0;
+		}
+	}
+	else
+	{
+		for(s32 i = 0; i < batch->stride; i++)
+		{
+			wrenGetListElement(vm, 1, index * batch->stride + i, slot);
+			fields[i] = isNumber(vm, slot) ? getWrenNumber(vm, slot) : 0;
+		}
+	}
+
+	return true;
+}
+
+// instances are [index, x, y, flip, rotate]
+static void wren_sprlist(WrenVM* vm)
+{
+	s32 top = wrenGetSlotCount(vm);
+	u8 colors[TIC_PALETTE_SIZE];
+	s32 count = 0;
+	s32 scale = 1;
+	s32 w = 1;
+	s32 h = 1;
+
+	if(top > 2)
+	{
+		count = getWrenColorKey(vm, 2, colors);
+
+		if(top > 3)
+		{
+			scale = getWrenNumber(vm, 3);
+
+			if(top > 5)
+			{
+				w = getWrenNumber(vm, 4);
+				h = getWrenNumber(vm, 5);
+			}
+		}
+	}
+
+	WrenBatch batch;
+
+	if(getWrenBatch(vm, 5, &batch))
+	{
+		tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+		if(!memory) return;
+
+		for(s32 i = 0; i < batch.count; i++)
+		{
+			s32 f[5];
+
+			if(getWrenInstance(vm, &batch, i, f))
+				memory->api.sprite_ex(memory, &memory->ram.gfx, f[0], f[1], f[2], w, h, colors, count, scale, f[3], f[4]);
+		}
+	}
+}
+
+// instances are [x, y, color]
+static void wren_pixlist(WrenVM* vm)
+{
+	WrenBatch batch;
+
+	if(getWrenBatch(vm, 3, &batch))
+	{
+		tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+		if(!memory) return;
+
+		for(s32 i = 0; i < batch.count; i++)
+		{
+			s32 f[3];
+
+			if(getWrenInstance(vm, &batch, i, f))
+				memory->api.pixel(memory, f[0], f[1], f[2]);
+		}
+	}
+}
+
+// instances are [x, y, w, h, color]
+static void wren_rectlist(WrenVM* vm)
+{
+	WrenBatch batch;
+
+	if(getWrenBatch(vm, 5, &batch))
+	{
+		tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+		if(!memory) return;
+
+		for(s32 i = 0; i < batch.count; i++)
+		{
+			s32 f[5];
+
+			if(getWrenInstance(vm, &batch, i, f))
+				memory->api.rect(memory, f[0], f[1], f[2], f[3], f[4]);
+		}
+	}
+}
+
 static void wren_spr_internal(WrenVM* vm) {	
 
 	s32 index = getWrenNumber(vm, 1);
 	s32 x = getWrenNumber(vm, 2);
 	s32 y = getWrenNumber(vm, 3);
 
-	static u8 colors[TIC_PALETTE_SIZE];
+	u8 colors[TIC_PALETTE_SIZE];
 	s32 count = 0;
 
 	if(isList(vm, 4)) {
@@ -509,6 +751,7 @@ static void wren_spr_internal(WrenVM* vm) {
 	s32 rotate = getWrenNumber(vm, 7);
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	memory->api.sprite(memory, &memory->ram.gfx, index, x, y, colors, count, scale, flip, rotate);
 
@@ -556,9 +799,147 @@ static void wren_map(WrenVM* vm)
 	}
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 	memory->api.map(memory, &memory->ram.gfx, x, y, w, h, sx, sy, chromakey, scale);
 }
 
+// list indices are tile indices, an element is the new index or [index, flip, rotate], missing ones stay as they are
+static void getWrenRemapTable(WrenVM* vm, s32 list, RemapResult* table)
+{
+	s32 slot = wrenGetSlotCount(vm);
+	wrenEnsureSlots(vm, slot + 2);
+
+	s32 size = wrenGetListCount(vm, list);
+
+	for(s32 i = 0; i < TIC_REMAP_SIZE; i++)
+	{
+		RemapResult* tile = &table[i];
+
+		tile->index = i;
+		tile->flip = tic_no_flip;
+		tile->rotate = tic_no_rotate;
+
+		if(i >= size)
+			continue;
+
+		wrenGetListElement(vm, list, i, slot);
+
+		if(isList(vm, slot))
+		{
+			s32 fields[3] = {i, tic_no_flip, tic_no_rotate};
+			s32 count = wrenGetListCount(vm, slot);
+
+			for(s32 f = 0; f < COUNT_OF(fields) && f < count; f++)
+			{
+				wrenGetListElement(vm, slot, f, slot + 1);
+
+				if(isNumber(vm, slot + 1))
+					fields[f] = getWrenNumber(vm, slot + 1);
+			}
+
+			tile->index = fields[0];
+			tile->flip = fields[1] & 0b11;
+			tile->rotate = fields[2] & 0b11;
+		}
+		else if(isNumber(vm, slot))
+			tile->index = getWrenNumber(vm, slot);
+	}
+}
+
+static void wren_maptable(WrenVM* vm)
+{
+	s32 x = getWrenNumber(vm, 1);
+	s32 y = getWrenNumber(vm, 2);
+	s32 w = getWrenNumber(vm, 3);
+	s32 h = getWrenNumber(vm, 4);
+	s32 sx = getWrenNumber(vm, 5);
+	s32 sy = getWrenNumber(vm, 6);
+	u8 chromakey = getWrenNumber(vm, 7);
+	s32 scale = getWrenNumber(vm, 8);
+
+	RemapResult table[TIC_REMAP_SIZE];
+	tic_machine* machine = getWrenMachine(vm);
+	if(!machine) return;
+	tic_mem* memory = &machine->memory;
+
+	if(isList(vm, 9))
+		getWrenRemapTable(vm, 9, table);
+	else if(!loadRemapTable(machine, getWrenNumber(vm, 9), table))
+	{
+		wrenSetSlotString(vm, 0, "invalid remap table address");
+		wrenAbortFiber(vm, 0);
+		return;
+	}
+
+	memory->api.remap_table(memory, &memory->ram.gfx, x, y, w, h, sx, sy, chromakey, scale, table);
+}
+
+// hits come as a flat list of x, y, tile with x and y in cells, mask defaults to any flag
+static void wren_mhit(WrenVM* vm)
+{
+	s32 top = wrenGetSlotCount(vm);
+
+	s32 x = getWrenNumber(vm, 1);
+	s32 y = getWrenNumber(vm, 2);
+	s32 w = getWrenNumber(vm, 3);
+	s32 h = getWrenNumber(vm, 4);
+	u8 mask = top > 5 ? getWrenNumber(vm, 5) : 0xff;
+
+	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
+
+	tic_map_hit buffer[TIC_MAP_HITS];
+	tic_map_hit* hits = buffer;
+	s32 count = memory->api.map_hits(memory, &memory->ram.gfx, &memory->ram.flags, x, y, w, h, mask, hits, TIC_MAP_HITS);
+
+	if(count > TIC_MAP_HITS && (hits = malloc(count * sizeof(tic_map_hit))))
+		memory->api.map_hits(memory, &memory->ram.gfx, &memory->ram.flags, x, y, w, h, mask, hits, count);
+	else if(count > TIC_MAP_HITS)
+	{
+		hits = buffer;
+		count = TIC_MAP_HITS;
+	}
+
+	wrenEnsureSlots(vm, 2);
+	wrenSetSlotNewList(vm, 0);
+
+	for(s32 i = 0; i < count; i++)
+	{
+		wrenSetSlotDouble(vm, 1, hits[i].x);
+		wrenInsertInList(vm, 0, -1, 1);
+		wrenSetSlotDouble(vm, 1, hits[i].y);
+		wrenInsertInList(vm, 0, -1, 1);
+		wrenSetSlotDouble(vm, 1, hits[i].index);
+		wrenInsertInList(vm, 0, -1, 1);
+	}
+
+	if(hits != buffer)
+		free(hits);
+}
+
+static void wren_fget(WrenVM* vm)
+{
+	s32 index = getWrenNumber(vm, 1);
+	s32 flag = getWrenNumber(vm, 2);
+
+	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
+
+	wrenSetSlotBool(vm, 0, memory->api.flag_get(memory, &memory->ram.flags, index, flag));
+}
+
+static void wren_fset(WrenVM* vm)
+{
+	s32 index = getWrenNumber(vm, 1);
+	s32 flag = getWrenNumber(vm, 2);
+	bool value = wrenGetSlotBool(vm, 3);
+
+	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
+
+	memory->api.flag_set(memory, &memory->ram.flags, index, flag, value);
+}
+
 static void wren_mset(WrenVM* vm)
 {
 
@@ -567,6 +948,7 @@ static void wren_mset(WrenVM* vm)
 	u8 val = getWrenNumber(vm, 3);
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	memory->api.map_set(memory, &memory->ram.gfx, x, y, val);
 }
@@ -577,6 +959,7 @@ static void wren_mget(WrenVM* vm)
 	s32 y = getWrenNumber(vm, 2);
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	u8 value = memory->api.map_get(memory, &memory->ram.gfx, x, y);
 	wrenSetSlotDouble(vm, 0, value);
@@ -593,8 +976,11 @@ static void wren_textri(WrenVM* vm)
 	}
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 	u8 chroma = 0xff;
 	bool use_map = false;
+	float z[3] = {0};
+	bool depth = false;
 
 	//	check for use map 
 	if (top > 13){
@@ -606,6 +992,18 @@ static void wren_textri(WrenVM* vm)
 		chroma = (u8)getWrenNumber(vm, 14);
 	}
 
+	//	check for depth, passed as [z1, z2, z3] since wren methods take at most 16 arguments
+	if (top > 15 && isList(vm, 15) && wrenGetListCount(vm, 15) >= COUNT_OF(z)){
+		wrenEnsureSlots(vm, 17);
+
+		for (s32 i = 0; i < COUNT_OF(z); i++){
+			wrenGetListElement(vm, 15, i, 16);
+			z[i] = (float)wrenGetSlotDouble(vm, 16);
+		}
+
+		depth = true;
+	}
+
 	memory->api.textri(memory, pt[0], pt[1],	//	xy 1
 								pt[2], pt[3],	//	xy 2
 								pt[4], pt[5],	//  xy 3
@@ -613,7 +1011,8 @@ static void wren_textri(WrenVM* vm)
 								pt[8], pt[9],	//	uv 2
 								pt[10], pt[11], //  uv 3
 								use_map,		// use map
-								chroma);		// chroma
+								chroma,			// chroma
+								z[0], z[1], z[2], depth);
 }
 
 static void wren_pix(WrenVM* vm)
@@ -624,6 +1023,7 @@ static void wren_pix(WrenVM* vm)
 	s32 y = getWrenNumber(vm, 2);
 	
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	if(top > 3)
 	{
@@ -645,6 +1045,7 @@ static void wren_line(WrenVM* vm)
 	s32 color = getWrenNumber(vm, 5);
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	memory->api.line(memory, x0, y0, x1, y1, color);
 }
@@ -661,6 +1062,7 @@ static void wren_circ(WrenVM* vm)
 	s32 color = getWrenNumber(vm, 4);
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	memory->api.circle(memory, x, y, radius, color);
 }
@@ -677,6 +1079,7 @@ static void wren_circb(WrenVM* vm)
 	s32 color = getWrenNumber(vm, 4);
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	memory->api.circle_border(memory, x, y, radius, color);
 }
@@ -690,6 +1093,7 @@ static void wren_rect(WrenVM* vm)
 	s32 color = getWrenNumber(vm, 5);
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	memory->api.rect(memory, x, y, w, h, color);
 }
@@ -703,6 +1107,7 @@ static void wren_rectb(WrenVM* vm)
 	s32 color = getWrenNumber(vm, 5);
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	memory->api.rect_border(memory, x, y, w, h, color);
 }
@@ -718,6 +1123,7 @@ static void wren_tri(WrenVM* vm)
 	s32 color = getWrenNumber(vm, 7);
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	memory->api.tri(memory, pt[0], pt[1], pt[2], pt[3], pt[4], pt[5], color);
 }
@@ -727,6 +1133,7 @@ static void wren_cls(WrenVM* vm)
 	int top = wrenGetSlotCount(vm);
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	memory->api.clear(memory, top == 1 ? 0 : getWrenNumber(vm, 1));
 }
@@ -736,6 +1143,7 @@ static void wren_clip(WrenVM* vm)
 	s32 top = wrenGetSlotCount(vm);
 
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	if(top == 1)
 	{
@@ -755,26 +1163,32 @@ static void wren_clip(WrenVM* vm)
 static void wren_peek(WrenVM* vm)
 {
 	tic_machine* machine = getWrenMachine(vm);
+	if(!machine) return;
 
 	// check number of args
 	s32 address = getWrenNumber(vm, 1);
 
 	if(address >=0 && address < sizeof(tic_ram))
 	{
-		wrenSetSlotDouble(vm, 0, *((u8*)&machine->memory.ram + address));
+		u8* ptr = (u8*)&machine->memory.ram + address;
+		machine->memory.api.observe(&machine->memory, ptr, 1);
+		wrenSetSlotDouble(vm, 0, *ptr);
 	}
 }
 
 static void wren_poke(WrenVM* vm)
 {
 	tic_machine* machine = getWrenMachine(vm);
+	if(!machine) return;
 
 	s32 address = getWrenNumber(vm, 1);
 	u8 value = getWrenNumber(vm, 2) & 0xff;
 
 	if(address >=0 && address < sizeof(tic_ram))
 	{
-		*((u8*)&machine->memory.ram + address) = value;
+		u8* ptr = (u8*)&machine->memory.ram + address;
+		*ptr = value;
+		machine->memory.api.invalidate(&machine->memory, ptr, 1);
 	}
 }
 
@@ -784,7 +1198,11 @@ static void wren_peek4(WrenVM* vm)
 
 	if(address >= 0 && address < sizeof(tic_ram)*2)
 	{
-		wrenSetSlotDouble(vm, 0, tic_tool_peek4((u8*)&getWrenMachine(vm)->memory.ram, address));
+		tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+		if(!memory) return;
+
+		memory->api.observe(memory, (u8*)&memory->ram + (address >> 1), 1);
+		wrenSetSlotDouble(vm, 0, tic_tool_peek4((u8*)&memory->ram, address));
 	}	
 }
 
@@ -795,7 +1213,12 @@ static void wren_poke4(WrenVM* vm)
 
 	if(address >= 0 && address < sizeof(tic_ram)*2)
 	{
-		tic_tool_poke4((u8*)&getWrenMachine(vm)->memory.ram, address, value);
+		tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+		if(!memory) return;
+
+		memory->api.observe(memory, (u8*)&memory->ram + (address >> 1), 1);
+		tic_tool_poke4((u8*)&memory->ram, address, value);
+		memory->api.invalidate(memory, (u8*)&memory->ram + (address >> 1), 1);
 	}
 }
 
@@ -808,8 +1231,12 @@ static void wren_memcpy(WrenVM* vm)
 
 	if(size >= 0 && size <= sizeof(tic_ram) && dest >= 0 && src >= 0 && dest <= bound && src <= bound)
 	{
-		u8* base = (u8*)&getWrenMachine(vm)->memory;
+		tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+		if(!memory) return;
+		u8* base = (u8*)memory;
+		memory->api.observe(memory, base + src, size);
 		memcpy(base + dest, base + src, size);
+		memory->api.invalidate(memory, base + dest, size);
 	}
 }
 
@@ -822,15 +1249,131 @@ static void wren_memset(WrenVM* vm)
 
 	if(size >= 0 && size <= sizeof(tic_ram) && dest >= 0 && dest <= bound)
 	{
-		u8* base = (u8*)&getWrenMachine(vm)->memory;
+		tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+		if(!memory) return;
+		u8* base = (u8*)memory;
 		memset(base + dest, value, size);
+		memory->api.invalidate(memory, base + dest, size);
+	}
+}
+
+static void wren_pemitter(WrenVM* vm)
+{
+	s32 top = wrenGetSlotCount(vm);
+
+	tic_particle_emitter emitter;
+	u8 colors[TIC_PALETTE_SIZE] = {0};
+
+	s32 id = getWrenNumber(vm, 1);
+	emitter.life = getWrenNumber(vm, 2);
+	emitter.speed = (float)wrenGetSlotDouble(vm, 3);
+	emitter.angle = (float)wrenGetSlotDouble(vm, 4);
+	emitter.spread = (float)wrenGetSlotDouble(vm, 5);
+	emitter.gravity = (float)wrenGetSlotDouble(vm, 6);
+	emitter.count = getWrenColorKey(vm, 7, colors);
+	memcpy(emitter.colors, colors, sizeof emitter.colors);
+	emitter.sprite = top > 8 ? getWrenNumber(vm, 8) : -1;
+
+	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
+	memory->api.particle_emitter(memory, id, &emitter);
+}
+
+static void wren_pemit(WrenVM* vm)
+{
+	s32 top = wrenGetSlotCount(vm);
+
+	s32 id = getWrenNumber(vm, 1);
+	s32 x = getWrenNumber(vm, 2);
+	s32 y = getWrenNumber(vm, 3);
+	s32 count = top > 4 ? getWrenNumber(vm, 4) : 1;
+
+	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
+	memory->api.particle_emit(memory, id, x, y, count);
+}
+
+static void wren_pdraw(WrenVM* vm)
+{
+	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
+
+	wrenSetSlotDouble(vm, 0, memory->api.particle_draw(memory));
+}
+
+static void wren_pclear(WrenVM* vm)
+{
+	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
+
+	memory->api.particle_clear(memory);
+}
+
+static void wren_memread(WrenVM* vm)
+{
+	s32 address = getWrenNumber(vm, 1);
+	s32 size = getWrenNumber(vm, 2);
+	s32 bound = sizeof(tic_ram) - size;
+
+	if(size >= 0 && size <= sizeof(tic_ram) && address >= 0 && address <= bound)
+	{
+		tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+		if(!memory) return;
+		u8* ptr = (u8*)&memory->ram + address;
+		memory->api.observe(memory, ptr, size);
+		wrenSetSlotBytes(vm, 0, (const char*)ptr, size);
+	}
+}
+
+// data is a string of bytes or a list of numbers
+static void wren_memwrite(WrenVM* vm)
+{
+	s32 address = getWrenNumber(vm, 1);
+	WrenType type = wrenGetSlotType(vm, 2);
+	const char* data = NULL;
+	s32 size = 0;
+
+	if(type == WREN_TYPE_STRING)
+		data = wrenGetSlotBytes(vm, 2, &size);
+	else if(type == WREN_TYPE_LIST)
+		size = wrenGetListCount(vm, 2);
+	else return;
+
+	s32 bound = sizeof(tic_ram) - size;
+
+	if(size <= sizeof(tic_ram) && address >= 0 && address <= bound)
+	{
+		tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+		if(!memory) return;
+		u8* ptr = (u8*)&memory->ram + address;
+
+		if(data)
+			memcpy(ptr, data, size);
+		else
+		{
+			wrenEnsureSlots(vm, 4);
+
+			for(s32 i = 0; i < size; i++)
+			{
+				wrenGetListElement(vm, 2, i, 3);
+				ptr[i] = getWrenNumber(vm, 3) & 0xff;
+			}
+		}
+
+		memory->api.invalidate(memory, ptr, size);
 	}
 }
 
+static void wren_ram_count(WrenVM* vm)
+{
+	wrenSetSlotDouble(vm, 0, sizeof(tic_ram));
+}
+
 static void wren_pmem(WrenVM* vm)
 {
 	s32 top = wrenGetSlotCount(vm);
 	tic_machine* machine = getWrenMachine(vm);
+	if(!machine) return;
 	tic_mem* memory = &machine->memory;
 
 	u32 index = getWrenNumber(vm, 1);
@@ -851,6 +1394,7 @@ static void wren_sfx(WrenVM* vm)
 	s32 top = wrenGetSlotCount(vm);
 
 	tic_machine* machine = getWrenMachine(vm);
+	if(!machine) return;
 
 	tic_mem* memory = &machine->memory;
 
@@ -930,6 +1474,7 @@ static void wren_music(WrenVM* vm)
 	s32 top = wrenGetSlotCount(vm);
 	
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	s32 track = -1;
 	s32 frame = -1;
@@ -962,6 +1507,7 @@ static void wren_music(WrenVM* vm)
 static void wren_time(WrenVM* vm)
 {
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 	
 	wrenSetSlotDouble(vm, 0, memory->api.time(memory));
 }
@@ -969,6 +1515,7 @@ static void wren_time(WrenVM* vm)
 static void wren_sync(WrenVM* vm)
 {
 	tic_mem* memory = (tic_mem*)getWrenMachine(vm);
+	if(!memory) return;
 
 	memory->api.sync(memory, true);
 }
@@ -976,6 +1523,7 @@ static void wren_sync(WrenVM* vm)
 static void wren_exit(WrenVM* vm)
 {
 	tic_machine* machine = getWrenMachine(vm);
+	if(!machine) return;
 
 	machine->data->exit(machine->data->data);
 }
@@ -1001,6 +1549,10 @@ WrenForeignMethodFn foreignTicMethods(const char* signature){
 	if (strcmp(signature, "static Tic.spr(_,_,_,_,_,_)"	        ) == 0) return wren_spr;
 	if (strcmp(signature, "static Tic.spr(_,_,_,_,_,_,_)"	    ) == 0) return wren_spr;
 	if (strcmp(signature, "static Tic.spr(_,_,_,_,_,_,_,_,_)"	) == 0) return wren_spr;
+	if (strcmp(signature, "static Tic.sprlist(_)"		        ) == 0) return wren_sprlist;
+	if (strcmp(signature, "static Tic.sprlist(_,_)"		        ) == 0) return wren_sprlist;
+	if (strcmp(signature, "static Tic.sprlist(_,_,_)"	        ) == 0) return wren_sprlist;
+	if (strcmp(signature, "static Tic.sprlist(_,_,_,_,_)"	    ) == 0) return wren_sprlist;
 
 	if (strcmp(signature, "static Tic.map(_,_)"	                ) == 0) return wren_map;
 	if (strcmp(signature, "static Tic.map(_,_,_,_)"	            ) == 0) return wren_map;
@@ -1016,6 +1568,7 @@ WrenForeignMethodFn foreignTicMethods(const char* signature){
 	if (strcmp(signature, "static Tic.textri(_,_,_,_,_,_,_,_,_,_,_,_)"	     ) == 0) return wren_textri;
 	if (strcmp(signature, "static Tic.textri(_,_,_,_,_,_,_,_,_,_,_,_,_)"	 ) == 0) return wren_textri;
 	if (strcmp(signature, "static Tic.textri(_,_,_,_,_,_,_,_,_,_,_,_,_,_)"	 ) == 0) return wren_textri;
+	if (strcmp(signature, "static Tic.textri(_,_,_,_,_,_,_,_,_,_,_,_,_,_,_)"	 ) == 0) return wren_textri;
 
 	if (strcmp(signature, "static Tic.pix(_,_)"          		) == 0) return wren_pix;
 	if (strcmp(signature, "static Tic.pix(_,_,_)"        		) == 0) return wren_pix;
@@ -1025,6 +1578,19 @@ WrenForeignMethodFn foreignTicMethods(const char* signature){
 	if (strcmp(signature, "static Tic.rect(_,_,_,_,_)"   		) == 0) return wren_rect;
 	if (strcmp(signature, "static Tic.rectb(_,_,_,_,_)"  		) == 0) return wren_rectb;
 	if (strcmp(signature, "static Tic.tri(_,_,_,_,_,_,_)"		) == 0) return wren_tri;
+	if (strcmp(signature, "static Tic.pixlist(_)"        		) == 0) return wren_pixlist;
+	if (strcmp(signature, "static Tic.rectlist(_)"       		) == 0) return wren_rectlist;
+
+	if (strcmp(signature, "static Tic.pemitter(_,_,_,_,_,_,_)"	) == 0) return wren_pemitter;
+	if (strcmp(signature, "static Tic.pemitter(_,_,_,_,_,_,_,_)") == 0) return wren_pemitter;
+	if (strcmp(signature, "static Tic.pemit(_,_,_)"      		) == 0) return wren_pemit;
+	if (strcmp(signature, "static Tic.pemit(_,_,_,_)"    		) == 0) return wren_pemit;
+	if (strcmp(signature, "static Tic.pdraw()"           		) == 0) return wren_pdraw;
+	if (strcmp(signature, "static Tic.pclear()"          		) == 0) return wren_pclear;
+	if (strcmp(signature, "static Tic.fget(_,_)"          		) == 0) return wren_fget;
+	if (strcmp(signature, "static Tic.fset(_,_,_)"          	) == 0) return wren_fset;
+	if (strcmp(signature, "static Tic.mhit(_,_,_,_)"          	) == 0) return wren_mhit;
+	if (strcmp(signature, "static Tic.mhit(_,_,_,_,_)"          ) == 0) return wren_mhit;
 
 	if (strcmp(signature, "static Tic.cls()"                    ) == 0) return wren_cls;
 	if (strcmp(signature, "static Tic.cls(_)"                   ) == 0) return wren_cls;
@@ -1037,8 +1603,15 @@ WrenForeignMethodFn foreignTicMethods(const char* signature){
 	if (strcmp(signature, "static Tic.poke4(_,_)"   			) == 0) return wren_poke4;
 	if (strcmp(signature, "static Tic.memcpy(_,_,_)"			) == 0) return wren_memcpy;
 	if (strcmp(signature, "static Tic.memset(_,_,_)"			) == 0) return wren_memset;
+	if (strcmp(signature, "static Tic.memread(_,_)"			) == 0) return wren_memread;
+	if (strcmp(signature, "static Tic.memwrite(_,_)"			) == 0) return wren_memwrite;
 	if (strcmp(signature, "static Tic.pmem(_,_)"    			) == 0) return wren_pmem;
 
+	// RAM[addr] takes its arguments in the same slots as peek and poke
+	if (strcmp(signature, "static RAM.[_]"          			) == 0) return wren_peek;
+	if (strcmp(signature, "static RAM.[_]=(_)"      			) == 0) return wren_poke;
+	if (strcmp(signature, "static RAM.count"        			) == 0) return wren_ram_count;
+
 	if (strcmp(signature, "static Tic.sfx(_)"    		        ) == 0) return wren_sfx;
 	if (strcmp(signature, "static Tic.sfx(_,_)"    		        ) == 0) return wren_sfx;
 	if (strcmp(signature, "static Tic.sfx(_,_,_)"    		    ) == 0) return wren_sfx;
@@ -1062,6 +1635,7 @@ WrenForeignMethodFn foreignTicMethods(const char* signature){
 	if (strcmp(signature, "static Tic.trace__(_,_)"             ) == 0) return wren_trace;
 	if (strcmp(signature, "static Tic.spr__(_,_,_,_,_,_,_)"	    ) == 0) return wren_spr_internal;
 	if (strcmp(signature, "static Tic.mgeti__(_)"                 ) == 0) return wren_mgeti;
+	if (strcmp(signature, "static Tic.maptable__(_,_,_,_,_,_,_,_,_)") == 0) return wren_maptable;
 
 	return NULL;
 }
@@ -1104,7 +1678,7 @@ static void initAPI(tic_machine* machine)
 
 static void reportError(WrenVM* vm, WrenErrorType type, const char* module, int line, const char* message)
 {
-	tic_machine* machine = getWrenMachine(vm);
+	tic_machine* machine = wrenGetUserData(vm);
 
 	char buffer[1024];
 
@@ -1120,7 +1694,7 @@ static void reportError(WrenVM* vm, WrenErrorType type, const char* module, int
 
 void writeFn(WrenVM* vm, const char* text) 
 {
-	tic_machine* machine = getWrenMachine(vm);
+	tic_machine* machine = wrenGetUserData(vm);
 	u8 color = tic_color_blue;
 	machine->data->trace(machine->data->data, text ? text : "null", color);
 }
@@ -1136,6 +1710,9 @@ bool initWren(tic_machine* machine, const char* code)
 
 	config.errorFn = reportError;
 	config.writeFn = writeFn;
+	config.reallocateFn = reallocWren;
+
+	WrenHeap = &machine->heap;
 
 	WrenVM* vm = machine->wren = wrenNewVM(&config);
 
@@ -1145,25 +1722,25 @@ bool initWren(tic_machine* machine, const char* code)
 		return false;
 	}
 
-	loaded = true;
+	machine->wrenGame.loaded = true;
 
 	// make handles
 	wrenEnsureSlots(vm, 1);
 	wrenGetVariable(vm, "main", "Game", 0);
-	game_class = wrenGetSlotHandle(vm, 0); // handle from game class 
+	machine->wrenGame.gameClass = wrenGetSlotHandle(vm, 0); // handle from game class 
 
-	new_handle = wrenMakeCallHandle(vm, "new()");
-	update_handle = wrenMakeCallHandle(vm, "update()");
-	scanline_handle = wrenMakeCallHandle(vm, "scanline(_)");
+	machine->wrenGame.newHandle = wrenMakeCallHandle(vm, "new()");
+	machine->wrenGame.updateHandle = wrenMakeCallHandle(vm, "update()");
+	machine->wrenGame.scanlineHandle = wrenMakeCallHandle(vm, "scanline(_)");
 
 	// create game class
-	if (game_class)
+	if (machine->wrenGame.gameClass)
 	{
 		wrenEnsureSlots(vm, 1);
-		wrenSetSlotHandle(vm, 0, game_class);
-		wrenCall(vm, new_handle);
-		wrenReleaseHandle(machine->wren, game_class); // release game class handle
-		game_class = wrenGetSlotHandle(vm, 0); // handle from game object 
+		wrenSetSlotHandle(vm, 0, machine->wrenGame.gameClass);
+		wrenCall(vm, machine->wrenGame.newHandle);
+		wrenReleaseHandle(machine->wren, machine->wrenGame.gameClass); // release game class handle
+		machine->wrenGame.gameClass = wrenGetSlotHandle(vm, 0); // handle from game object 
 	} else {
 		machine->data->error(machine->data->data, "'Game class' isn't found :(");	
 		return false;
@@ -1176,11 +1753,13 @@ void callWrenTick(tic_machine* machine)
 {
 	WrenVM* vm = machine->wren;
 
-	if(vm && game_class)
+	if(vm && machine->wrenGame.gameClass)
 	{
+		WrenHeap = &machine->heap;
+
 		wrenEnsureSlots(vm, 1);
-		wrenSetSlotHandle(vm, 0, game_class);
-		wrenCall(vm, update_handle);
+		wrenSetSlotHandle(vm, 0, machine->wrenGame.gameClass);
+		wrenCall(vm, machine->wrenGame.updateHandle);
 	}
 }
 
@@ -1189,11 +1768,18 @@ void callWrenScanline(tic_mem* memory, s32 row)
 	tic_machine* machine = (tic_machine*)memory;
 	WrenVM* vm = machine->wren;
 
-	if(vm && game_class)
+	// Game inherits an empty scanline(row) from TIC, so there is no way to tell it is unused
+	machine->scanlineCall.defined = true;
+
+	if(vm && machine->wrenGame.gameClass)
 	{
+		WrenHeap = &machine->heap;
+
 		wrenEnsureSlots(vm, 2);
-		wrenSetSlotHandle(vm, 0, game_class);
+		wrenSetSlotHandle(vm, 0, machine->wrenGame.gameClass);
 		wrenSetSlotDouble(vm, 1, row);
-		wrenCall(vm, scanline_handle);
+		wrenCall(vm, machine->wrenGame.scanlineHandle);
 	}
 }
+
+#endif
@@ -0,0 +1,164 @@
+// MIT License
+
+// Copyright (c) 2017 Vadim Grigoruk @nesbox // grigoruk@gmail.com
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Sound synthesis speed: tick_start + tick_end with no script, reported as
+// seconds of audio synthesized per second of cpu. The sound comes from
+// demos/music.tic, or the cart given on the command line.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ticapi.h"
+
+#define SAMPLERATE 44100
+#define ROUNDS 3
+
+typedef enum
+{
+	PlaySilence,
+	PlaySfx,
+	PlayMusic,
+} Play;
+
+typedef struct
+{
+	const char* name;
+	Play play;
+	s32 seconds;
+} Bench;
+
+static const Bench Benches[] =
+{
+	{"silence", PlaySilence, 60},
+	{"4 sfx", PlaySfx, 60},
+	{"4 sfx", PlaySfx, 600},
+	{"music", PlayMusic, 60},
+	{"music", PlayMusic, 600},
+};
+
+static double getTime()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+static void* readFile(const char* path, s32* size)
+{
+	FILE* file = fopen(path, "rb");
+	void* buffer = NULL;
+
+	if(file)
+	{
+		fseek(file, 0, SEEK_END);
+		*size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		if(*size > 0 && (buffer = malloc(*size)))
+			if(fread(buffer, *size, 1, file) != 1)
+			{
+				free(buffer);
+				buffer = NULL;
+			}
+
+		fclose(file);
+	}
+
+	return buffer;
+}
+
+// cpu seconds for the whole run
+static double run(const Bench* bench, const void* cart, s32 size)
+{
+	tic_mem* memory = tic_create(SAMPLERATE);
+
+	memory->api.load(&memory->cart, cart, size, true);
+	memcpy(&memory->ram.sound, &memory->cart.sound, sizeof(tic_sound));
+
+	s32 frames = bench->seconds * TIC_FRAMERATE;
+	double start = getTime();
+
+	for(s32 frame = 0; frame < frames; frame++)
+	{
+		memory->api.tick_start(memory, &memory->ram.sound);
+
+		if(frame == 0)
+		{
+			if(bench->play == PlaySfx)
+				for(s32 channel = 0; channel < TIC_SOUND_CHANNELS; channel++)
+				{
+					const tic_sound_effect* effect = &memory->ram.sound.sfx.data[channel];
+					memory->api.sfx(memory, channel, effect->note, effect->octave, -1, channel);
+				}
+			else if(bench->play == PlayMusic)
+				memory->api.music(memory, 0, -1, -1, true);
+		}
+
+		memory->api.tick_end(memory);
+	}
+
+	double time = getTime() - start;
+
+	tic_close(memory);
+
+	return time;
+}
+
+int main(int argc, char** argv)
+{
+	const char* path = argc > 1 ? argv[1] : "../demos/music.tic";
+
+	s32 size = 0;
+	void* cart = readFile(path, &size);
+
+	if(!cart)
+	{
+		printf("bench_audio: can't read %s\n", path);
+		return 1;
+	}
+
+	printf("%-8s %8s %12s %12s\n", "", "audio s", "us/frame", "x realtime");
+
+	for(s32 i = 0; i < COUNT_OF(Benches); i++)
+	{
+		const Bench* bench = &Benches[i];
+		double best = 0;
+
+		for(s32 round = 0; round < ROUNDS; round++)
+		{
+			double time = run(bench, cart, size);
+
+			if(round == 0 || time < best)
+				best = time;
+		}
+
+		printf("%-8s %8i %12.2f %12.0f\n", bench->name, bench->seconds,
+			best * 1e6 / (bench->seconds * TIC_FRAMERATE), bench->seconds / best);
+	}
+
+	free(cart);
+
+	return 0;
+}
@@ -0,0 +1,155 @@
+// MIT License
+
+// Copyright (c) 2017 Vadim Grigoruk @nesbox // grigoruk@gmail.com
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Fill throughput of cls, rect and rectb on the packed 4bpp screen, in
+// pixels per second. 'pix' fills the same rects a pixel at a time with
+// clipping on every pixel, which is what rect used to cost.
+
+#include <stdio.h>
+#include <time.h>
+
+#include "ticapi.h"
+
+#define ROUNDS 5
+#define MIN_TIME 0.2
+
+typedef struct
+{
+	const char* name;
+	void(*fill)(tic_mem* memory, s32 index);
+	s64 pixels; // per call
+} Bench;
+
+static double getTime()
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+// every other rect starts and ends on half bytes
+static void getRect(s32 index, s32* x, s32* y, s32* w, s32* h)
+{
+	*x = index & 1;
+	*y = 0;
+	*w = TIC80_WIDTH - 1;
+	*h = TIC80_HEIGHT;
+}
+
+static void fillPix(tic_mem* memory, s32 index)
+{
+	s32 x, y, w, h;
+	getRect(index, &x, &y, &w, &h);
+
+	for(s32 j = y; j < y + h; j++)
+		for(s32 i = x; i < x + w; i++)
+			memory->api.pixel(memory, i, j, index);
+}
+
+static void fillRect(tic_mem* memory, s32 index)
+{
+	s32 x, y, w, h;
+	getRect(index, &x, &y, &w, &h);
+
+	memory->api.rect(memory, x, y, w, h, index);
+}
+
+static void fillRectBorder(tic_mem* memory, s32 index)
+{
+	for(s32 i = 0; i < TIC80_HEIGHT / 2; i++)
+		memory->api.rect_border(memory, i, i, TIC80_WIDTH - i * 2, TIC80_HEIGHT - i * 2, index);
+}
+
+static void fillCls(tic_mem* memory, s32 index)
+{
+	memory->api.clear(memory, index);
+}
+
+static void fillClippedCls(tic_mem* memory, s32 index)
+{
+	memory->api.clip(memory, 1, 1, TIC80_WIDTH - 3, TIC80_HEIGHT - 2);
+	memory->api.clear(memory, index);
+	memory->api.clip(memory, 0, 0, TIC80_WIDTH, TIC80_HEIGHT);
+}
+
+// calls per second, best of a few rounds
+static double run(tic_mem* memory, const Bench* bench)
+{
+	double best = 0;
+
+	for(s32 round = 0; round < ROUNDS; round++)
+	{
+		s32 calls = 0;
+		double start = getTime(), time = 0;
+
+		do
+		{
+			for(s32 i = 0; i < 16; i++)
+				bench->fill(memory, calls++);
+
+			time = getTime() - start;
+		}
+		while(time < MIN_TIME);
+
+		if(calls / time > best)
+			best = calls / time;
+	}
+
+	return best;
+}
+
+int main(int argc, char** argv)
+{
+	tic_mem* memory = tic_create(44100);
+
+	enum {Screen = TIC80_WIDTH * TIC80_HEIGHT};
+
+	s64 rectPixels = (TIC80_WIDTH - 1) * TIC80_HEIGHT;
+	s64 borderPixels = 0;
+
+	for(s32 i = 0; i < TIC80_HEIGHT / 2; i++)
+		borderPixels += 2 * (TIC80_WIDTH - i * 2) + 2 * (TIC80_HEIGHT - i * 2) - 4;
+
+	const Bench benches[] =
+	{
+		{"pix", fillPix, rectPixels},
+		{"rect", fillRect, rectPixels},
+		{"rectb", fillRectBorder, borderPixels},
+		{"cls", fillCls, Screen},
+		{"cls clipped", fillClippedCls, (TIC80_WIDTH - 3) * (TIC80_HEIGHT - 2)},
+	};
+
+	printf("%-12s %12s %12s\n", "", "calls/s", "Mpixels/s");
+
+	for(s32 i = 0; i < COUNT_OF(benches); i++)
+	{
+		const Bench* bench = &benches[i];
+		double calls = run(memory, bench);
+
+		printf("%-12s %12.0f %12.1f\n", bench->name, calls, calls * bench->pixels / 1e6);
+	}
+
+	tic_close(memory);
+
+	return 0;
+}
@@ -0,0 +1,248 @@
+// MIT License
+
+// Copyright (c) 2017 Vadim Grigoruk @nesbox // grigoruk@gmail.com
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Precompiled code chunks: a cart saved with a key runs from its bytecode only
+// where the same key is trusted, and a chunk with a changed byte, a changed
+// source or another key is dropped. Either way the cart draws the same and
+// stops with the same error as when it's compiled from the source.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "machine.h"
+
+#define FRAMES 10
+
+static const char* Scripts[] =
+{
+	"-- script: lua\n"
+	"t=0\n"
+	"function TIC()\n"
+	" cls(t%16)\n"
+	" circ(120,68,t,t%15+1)\n"
+	" t=t+1\n"
+	" if t==8 then error('boom') end\n"
+	"end\n",
+
+	"// script: js\n"
+	"var t=0;\n"
+	"function TIC(){\n"
+	" cls(t%16);\n"
+	" circ(120,68,t,t%15+1);\n"
+	" t++;\n"
+	" if(t==8) throw 'boom';\n"
+	"}\n",
+
+	"-- script: moon\n"
+	"export t=0\n"
+	"export TIC=->\n"
+	" cls t%16\n"
+	" circ 120,68,t,t%15+1\n"
+	" t+=1\n"
+	" error 'boom' if t==8\n",
+};
+
+static const u8 Key[TIC_BINARY_KEY_SIZE] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+static const u8 OtherKey[TIC_BINARY_KEY_SIZE] = {16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1};
+
+typedef struct
+{
+	char error[1024];
+	u64 screen;
+	bool binary; // ran from the chunk
+} Result;
+
+static void onTrace(void* data, const char* text, u8 color) {}
+static void onExit(void* data) {}
+static u64 getCounter(void* data) {return 0;}
+static u64 getFreq(void* data) {return 1000;}
+
+static void onError(void* data, const char* info)
+{
+	Result* result = (Result*)data;
+
+	if(!strlen(result->error))
+		snprintf(result->error, sizeof result->error, "%s", info);
+}
+
+static u64 hashScreen(u64 hash, tic_mem* memory)
+{
+	for(s32 y = 0; y < TIC80_HEIGHT; y++)
+		for(s32 x = 0; x < TIC80_WIDTH; x++)
+			hash = (hash ^ memory->api.get_pixel(memory, x, y)) * 1099511628211ULL;
+
+	return hash;
+}
+
+// the code chunk, followed by the binary chunk when the key signs one
+static u8* saveCart(const char* code, const u8* key, s32* size)
+{
+	tic_mem* memory = tic_create(44100);
+
+	memory->api.trust_binary(memory, key);
+	strcpy(memory->cart.code.data, code);
+	memory->api.compile(memory);
+
+	u8* buffer = malloc(sizeof(tic_cartridge) + memory->api.save_binary(memory, NULL));
+
+	*size = memory->api.save(&memory->cart, buffer);
+	*size += memory->api.save_binary(memory, buffer + *size);
+
+	tic_close(memory);
+
+	return buffer;
+}
+
+static Result runCart(const u8* cart, s32 size, const u8* key)
+{
+	Result result = {.screen = 14695981039346656037ULL};
+	tic_mem* memory = tic_create(44100);
+
+	tic_tick_data data =
+	{
+		.trace = onTrace,
+		.error = onError,
+		.exit = onExit,
+		.counter = getCounter,
+		.freq = getFreq,
+		.data = &result,
+	};
+
+	if(key)
+		memory->api.trust_binary(memory, key);
+
+	memory->api.load(&memory->cart, cart, size, true);
+	memory->api.load_binary(memory, cart, size);
+	memory->api.reset(memory);
+
+	result.binary = ((tic_machine*)memory)->binary.chunk.size > 0;
+
+	for(s32 frame = 0; frame < FRAMES && !strlen(result.error); frame++)
+	{
+		memory->api.tick_start(memory, &memory->ram.sound);
+		memory->api.tick(memory, &data);
+		memory->api.tick_end(memory);
+
+		result.screen = hashScreen(result.screen, memory);
+	}
+
+	tic_close(memory);
+
+	return result;
+}
+
+static bool check(const char* name, const Result* source, const Result* result, bool binary)
+{
+	if(result->binary != binary)
+	{
+		printf("test_binary: %s %s the bytecode\n", name, binary ? "didn't run" : "ran");
+		return false;
+	}
+
+	if(result->screen != source->screen || strcmp(result->error, source->error))
+	{
+		printf("test_binary: %s differs from the source, error '%s' vs '%s'\n", name, result->error, source->error);
+		return false;
+	}
+
+	return true;
+}
+
+// the offset of the first byte of a chunk's data
+static s32 findChunk(const u8* cart, s32 size, u8 type)
+{
+	for(s32 offset = 0; offset < size; offset += 4 + (cart[offset + 1] | cart[offset + 2] << 8 | cart[offset + 3] << 16))
+		if(cart[offset] == type)
+			return offset + 4;
+
+	return -1;
+}
+
+static bool testScript(const char* code)
+{
+	const char* lang = code + 11;
+	s32 size = 0, unsignedSize = 0;
+	u8* cart = saveCart(code, Key, &size);
+	u8* unsignedCart = saveCart(code, NULL, &unsignedSize);
+
+	enum {CHUNK_CODE = 5, CHUNK_BINARY = 15};
+	s32 binary = findChunk(cart, size, CHUNK_BINARY);
+	s32 source = findChunk(cart, size, CHUNK_CODE);
+
+	bool ok = binary > 0 && findChunk(unsignedCart, unsignedSize, CHUNK_BINARY) < 0;
+
+	if(!ok)
+		printf("test_binary: %.4s cart saved without a key has a binary chunk, or with one has none\n", lang);
+
+	Result reference = runCart(unsignedCart, unsignedSize, NULL);
+
+	if(ok && !strlen(reference.error))
+	{
+		printf("test_binary: %.4s cart didn't stop with an error\n", lang);
+		ok = false;
+	}
+
+	Result signedRun = runCart(cart, size, Key);
+	ok = ok && check("signed", &reference, &signedRun, true);
+
+	Result untrusted = runCart(cart, size, NULL);
+	ok = ok && check("untrusted", &reference, &untrusted, false);
+
+	Result other = runCart(cart, size, OtherKey);
+	ok = ok && check("other key", &reference, &other, false);
+
+	cart[size - 1] ^= 1;
+	Result bytecode = runCart(cart, size, Key);
+	ok = ok && check("changed bytecode", &reference, &bytecode, false);
+	cart[size - 1] ^= 1;
+
+	cart[binary + sizeof(u64)] ^= 1;
+	Result signature = runCart(cart, size, Key);
+	ok = ok && check("changed signature", &reference, &signature, false);
+	cart[binary + sizeof(u64)] ^= 1;
+
+	// a space for the last new line, the code still runs the same
+	cart[source + strlen(code) - 1] = ' ';
+	Result changed = runCart(cart, size, Key);
+	ok = ok && check("changed source", &reference, &changed, false);
+
+	if(!ok)
+		printf("test_binary: %.4s cart failed\n", lang);
+
+	free(cart);
+	free(unsignedCart);
+
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	bool ok = true;
+
+	for(s32 i = 0; i < COUNT_OF(Scripts); i++)
+		ok = testScript(Scripts[i]) && ok;
+
+	printf("test_binary: %s\n", ok ? "ok" : "FAILED");
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+// MIT License
+
+// Copyright (c) 2017 Vadim Grigoruk @nesbox // grigoruk@gmail.com
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Carts that never return from TIC() stop on their first frame with the cpu
+// budget error, in every language. Wren can only be stopped when it calls the
+// API, so its cart loops on one, and the call that goes over must not draw.
+// Without a prebuilt Wren library only the Lua and JS carts run.
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "ticapi.h"
+
+#define BUDGET_MS 50
+
+typedef struct
+{
+	const char* name;
+	const char* code;
+	tic_cpu_budget budget;
+} Cart;
+
+static const Cart Carts[] =
+{
+	{
+		"lua instructions",
+		"-- script: lua\n"
+		"function TIC()\n"
+		" while true do end\n"
+		"end\n",
+		{.instructions = 1000000},
+	},
+
+	{
+		"lua ms",
+		"-- script: lua\n"
+		"function TIC()\n"
+		" local t={}\n"
+		" while true do t[#t%100+1]=1 end\n"
+		"end\n",
+		{.ms = BUDGET_MS},
+	},
+
+	{
+		"js instructions",
+		"// script: js\n"
+		"function TIC(){\n"
+		" for(;;){}\n"
+		"}\n",
+		{.instructions = 1000000},
+	},
+
+	{
+		"js ms",
+		"// script: js\n"
+		"function TIC(){\n"
+		" for(;;){try{throw 1}catch(e){}}\n"
+		"}\n",
+		{.ms = BUDGET_MS},
+	},
+
+#if !defined(TIC80_NO_WREN)
+	// calls are counted from 0 and the budget is checked on every 64th, so
+	// it's always pix(0,0,1) that goes over and it must not draw
+	{
+		"wren ms",
+		"// script: wren\n"
+		"class Game is Engine {\n"
+		" construct new(){}\n"
+		" update(){\n"
+		"  while(true){\n"
+		"   Tic.pix(0,0,0)\n"
+		"   Tic.pix(0,0,1)\n"
+		"  }\n"
+		" }\n"
+		"}\n",
+		{.ms = BUDGET_MS},
+	},
+#endif
+};
+
+static void onTrace(void* data, const char* text, u8 color) {}
+static void onExit(void* data) {}
+
+static void onError(void* data, const char* info)
+{
+	char* error = (char*)data;
+
+	if(!strlen(error))
+		snprintf(error, 1024, "%s", info);
+}
+
+static u64 getCounter(void* data)
+{
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+
+	return (u64)time.tv_sec * 1000000 + time.tv_nsec / 1000;
+}
+
+static u64 getFreq(void* data)
+{
+	return 1000000;
+}
+
+static bool testCart(const Cart* cart)
+{
+	char error[1024] = "";
+	tic_mem* memory = tic_create(44100);
+
+	tic_tick_data data =
+	{
+		.trace = onTrace,
+		.error = onError,
+		.exit = onExit,
+		.counter = getCounter,
+		.freq = getFreq,
+		.data = error,
+	};
+
+	strcpy(memory->cart.code.data, cart->code);
+	memory->api.cpu_budget(memory, cart->budget);
+	memory->api.reset(memory);
+
+	memory->api.tick_start(memory, &memory->ram.sound);
+	memory->api.tick(memory, &data);
+	memory->api.tick_end(memory);
+
+	bool ok = strstr(error, "cpu budget") != NULL;
+
+	if(!ok)
+		printf("test_budget: %s cart stopped with '%s'\n", cart->name, error);
+	else if(memory->api.get_pixel(memory, 0, 0) != 0)
+	{
+		printf("test_budget: %s cart drew after it went over the budget\n", cart->name);
+		ok = false;
+	}
+
+	tic_close(memory);
+
+	return ok;
+}
+
+int main(int argc, char** argv)
+{
+	bool ok = true;
+
+	for(s32 i = 0; i < COUNT_OF(Carts); i++)
+		ok = testCart(&Carts[i]) && ok;
+
+	printf("test_budget: %i hanging carts%s\n", (s32)COUNT_OF(Carts),
+#if defined(TIC80_NO_WREN)
+		", no Wren in this build"
+#else
+		""
+#endif
+	);
+	printf("test_budget: %s\n", ok ? "ok" : "FAILED");
+
+	return ok ? 0 : 1;
+}
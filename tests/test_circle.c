@@ -0,0 +1,214 @@
+// MIT License
+
+// Copyright (c) 2017 Vadim Grigoruk @nesbox // grigoruk@gmail.com
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// circ and circb against a plain Bresenham walk over the whole radius,
+// including huge circles that only cross the clip rect. The time the huge
+// ones take is printed, it should be about that of their visible rows
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "ticapi.h"
+
+#define HUGE_RADIUS 50000000
+#define HUGE_CALLS 1000
+
+typedef struct
+{
+	s32 l, t, r, b;
+} Rect;
+
+static u8 Expected[TIC80_HEIGHT][TIC80_WIDTH];
+
+static u32 Seed = 1;
+
+static u32 rnd()
+{
+	Seed ^= Seed << 13;
+	Seed ^= Seed >> 17;
+	Seed ^= Seed << 5;
+	return Seed;
+}
+
+static void plot(const Rect* clip, s64 x, s64 y, u8 color)
+{
+	if(x >= clip->l && x < clip->r && y >= clip->t && y < clip->b)
+		Expected[y][x] = color;
+}
+
+// the walk circb used to do, with 64 bit error so it works for any radius
+static void drawBorder(const Rect* clip, s64 xm, s64 ym, s64 r, u8 color)
+{
+	s64 x = -r, y = 0, err = 2-2*r;
+	do
+	{
+		plot(clip, xm-x, ym+y, color);
+		plot(clip, xm-y, ym-x, color);
+		plot(clip, xm+x, ym-y, color);
+		plot(clip, xm+y, ym+x, color);
+
+		s64 e = err;
+		if (e <= y) err += ++y*2+1;
+		if (e > x || err > y) err += ++x*2+1;
+	} while (x < 0);
+}
+
+static void side(s64* left, s64* right, s64 x, s64 y)
+{
+	if(y >= 0 && y < TIC80_HEIGHT)
+	{
+		if(x < left[y]) left[y] = x;
+		if(x > right[y]) right[y] = x;
+	}
+}
+
+// circ fills every row between the leftmost and rightmost pixel of the walk
+static void drawFilled(const Rect* clip, s64 xm, s64 ym, s64 r, u8 color)
+{
+	s64 left[TIC80_HEIGHT], right[TIC80_HEIGHT];
+
+	for(s32 i = 0; i < TIC80_HEIGHT; i++)
+		left[i] = INT64_MAX, right[i] = INT64_MIN;
+
+	s64 x = -r, y = 0, err = 2-2*r;
+	do
+	{
+		side(left, right, xm-x, ym+y);
+		side(left, right, xm-y, ym-x);
+		side(left, right, xm+x, ym-y);
+		side(left, right, xm+y, ym+x);
+
+		s64 e = err;
+		if (e <= y) err += ++y*2+1;
+		if (e > x || err > y) err += ++x*2+1;
+	} while (x < 0);
+
+	for(s32 j = 0; j < TIC80_HEIGHT; j++)
+		for(s64 i = left[j] < 0 ? 0 : left[j]; i <= right[j] && i < TIC80_WIDTH; i++)
+			plot(clip, i, j, color);
+}
+
+static bool check(tic_mem* memory, const char* name, s32 xm, s32 ym, s32 radius)
+{
+	for(s32 y = 0; y < TIC80_HEIGHT; y++)
+		for(s32 x = 0; x < TIC80_WIDTH; x++)
+			if(memory->api.get_pixel(memory, x, y) != Expected[y][x])
+			{
+				printf("test_circle: %s(%i, %i, %i) differs at %i,%i\n", name, xm, ym, radius, x, y);
+				return false;
+			}
+
+	return true;
+}
+
+static bool testCircle(tic_mem* memory, const Rect* clip, s32 xm, s32 ym, s32 radius, bool filled)
+{
+	u8 color = 1 + rnd() % 15;
+
+	memory->api.clear(memory, 0);
+	memory->api.clip(memory, clip->l, clip->t, clip->r - clip->l, clip->b - clip->t);
+	memset(Expected, 0, sizeof Expected);
+
+	if(filled)
+	{
+		memory->api.circle(memory, xm, ym, radius, color);
+		drawFilled(clip, xm, ym, radius, color);
+	}
+	else
+	{
+		memory->api.circle_border(memory, xm, ym, radius, color);
+		drawBorder(clip, xm, ym, radius, color);
+	}
+
+	return check(memory, filled ? "circ" : "circb", xm, ym, radius);
+}
+
+static double getTime()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+int main(int argc, char** argv)
+{
+	tic_mem* memory = tic_create(44100);
+	const Rect screen = {0, 0, TIC80_WIDTH, TIC80_HEIGHT};
+
+	bool ok = true;
+
+	for(s32 i = 0; i < 20000 && ok; i++)
+	{
+		s32 radius = i < 2000 ? i / 4 : i % 10 ? rnd() % 300 : rnd() % 100000;
+		s32 xm = (s32)(rnd() % (TIC80_WIDTH + 2 * radius + 20)) - radius - 10;
+		s32 ym = (s32)(rnd() % (TIC80_HEIGHT + 2 * radius + 20)) - radius - 10;
+
+		Rect clip = screen;
+
+		if(i % 3 == 0)
+		{
+			clip.l = rnd() % TIC80_WIDTH;
+			clip.t = rnd() % TIC80_HEIGHT;
+			clip.r = clip.l + 1 + rnd() % (TIC80_WIDTH - clip.l);
+			clip.b = clip.t + 1 + rnd() % (TIC80_HEIGHT - clip.t);
+		}
+
+		ok = testCircle(memory, &clip, xm, ym, radius, i & 1);
+	}
+
+	// the top of a huge circle showing at the bottom of the screen, the
+	// edges of one crossing the screen sideways and one just off screen
+	static const s32 Huge[][2] =
+	{
+		{TIC80_WIDTH / 2, HUGE_RADIUS + 68},
+		{TIC80_WIDTH / 2, -HUGE_RADIUS + 100},
+		{HUGE_RADIUS + 200, TIC80_HEIGHT / 2},
+		{-HUGE_RADIUS + 20, 40},
+		{TIC80_WIDTH / 2, HUGE_RADIUS + TIC80_HEIGHT},
+	};
+
+	for(s32 i = 0; i < COUNT_OF(Huge) && ok; i++)
+		ok = testCircle(memory, &screen, Huge[i][0], Huge[i][1], HUGE_RADIUS, true)
+			&& testCircle(memory, &screen, Huge[i][0], Huge[i][1], HUGE_RADIUS, false);
+
+	if(ok)
+	{
+		double start = getTime();
+
+		for(s32 i = 0; i < HUGE_CALLS; i++)
+		{
+			memory->api.circle(memory, Huge[0][0], Huge[0][1], HUGE_RADIUS, 3);
+			memory->api.circle_border(memory, Huge[0][0], Huge[0][1], HUGE_RADIUS, 4);
+		}
+
+		double time = getTime() - start;
+
+		printf("test_circle: %i huge circ+circb pairs in %.2f ms\n", HUGE_CALLS, time);
+	}
+
+	tic_close(memory);
+
+	printf("test_circle: %s\n", ok ? "ok" : "FAILED");
+
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,305 @@
+// MIT License
+
+// Copyright (c) 2017 Vadim Grigoruk @nesbox // grigoruk@gmail.com
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// Many tic80 instances in one process: every demo cart is ticked alone to get
+// its screen and sound hashes, then copies of all of them are ticked at once,
+// interleaved frame by frame on each of several threads. Any state shared
+// between instances shows up as a different hash.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <tic80.h>
+#include "ticapi.h"
+
+#define FRAMES 300
+#define THREADS 8
+#define COPIES 4
+
+// carts that don't use math.random, Lua takes it from the process-wide rand()
+static const char* Carts[] =
+{
+	"font.tic",
+	"jsdemo.tic",
+	"luademo.tic",
+	"moondemo.tic",
+	"music.tic",
+	"p3d.tic",
+	"palette.tic",
+	"sfx.tic",
+	"wrendemo.tic",
+};
+
+// time() counts ticks of its own instance, tri and textri share the span
+// buffer of the rasterizer
+static const char* Scripts[] =
+{
+	"-- script: lua\n"
+	"t=0\n"
+	"function TIC()\n"
+	" cls(t%16)\n"
+	" local ms=time()\n"
+	" for i=0,7 do\n"
+	"  local a=ms/500+i\n"
+	"  circ(120+math.cos(a)*60,68+math.sin(a)*40,6+i,i+1)\n"
+	"  tri(i*30,0,240,i*17,i*20,136,i+8)\n"
+	"  textri(0,i*8,120,a*10,60,136,0,0,64,0,32,64)\n"
+	" end\n"
+	" print(ms,4,4)\n"
+	" t=t+1\n"
+	"end\n",
+
+	"// script: js\n"
+	"var t=0;\n"
+	"function TIC(){\n"
+	" cls(t%16);\n"
+	" var ms=time();\n"
+	" for(var i=0;i<8;i++){\n"
+	"  var a=ms/500+i;\n"
+	"  circ(120+Math.cos(a)*60,68+Math.sin(a)*40,6+i,i+1);\n"
+	"  tri(i*30,0,240,i*17,i*20,136,i+8);\n"
+	"  textri(0,i*8,120,a*10,60,136,0,0,64,0,32,64);\n"
+	" }\n"
+	" print(ms,4,4);\n"
+	" t++;\n"
+	"}\n",
+};
+
+typedef struct
+{
+	const char* name;
+	void* data;
+	s32 size;
+	u64 screen;
+	u64 sound;
+} Cart;
+
+typedef struct
+{
+	const Cart* cart;
+	tic80* tic;
+	u64 screen;
+	u64 sound;
+} Instance;
+
+typedef struct
+{
+	Instance* instances;
+	s32 count;
+	pthread_t thread;
+} Worker;
+
+enum {CartsCount = COUNT_OF(Carts) + COUNT_OF(Scripts)};
+
+static Cart Loaded[CartsCount];
+
+static void onTrace(const char* text, u8 color) {}
+static void onError(const char* info) {}
+static void onExit() {}
+
+static u64 hashData(u64 hash, const void* data, s32 size)
+{
+	const u8* ptr = (const u8*)data;
+
+	for(s32 i = 0; i < size; i++)
+	{
+		hash ^= ptr[i];
+		hash *= 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+static void* readFile(const char* path, s32* size)
+{
+	FILE* file = fopen(path, "rb");
+	void* buffer = NULL;
+
+	if(file)
+	{
+		fseek(file, 0, SEEK_END);
+		*size = ftell(file);
+		fseek(file, 0, SEEK_SET);
+
+		if(*size > 0 && (buffer = malloc(*size)))
+			if(fread(buffer, *size, 1, file) != 1)
+			{
+				free(buffer);
+				buffer = NULL;
+			}
+
+		fclose(file);
+	}
+
+	return buffer;
+}
+
+// a cart with nothing but a code chunk
+static void* makeCart(const char* code, s32* size)
+{
+	s32 length = strlen(code);
+	u8* buffer = malloc(length + 4);
+
+	buffer[0] = 5; // CHUNK_CODE
+	buffer[1] = length & 0xff;
+	buffer[2] = length >> 8 & 0xff;
+	buffer[3] = 0;
+	memcpy(buffer + 4, code, length);
+
+	*size = length + 4;
+	return buffer;
+}
+
+// a button pattern that changes every few frames, so carts react to input
+static tic80_input getInput(s32 frame)
+{
+	tic80_input input = {.data = 0};
+
+	if(frame / 20 % 3 == 1) input.first.right = input.first.a = true;
+	if(frame / 30 % 4 == 2) input.first.left = input.first.up = input.first.b = true;
+
+	return input;
+}
+
+static void startInstance(Instance* instance, const Cart* cart)
+{
+	instance->cart = cart;
+	instance->screen = instance->sound = 14695981039346656037ULL;
+	instance->tic = tic80_create(44100);
+
+	instance->tic->callback.trace = onTrace;
+	instance->tic->callback.error = onError;
+	instance->tic->callback.exit = onExit;
+
+	tic80_load(instance->tic, cart->data, cart->size);
+}
+
+static void tickInstance(Instance* instance, s32 frame)
+{
+	tic80* tic = instance->tic;
+
+	tic80_tick(tic, getInput(frame));
+
+	instance->screen = hashData(instance->screen, tic->screen, sizeof tic->screen);
+	instance->sound = hashData(instance->sound, tic->sound.samples, tic->sound.count * sizeof(s16));
+}
+
+static void* workerThread(void* data)
+{
+	Worker* worker = (Worker*)data;
+
+	for(s32 frame = 0; frame < FRAMES; frame++)
+		for(s32 i = 0; i < worker->count; i++)
+			tickInstance(&worker->instances[i], frame);
+
+	return NULL;
+}
+
+int main(int argc, char** argv)
+{
+	const char* folder = argc > 1 ? argv[1] : "../demos";
+
+	for(s32 i = 0; i < CartsCount; i++)
+	{
+		Cart* cart = &Loaded[i];
+
+		if(i < COUNT_OF(Carts))
+		{
+			char path[1024];
+			snprintf(path, sizeof path, "%s/%s", folder, Carts[i]);
+
+			cart->name = Carts[i];
+
+			if(!(cart->data = readFile(path, &cart->size)))
+			{
+				printf("test_parallel: can't read %s\n", path);
+				return 1;
+			}
+		}
+		else
+		{
+			cart->name = i == COUNT_OF(Carts) ? "lua script" : "js script";
+			cart->data = makeCart(Scripts[i - COUNT_OF(Carts)], &cart->size);
+		}
+
+		Instance instance;
+		startInstance(&instance, cart);
+
+		for(s32 frame = 0; frame < FRAMES; frame++)
+			tickInstance(&instance, frame);
+
+		cart->screen = instance.screen;
+		cart->sound = instance.sound;
+
+		tic80_delete(instance.tic);
+	}
+
+	enum {Count = CartsCount * COPIES};
+
+	static Instance Instances[Count];
+	static Worker Workers[THREADS];
+
+	for(s32 i = 0; i < Count; i++)
+		startInstance(&Instances[i], &Loaded[i % CartsCount]);
+
+	// neighbours run different carts, so every thread gets a mix of them
+	for(s32 i = 0, first = 0; i < THREADS; i++)
+	{
+		Worker* worker = &Workers[i];
+		worker->instances = &Instances[first];
+		worker->count = Count / THREADS + (i < Count % THREADS);
+		first += worker->count;
+
+		pthread_create(&worker->thread, NULL, workerThread, worker);
+	}
+
+	for(s32 i = 0; i < THREADS; i++)
+		pthread_join(Workers[i].thread, NULL);
+
+	s32 failed = 0;
+
+	for(s32 i = 0; i < Count; i++)
+	{
+		Instance* instance = &Instances[i];
+		const Cart* cart = instance->cart;
+
+		if(instance->screen != cart->screen || instance->sound != cart->sound)
+		{
+			printf("test_parallel: %s copy %i differs from the single instance run\n",
+				cart->name, i / CartsCount);
+			failed++;
+		}
+
+		tic80_delete(instance->tic);
+	}
+
+	for(s32 i = 0; i < CartsCount; i++)
+		free(Loaded[i].data);
+
+	printf("test_parallel: %i instances of %i carts on %i threads, %i frames\n",
+		Count, CartsCount, THREADS, FRAMES);
+	printf("test_parallel: %s\n", failed ? "FAILED" : "ok");
+
+	return failed ? 1 : 0;
+}
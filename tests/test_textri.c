@@ -0,0 +1,276 @@
+// MIT License
+
+// Copyright (c) 2017 Vadim Grigoruk @nesbox // grigoruk@gmail.com
+
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+// textri against the rule it draws by, worked out exactly in double: a pixel
+// is drawn when its center is inside the triangle or on a top or left edge, and
+// shows the texel under its center. The engine steps edges and uvs in 16.16, so
+// a pixel may only differ when its center is within rounding of an edge or of a
+// texel border. This is not what textri drew before the fixed point rewrite,
+// the old float walk differs on about a fifth of the pixels.
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "ticapi.h"
+#include "tools.h"
+
+#define CASES 20000
+#define NEAR (1.0 / 64)
+
+typedef struct
+{
+	s32 l, t, r, b;
+} Rect;
+
+typedef struct
+{
+	double x[3], y[3], u[3], v[3];
+	bool map;
+	u8 chroma;
+} Tri;
+
+static u8 Expected[TIC80_HEIGHT][TIC80_WIDTH];
+static bool Unsure[TIC80_HEIGHT][TIC80_WIDTH];
+
+static u32 Seed = 1;
+
+static u32 rnd()
+{
+	Seed ^= Seed << 13;
+	Seed ^= Seed >> 17;
+	Seed ^= Seed << 5;
+	return Seed;
+}
+
+// textri takes floats
+static double rndRange(double from, double to)
+{
+	return (float)(from + (to - from) * (rnd() % 100000) / 100000.0);
+}
+
+static bool nearInteger(double value)
+{
+	return fabs(value - floor(value + 0.5)) < NEAR;
+}
+
+static s32 wrap(s32 value, s32 size)
+{
+	value %= size;
+	return value < 0 ? value + size : value;
+}
+
+static u8 sample(tic_mem* memory, const Tri* tri, double u, double v)
+{
+	s32 iu = (s32)floor(u), iv = (s32)floor(v);
+	s32 tile;
+
+	if(tri->map)
+	{
+		iu = wrap(iu, TIC_MAP_WIDTH * TIC_SPRITESIZE);
+		iv = wrap(iv, TIC_MAP_HEIGHT * TIC_SPRITESIZE);
+		tile = memory->ram.gfx.map.data[(iv >> 3) * TIC_MAP_WIDTH + (iu >> 3)];
+	}
+	else
+	{
+		iu &= TIC_SPRITESHEET_SIZE - 1;
+		iv &= TIC_SPRITESHEET_SIZE * TIC_SPRITE_BANKS - 1;
+		tile = (iu >> 3) + (iv >> 3) * (TIC_SPRITESHEET_SIZE / TIC_SPRITESIZE);
+	}
+
+	// the sheet goes on from the tiles into the sprites
+	const u8* texels = memory->ram.gfx.tiles[0].data + tile * sizeof(tic_tile);
+
+	return tic_tool_peek4(texels, (iu & 7) + ((iv & 7) << 3));
+}
+
+static void drawExpected(tic_mem* memory, const Rect* clip, const Tri* tri, u8 background)
+{
+	const double* x = tri->x;
+	const double* y = tri->y;
+	double det = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+
+	memset(Expected, background, sizeof Expected);
+	memset(Unsure, 0, sizeof Unsure);
+
+	if(det == 0)
+		return;
+
+	for(s32 row = clip->t; row < clip->b; row++)
+	{
+		double yc = row + 0.5;
+		double left = 0, right = 0;
+		bool crossed = false;
+
+		for(s32 a = 0; a < 3; a++)
+		{
+			s32 b = (a + 1) % 3;
+
+			if((yc >= y[a] && yc < y[b]) || (yc >= y[b] && yc < y[a]))
+			{
+				double xc = x[a] + (yc - y[a]) * (x[b] - x[a]) / (y[b] - y[a]);
+
+				if(!crossed || xc < left) left = xc;
+				if(!crossed || xc > right) right = xc;
+
+				crossed = true;
+			}
+		}
+
+		for(s32 col = clip->l; crossed && col < clip->r; col++)
+		{
+			double xc = col + 0.5;
+
+			if(fabs(xc - left) < NEAR || fabs(xc - right) < NEAR)
+				Unsure[row][col] = true;
+
+			if(xc < left || xc >= right)
+				continue;
+
+			// barycentric weights of the pixel center
+			double w1 = ((xc - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (yc - y[0])) / det;
+			double w2 = ((x[1] - x[0]) * (yc - y[0]) - (xc - x[0]) * (y[1] - y[0])) / det;
+			double w0 = 1 - w1 - w2;
+
+			double u = w0 * tri->u[0] + w1 * tri->u[1] + w2 * tri->u[2];
+			double v = w0 * tri->v[0] + w1 * tri->v[1] + w2 * tri->v[2];
+
+			if(nearInteger(u) || nearInteger(v))
+				Unsure[row][col] = true;
+
+			u8 color = sample(memory, tri, u, v);
+
+			if(color != tri->chroma)
+				Expected[row][col] = color;
+		}
+	}
+}
+
+// pixels that differ away from edges and texel borders
+static s32 compare(tic_mem* memory, s32* unsure)
+{
+	s32 wrong = 0;
+
+	for(s32 y = 0; y < TIC80_HEIGHT; y++)
+		for(s32 x = 0; x < TIC80_WIDTH; x++)
+			if(memory->api.get_pixel(memory, x, y) != Expected[y][x])
+			{
+				if(Unsure[y][x]) (*unsure)++;
+				else wrong++;
+			}
+
+	return wrong;
+}
+
+static bool testTri(tic_mem* memory, const Rect* clip, const Tri* tri, bool depth, s32* unsure)
+{
+	// the same depth everywhere, so the perspective path has to match the affine one
+	float z = depth ? 3.5f : 0;
+	u8 background = 15;
+
+	memory->api.clip(memory, 0, 0, TIC80_WIDTH, TIC80_HEIGHT);
+	memory->api.clear(memory, background);
+	memory->api.clip(memory, clip->l, clip->t, clip->r - clip->l, clip->b - clip->t);
+
+	memory->api.textri(memory,
+		(float)tri->x[0], (float)tri->y[0], (float)tri->x[1], (float)tri->y[1], (float)tri->x[2], (float)tri->y[2],
+		(float)tri->u[0], (float)tri->v[0], (float)tri->u[1], (float)tri->v[1], (float)tri->u[2], (float)tri->v[2],
+		tri->map, tri->chroma, z, z, z, depth);
+
+	drawExpected(memory, clip, tri, background);
+
+	s32 wrong = compare(memory, unsure);
+
+	if(wrong)
+		printf("test_textri: %i pixels differ for (%g,%g) (%g,%g) (%g,%g) uv (%g,%g) (%g,%g) (%g,%g)%s%s\n", wrong,
+			tri->x[0], tri->y[0], tri->x[1], tri->y[1], tri->x[2], tri->y[2],
+			tri->u[0], tri->v[0], tri->u[1], tri->v[1], tri->u[2], tri->v[2],
+			tri->map ? " map" : "", depth ? " depth" : "");
+
+	return wrong == 0;
+}
+
+int main(int argc, char** argv)
+{
+	tic_mem* memory = tic_create(44100);
+
+	for(s32 i = 0; i < sizeof(tic_gfx); i++)
+		((u8*)&memory->ram.gfx)[i] = rnd();
+
+	memory->api.invalidate(memory, &memory->ram.gfx, sizeof memory->ram.gfx);
+
+	const Rect screen = {0, 0, TIC80_WIDTH, TIC80_HEIGHT};
+
+	bool ok = true;
+	s32 unsure = 0;
+
+	for(s32 i = 0; i < CASES && ok; i++)
+	{
+		// mostly on screen, every tenth one much bigger than it and every tenth with a vertex far away
+		double size = i % 10 ? 300 : 5000;
+		double uvSize = i % 4 ? 200 : 3000;
+
+		Tri tri = {.map = i & 1, .chroma = rnd() % 16};
+
+		for(s32 v = 0; v < 3; v++)
+		{
+			tri.x[v] = rndRange(TIC80_WIDTH / 2 - size / 2, TIC80_WIDTH / 2 + size / 2);
+			tri.y[v] = rndRange(TIC80_HEIGHT / 2 - size / 2, TIC80_HEIGHT / 2 + size / 2);
+			tri.u[v] = rndRange(-uvSize, uvSize);
+			tri.v[v] = rndRange(-uvSize, uvSize);
+		}
+
+		// one vertex far off screen, edges steep enough to cross the whole screen between two rows
+		if(i % 10 == 5)
+		{
+			s32 v = rnd() % 3;
+			double far = rndRange(1e6, 1e12) * (rnd() & 1 ? 1 : -1);
+
+			if(rnd() & 1) tri.x[v] = far;
+			else tri.y[v] = far;
+		}
+
+		// quarters, halves and integers land right on pixel centers and texel borders
+		if(i % 5 == 0)
+			for(s32 v = 0; v < 3; v++)
+				tri.x[v] = floor(tri.x[v] * 4) / 4, tri.y[v] = floor(tri.y[v] * 2) / 2, tri.u[v] = floor(tri.u[v]);
+
+		Rect clip = screen;
+
+		if(i % 3 == 0)
+		{
+			clip.l = rnd() % TIC80_WIDTH;
+			clip.t = rnd() % TIC80_HEIGHT;
+			clip.r = clip.l + 1 + rnd() % (TIC80_WIDTH - clip.l);
+			clip.b = clip.t + 1 + rnd() % (TIC80_HEIGHT - clip.t);
+		}
+
+		ok = testTri(memory, &clip, &tri, i % 7 == 0, &unsure);
+	}
+
+	tic_close(memory);
+
+	printf("test_textri: %i triangles, %i pixels off by rounding at edges or texel borders\n", CASES, unsure);
+	printf("test_textri: %s\n", ok ? "ok" : "FAILED");
+
+	return ok ? 0 : 1;
+}